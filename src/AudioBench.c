@@ -0,0 +1,243 @@
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <libavutil/lfg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "SampleConvert.h"
+
+#define MAX_CHANNELS 8
+
+/*
+ * Time every SampleConvert kernel at every level the CPU runs, on blocks the size of a decoded frame.
+ * The output of each level is compared to the scalar one first, a mismatch is reported and not timed.
+ *   Msamples/s counts the samples of all channels, MB/s the bytes read
+ */
+typedef struct BenchData{
+    int channels;
+    int nb_samples;
+    float *planar[MAX_CHANNELS];
+    int16_t *planar_s16[MAX_CHANNELS];
+    float *mixed[2];            //the channels mixed down to stereo
+    float *mixed_ref[2];
+    float matrix[2*MAX_CHANNELS];
+    float *flt;
+    int16_t *s16;
+    float *flt_out;
+    int16_t *s16_out;
+    float *flt_ref;
+    int16_t *s16_ref;
+}BenchData;
+
+enum{
+    KERNEL_INTERLEAVE_FLT,
+    KERNEL_INTERLEAVE_S16,
+    KERNEL_FLTP_TO_S16,
+    KERNEL_MIX_FLTP,
+    KERNEL_FLT_TO_S16,
+    KERNEL_S16_TO_FLT,
+    KERNEL_GAIN_FLT,
+    KERNEL_GAIN_S16,
+    KERNEL_NUMBER,
+};
+
+static const char *kernel_names[] = {
+    "interleave_flt",
+    "interleave_s16",
+    "fltp_to_s16",
+    "mix_fltp",
+    "flt_to_s16",
+    "s16_to_flt",
+    "gain_flt",
+    "gain_s16",
+};
+
+/* bytes read per sample */
+static const int kernel_bytes[] = {4, 2, 4, 4, 4, 2, 4, 2};
+
+static int BenchDataInit(BenchData *d, int channels, int nb_samples){
+    AVLFG lfg;
+    int n = channels*nb_samples;
+    int i, ch;
+
+    memset(d, 0, sizeof(BenchData));
+    d->channels = channels;
+    d->nb_samples = nb_samples;
+    for(ch=0; ch<channels; ch++){
+        d->planar[ch] = av_malloc(nb_samples*sizeof(float));
+        d->planar_s16[ch] = av_malloc(nb_samples*sizeof(int16_t));
+        if(!d->planar[ch] || !d->planar_s16[ch])
+            return -1;
+    }
+    for(ch=0; ch<2; ch++){
+        d->mixed[ch] = av_malloc(nb_samples*sizeof(float));
+        d->mixed_ref[ch] = av_malloc(nb_samples*sizeof(float));
+        if(!d->mixed[ch] || !d->mixed_ref[ch])
+            return -1;
+    }
+    d->flt = av_malloc(n*sizeof(float));
+    d->s16 = av_malloc(n*sizeof(int16_t));
+    d->flt_out = av_malloc(n*sizeof(float));
+    d->s16_out = av_malloc(n*sizeof(int16_t));
+    d->flt_ref = av_malloc(n*sizeof(float));
+    d->s16_ref = av_malloc(n*sizeof(int16_t));
+    if(!d->flt || !d->s16 || !d->flt_out || !d->s16_out || !d->flt_ref || !d->s16_ref)
+        return -1;
+
+    //every input goes to one side or both, like a downmix to stereo
+    for(ch=0; ch<channels; ch++){
+        d->matrix[ch] = ch%2 == 0 || ch == channels-1 ? 0.4f : 0.0f;
+        d->matrix[channels+ch] = ch%2 == 1 || ch == channels-1 ? 0.4f : 0.0f;
+    }
+
+    //a little over full scale so the clipping paths run too
+    av_lfg_init(&lfg, 0x5eed);
+    for(ch=0; ch<channels; ch++){
+        for(i=0; i<nb_samples; i++){
+            d->planar[ch][i] = (av_lfg_get(&lfg)/(float)UINT32_MAX - 0.5f)*2.2f;
+            d->planar_s16[ch][i] = av_lfg_get(&lfg);
+        }
+    }
+    for(i=0; i<n; i++){
+        d->flt[i] = (av_lfg_get(&lfg)/(float)UINT32_MAX - 0.5f)*2.2f;
+        d->s16[i] = av_lfg_get(&lfg);
+    }
+    return 0;
+}
+
+static void BenchDataFree(BenchData *d){
+    int ch;
+
+    for(ch=0; ch<d->channels; ch++){
+        av_freep(&d->planar[ch]);
+        av_freep(&d->planar_s16[ch]);
+    }
+    for(ch=0; ch<2; ch++){
+        av_freep(&d->mixed[ch]);
+        av_freep(&d->mixed_ref[ch]);
+    }
+    av_freep(&d->flt);
+    av_freep(&d->s16);
+    av_freep(&d->flt_out);
+    av_freep(&d->s16_out);
+    av_freep(&d->flt_ref);
+    av_freep(&d->s16_ref);
+}
+
+/*
+ * The gain kernels work in place, they get a fresh copy of the input on every run.
+ * The mix kernel writes the planes of mixed.
+ */
+static void RunKernel(BenchData *d, int kernel, float *flt_out, int16_t *s16_out, float **mixed){
+    int n = d->channels*d->nb_samples;
+
+    switch(kernel){
+    case KERNEL_INTERLEAVE_FLT :
+        sample_interleave_flt(flt_out, (const float **)d->planar, d->channels, d->nb_samples);
+        break;
+    case KERNEL_INTERLEAVE_S16 :
+        sample_interleave_s16(s16_out, (const int16_t **)d->planar_s16, d->channels, d->nb_samples);
+        break;
+    case KERNEL_FLTP_TO_S16 :
+        sample_fltp_to_s16(s16_out, (const float **)d->planar, d->channels, d->nb_samples);
+        break;
+    case KERNEL_MIX_FLTP :
+        sample_mix_fltp(mixed, 2, (const float **)d->planar, d->channels, d->matrix, d->nb_samples);
+        break;
+    case KERNEL_FLT_TO_S16 :
+        sample_flt_to_s16(s16_out, d->flt, n);
+        break;
+    case KERNEL_S16_TO_FLT :
+        sample_s16_to_flt(flt_out, d->s16, n);
+        break;
+    case KERNEL_GAIN_FLT :
+        memcpy(flt_out, d->flt, n*sizeof(float));
+        sample_gain_flt(flt_out, 0.8f, n);
+        break;
+    case KERNEL_GAIN_S16 :
+        memcpy(s16_out, d->s16, n*sizeof(int16_t));
+        sample_gain_s16(s16_out, 1.3f, n);
+        break;
+    default :
+        break;
+    }
+}
+
+static int OutputIsFloat(int kernel){
+    return kernel == KERNEL_INTERLEAVE_FLT || kernel == KERNEL_S16_TO_FLT || kernel == KERNEL_GAIN_FLT;
+}
+
+static void RunBench(BenchData *d, int kernel, int level, int64_t iterations){
+    int n = d->channels*d->nb_samples;
+    int64_t start, elapsed, k;
+    int mismatch;
+
+    sample_kernel_force(SAMPLE_KERNEL_SCALAR);
+    RunKernel(d, kernel, d->flt_ref, d->s16_ref, d->mixed_ref);
+    sample_kernel_force(level);
+    RunKernel(d, kernel, d->flt_out, d->s16_out, d->mixed);
+    if(kernel == KERNEL_MIX_FLTP)
+        mismatch = memcmp(d->mixed_ref[0], d->mixed[0], d->nb_samples*sizeof(float))
+            || memcmp(d->mixed_ref[1], d->mixed[1], d->nb_samples*sizeof(float));
+    else if(OutputIsFloat(kernel))
+        mismatch = memcmp(d->flt_ref, d->flt_out, n*sizeof(float));
+    else
+        mismatch = memcmp(d->s16_ref, d->s16_out, n*sizeof(int16_t));
+    if(mismatch){
+        fprintf(stdout, "%-15s %-7s output differs from scalar\n", kernel_names[kernel], sample_kernel_name(level));
+        return;
+    }
+
+    start = av_gettime_relative();
+    for(k=0; k<iterations; k++)
+        RunKernel(d, kernel, d->flt_out, d->s16_out, d->mixed);
+    elapsed = av_gettime_relative() - start;
+    if(elapsed <= 0)
+        elapsed = 1;
+
+    fprintf(stdout, "%-15s %-7s %8.1f ms %9.1f Msamples/s %9.1f MB/s\n", kernel_names[kernel], sample_kernel_name(level),
+            elapsed/1000.0, (double)n*iterations/elapsed, (double)n*iterations*kernel_bytes[kernel]/elapsed);
+}
+
+int main(int argc, char *argv[]){
+    BenchData data;
+    int channels = 2, nb_samples = 1024, top;
+    int64_t iterations = 100000;
+    int i, j;
+
+    for(i=1; i<argc && argv[i][0]=='-'; i++){
+        if(!strcmp(argv[i], "-channels") && i+1<argc)
+            channels = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-samples") && i+1<argc)
+            nb_samples = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-iterations") && i+1<argc)
+            iterations = atoll(argv[++i]);
+        else
+            goto usage;
+    }
+    if(i<argc || channels<=0 || channels>MAX_CHANNELS || nb_samples<=0 || iterations<=0)
+        goto usage;
+
+    if(BenchDataInit(&data, channels, nb_samples) < 0){
+        fprintf(stderr, "cannot allocate the sample buffers\n");
+        BenchDataFree(&data);
+        return -1;
+    }
+
+    //forcing the top level gives back the best one the CPU runs
+    top = sample_kernel_force(SAMPLE_KERNEL_AVX2);
+    fprintf(stdout, "%d channels x %d samples, %lld iterations, best kernels: %s\n",
+            channels, nb_samples, (long long)iterations, sample_kernel_name(top));
+    for(j=0; j<KERNEL_NUMBER; j++)
+        for(i=SAMPLE_KERNEL_SCALAR; i<=top; i++)
+            RunBench(&data, j, i, iterations);
+
+    BenchDataFree(&data);
+    return 0;
+
+usage:
+    fprintf(stderr, "Usage: %s [-channels n] [-samples n] [-iterations n]\n", argv[0]);
+    return -1;
+}
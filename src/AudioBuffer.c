@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <string.h>
+#include <libavutil/time.h>
+#include <libavutil/common.h>
+#include "Queue.h"
+#include "AudioBuffer.h"
+
+void audio_buffer_init(AudioBufferControl *ab, int target_ms, int adaptive){
+    memset(ab, 0, sizeof(AudioBufferControl));
+    ab->adaptive = adaptive;
+    ab->max_target = (target_ms > 0 ? target_ms : AUDIO_BUFFER_MS)*1000LL;
+    ab->target = adaptive ? FFMIN(AUDIO_BUFFER_START_MS*1000LL, ab->max_target) : ab->max_target;
+}
+
+/* a power of two, what most backends do best */
+int audio_buffer_wanted_samples(AudioBufferControl *ab, int freq){
+    int64_t n = av_rescale(ab->target, freq, 1000000)/AUDIO_BUFFER_CALLBACKS;
+    int samples = AUDIO_BUFFER_MIN_SAMPLES;
+
+    while(samples*2 <= n && samples*2 <= AUDIO_BUFFER_MAX_SAMPLES)
+        samples *= 2;
+    return samples;
+}
+
+/* the device buffer is part of the target, the queue holds the rest rounded up */
+static int target_frames(AudioBufferControl *ab){
+    int64_t callback = av_rescale(ab->samples, 1000000, ab->freq);
+    int64_t frames;
+
+    if(callback <= 0)
+        return AUDIO_BUFFER_MIN_FRAMES;
+    frames = (ab->target + callback - 1)/callback - 1;
+    return av_clip(frames, AUDIO_BUFFER_MIN_FRAMES, FRAME_QUEUE_MAX);
+}
+
+int audio_buffer_open(AudioBufferControl *ab, int freq, int samples){
+    ab->freq = freq;
+    ab->samples = samples;
+    ab->frames = target_frames(ab);
+    fprintf(stdout, "audio buffer: target %lld ms%s, %d samples per callback, %d frames queued\n",
+            (long long)(ab->target/1000), ab->adaptive ? " adaptive" : "", samples, ab->frames);
+    return ab->frames;
+}
+
+void audio_buffer_underrun(AudioBufferControl *ab, int64_t silence){
+    if(!ab->in_underrun){
+        ab->in_underrun = 1;
+        ab->underrun_silence = 0;
+        SDL_AtomicAdd(&ab->underruns, 1);
+    }
+    ab->underrun_silence += silence;
+}
+
+void audio_buffer_played(AudioBufferControl *ab){
+    if(!ab->in_underrun)
+        return;
+    ab->in_underrun = 0;
+    ab->underrun_time += ab->underrun_silence;
+    ab->max_underrun = FFMAX(ab->max_underrun, ab->underrun_silence);
+    ab->last_underrun = ab->underrun_silence;
+    SDL_AtomicAdd(&ab->ended, 1);
+}
+
+/* the device is locked only when there is something to publish */
+int audio_buffer_publish(AudioBufferControl *ab, SDL_AudioDeviceID dev){
+    int ended = SDL_AtomicGet(&ab->ended);
+    int64_t last, total;
+    int n = ended - ab->published;
+
+    if(n <= 0)
+        return 0;
+    SDL_LockAudioDevice(dev);
+    last = ab->last_underrun;
+    total = ab->underrun_time;
+    SDL_UnlockAudioDevice(dev);
+    ab->published = ended;
+    fprintf(stdout, "audio underrun: %lld ms of silence%s, %d underruns %lld ms in total\n",
+            (long long)(last/1000), n > 1 ? " last" : "", ended, (long long)(total/1000));
+    return n;
+}
+
+int audio_buffer_update(AudioBufferControl *ab){
+    int underruns = SDL_AtomicGet(&ab->underruns);
+    int64_t now;
+
+    if(!ab->adaptive || underruns == ab->grown_underruns)
+        return 0;
+    //one burst of underruns grows the target once, the queue needs time to fill up
+    now = av_gettime_relative();
+    ab->grown_underruns = underruns;
+    if(ab->target >= ab->max_target || (ab->last_grow && now - ab->last_grow < AUDIO_BUFFER_GROW_INTERVAL))
+        return 0;
+
+    ab->target = FFMIN(ab->target*2, ab->max_target);
+    ab->last_grow = now;
+    ab->grows++;
+    ab->frames = target_frames(ab);
+    fprintf(stdout, "audio buffer: %d underruns, target grown to %lld ms, %d frames queued\n",
+            underruns, (long long)(ab->target/1000), ab->frames);
+    return ab->frames;
+}
+
+int64_t audio_buffer_latency(AudioBufferControl *ab, int64_t queued){
+    if(ab->freq <= 0)
+        return queued;
+    return av_rescale(ab->samples, 1000000, ab->freq) + queued;
+}
+
+int audio_buffer_underruns(AudioBufferControl *ab){
+    return SDL_AtomicGet(&ab->underruns);
+}
+
+void audio_buffer_log(AudioBufferControl *ab, int64_t queued){
+    fprintf(stdout, "audio buffer: target %lld ms, latency %lld ms, %d underruns %lld ms max %lld ms, grown %d times\n",
+            (long long)(ab->target/1000), (long long)(audio_buffer_latency(ab, queued)/1000), audio_buffer_underruns(ab),
+            (long long)(ab->underrun_time/1000), (long long)(ab->max_underrun/1000), ab->grows);
+}
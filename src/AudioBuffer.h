@@ -0,0 +1,63 @@
+#ifndef __INCLUDED_AUDIOBUFFER_H__
+#define __INCLUDED_AUDIOBUFFER_H__
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+#define AUDIO_BUFFER_MS          200    //default target latency, device buffer plus decoded audio queued
+#define AUDIO_BUFFER_START_MS    30     //adaptive mode starts here and grows up to the target
+#define AUDIO_BUFFER_CALLBACKS   4      //the device buffer is about this part of the starting target
+#define AUDIO_BUFFER_MIN_SAMPLES 256
+#define AUDIO_BUFFER_MAX_SAMPLES 8192
+#define AUDIO_BUFFER_MIN_FRAMES  2      //frames queued at least, one being played and one ahead
+#define AUDIO_BUFFER_GROW_INTERVAL 1000000 //usecond, underruns closer than this grow the target once
+
+/*
+ * Audio latency given in milliseconds instead of samples and queue slots.
+ * The device buffer is sized from the starting target before the device is opened,
+ * the frames of one callback queued after it from the format the device hands out.
+ * In adaptive mode the target starts at AUDIO_BUFFER_START_MS and is doubled after
+ * underruns up to max_target, only the queue grows, the device keeps its buffer.
+ * An underrun lasts from the first callback short of data to the next one filled,
+ * the silence played in between is its duration.
+ */
+typedef struct AudioBufferControl{
+    int adaptive;
+    int64_t target;             //usecond, device buffer plus queued frames
+    int64_t max_target;
+    int samples;                //per callback, the device buffer
+    int freq;
+    int frames;                 //frames of one callback queued
+    SDL_atomic_t underruns;     //started, counted by the audio callback
+    int grown_underruns;        //underruns the target has grown for
+    int64_t last_grow;
+    int grows;
+
+    /* written by the audio callback, read with the device locked */
+    int in_underrun;
+    int64_t underrun_silence;   //usecond of silence played in the current underrun
+    int64_t underrun_time;      //usecond of silence of all the underruns ended
+    int64_t max_underrun;
+    int64_t last_underrun;      //usecond of silence of the last underrun ended
+    SDL_atomic_t ended;         //underruns ended
+    int published;              //underruns ended and published by the main thread
+}AudioBufferControl;
+
+/* target_ms <= 0 for AUDIO_BUFFER_MS */
+void audio_buffer_init(AudioBufferControl *ab, int target_ms, int adaptive);
+/* samples per callback to ask the device for at freq */
+int audio_buffer_wanted_samples(AudioBufferControl *ab, int freq);
+/* with the format obtained from the device, return the frames to queue */
+int audio_buffer_open(AudioBufferControl *ab, int freq, int samples);
+/* from the audio callback, silence usecond played for want of data while playing */
+void audio_buffer_underrun(AudioBufferControl *ab, int64_t silence);
+/* from the audio callback, a callback not short of data ends the underrun */
+void audio_buffer_played(AudioBufferControl *ab);
+/* from the main thread, print the underruns ended since the last call, return their number */
+int audio_buffer_publish(AudioBufferControl *ab, SDL_AudioDeviceID dev);
+/* adaptive mode, return the frames to queue when the target has grown, 0 otherwise */
+int audio_buffer_update(AudioBufferControl *ab);
+/* usecond of audio between the decoder and the speaker, queued: usecond of decoded audio queued */
+int64_t audio_buffer_latency(AudioBufferControl *ab, int64_t queued);
+int audio_buffer_underruns(AudioBufferControl *ab);
+void audio_buffer_log(AudioBufferControl *ab, int64_t queued);
+#endif
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <string.h>
+#include <libavutil/time.h>
+#include "AudioPush.h"
+
+void audio_push_init(AudioPush *ap, SDL_AudioDeviceID dev, int chunk, double usecond_per_byte){
+    memset(ap, 0, sizeof(AudioPush));
+    ap->dev = dev;
+    ap->chunk = chunk;
+    ap->usecond_per_byte = usecond_per_byte;
+}
+
+int audio_push_queued(AudioPush *ap){
+    return SDL_GetQueuedAudioSize(ap->dev);
+}
+
+int audio_push_room(AudioPush *ap){
+    return audio_push_queued(ap) + ap->chunk <= AUDIO_PUSH_CHUNKS*ap->chunk;
+}
+
+int audio_push_starving(AudioPush *ap){
+    return audio_push_queued(ap) < ap->chunk;
+}
+
+int audio_push(AudioPush *ap, const uint8_t *buf, int media, int64_t pts){
+    AudioPushMark *m;
+    int ret;
+
+    ret = SDL_QueueAudio(ap->dev, buf, ap->chunk);
+    if(ret < 0){
+        fprintf(stderr, "SDL_QueueAudio failed, reason:%s\n", SDL_GetError());
+        return ret;
+    }
+    //nobody took the clock for long, the oldest mark is of no use
+    if(ap->nb == AUDIO_PUSH_MARKS){
+        ap->first = (ap->first + 1) % AUDIO_PUSH_MARKS;
+        ap->nb--;
+    }
+    m = &ap->marks[(ap->first + ap->nb) % AUDIO_PUSH_MARKS];
+    m->media_end = ap->pushed + media;
+    m->end = ap->pushed + ap->chunk;
+    m->pts = pts;
+    ap->nb++;
+    ap->pushed += ap->chunk;
+    ap->pushes++;
+    return 0;
+}
+
+int audio_push_clock(AudioPush *ap, int64_t *pts, int *held){
+    int queued = audio_push_queued(ap);
+    int64_t played = ap->pushed - queued;
+    int dry = !queued && ap->pushed && SDL_GetAudioDeviceStatus(ap->dev) == SDL_AUDIO_PLAYING;
+    AudioPushMark *m;
+
+    if(dry && !ap->was_dry)
+        ap->dry++;
+    if(played == ap->played && dry == ap->was_dry)
+        return 0;
+    ap->played = played;
+    ap->was_dry = dry;
+
+    //the first mark not played to its end, the last one is kept for a dry queue
+    while(ap->nb > 1 && ap->marks[ap->first].end < played){
+        ap->first = (ap->first + 1) % AUDIO_PUSH_MARKS;
+        ap->nb--;
+    }
+    if(ap->nb == 0)
+        return 0;
+    m = &ap->marks[ap->first];
+    if(played <= m->media_end){
+        *pts = m->pts - (int64_t)((m->media_end - played)*ap->usecond_per_byte);
+        *held = dry;
+    }else{
+        *pts = m->pts;
+        *held = 1;
+    }
+    return 1;
+}
+
+void audio_push_clear(AudioPush *ap){
+    SDL_ClearQueuedAudio(ap->dev);
+    ap->pushed = ap->played = 0;
+    ap->first = ap->nb = 0;
+    ap->was_dry = 0;
+}
+
+void audio_push_wait(AudioPush *ap){
+    ap->wakeups++;
+    av_usleep((unsigned)(ap->chunk*ap->usecond_per_byte/AUDIO_PUSH_WAKEUPS));
+}
+
+void audio_push_log(AudioPush *ap){
+    fprintf(stdout, "audio push: %lld wakeups, %lld chunks of %d bytes pushed, found dry %d times\n",
+            (long long)ap->wakeups, (long long)ap->pushes, ap->chunk, ap->dry);
+}
@@ -0,0 +1,59 @@
+#ifndef __INCLUDED_AUDIOPUSH_H__
+#define __INCLUDED_AUDIOPUSH_H__
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+#define AUDIO_PUSH_CHUNKS 2     //device buffers kept queued ahead of the device
+#define AUDIO_PUSH_MARKS  16    //chunks remembered for the clock, more than ever queued
+#define AUDIO_PUSH_WAKEUPS 4    //wakeups per device buffer, the clock is late by one period of them at most
+
+/*
+ * Push mode audio output: the device is opened without a callback and the chunks of one device buffer
+ * are queued with SDL_QueueAudio. SDL copies the queue to the device a device buffer at a time,
+ * what has been played is what was pushed less what is still queued.
+ * Every chunk leaves a mark, the bytes of audio at its head, the silence after them and the pts
+ * at the end of its audio, so the clock follows the queue as it drains, held over the silence.
+ */
+typedef struct AudioPushMark{
+    int64_t media_end;          //bytes pushed at the end of the audio of the chunk
+    int64_t end;                //bytes pushed at the end of the chunk
+    int64_t pts;                //usecond, at media_end
+}AudioPushMark;
+
+typedef struct AudioPush{
+    SDL_AudioDeviceID dev;
+    int chunk;                  //bytes of one device buffer
+    double usecond_per_byte;
+    int64_t pushed;             //bytes queued since the start or the last clear
+    AudioPushMark marks[AUDIO_PUSH_MARKS];
+    int first;
+    int nb;
+    int64_t played;             //bytes played the last time the clock was taken
+
+    /* stats */
+    int64_t wakeups;
+    int64_t pushes;
+    int dry;                    //the queue was found empty while the device played
+    int was_dry;
+}AudioPush;
+
+void audio_push_init(AudioPush *ap, SDL_AudioDeviceID dev, int chunk, double usecond_per_byte);
+/* bytes queued, not played yet */
+int audio_push_queued(AudioPush *ap);
+/* 1 when one more chunk fits below AUDIO_PUSH_CHUNKS */
+int audio_push_room(AudioPush *ap);
+/* 1 when the device takes the last chunk queued at its next period, silence has to follow */
+int audio_push_starving(AudioPush *ap);
+/* queue a chunk with media bytes of audio at its head, pts at the end of them */
+int audio_push(AudioPush *ap, const uint8_t *buf, int media, int64_t pts);
+/*
+ * The pts played and whether the device plays silence, 1 when it has changed since the last call,
+ * 0 when the device has not taken anything since.
+ */
+int audio_push_clock(AudioPush *ap, int64_t *pts, int *held);
+/* drop the queue, with the device locked by the caller */
+void audio_push_clear(AudioPush *ap);
+/* sleep one wakeup period */
+void audio_push_wait(AudioPush *ap);
+void audio_push_log(AudioPush *ap);
+#endif
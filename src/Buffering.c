@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <string.h>
+#include <libavutil/time.h>
+#include <libavutil/common.h>
+#include "Buffering.h"
+
+static const char *state_names[] = {
+    "prebuffer",
+    "playing",
+    "rebuffer",
+    "seeking",
+};
+
+void buffer_init(BufferControl *bc){
+    memset(bc, 0, sizeof(BufferControl));
+    bc->state = BUFFER_PREBUFFER;
+    bc->low = BUFFER_LOW_WATERMARK;
+    bc->high = BUFFER_HIGH_WATERMARK;
+    bc->max_high = BUFFER_MAX_HIGH_WATERMARK;
+    bc->init_time = av_gettime_relative();
+    bc->state_time = bc->init_time;
+    bc->start_latency = -1;
+}
+
+void buffer_set_watermarks(BufferControl *bc, int64_t low, int64_t high, int64_t max_high){
+    bc->low = low;
+    bc->high = high;
+    bc->max_high = FFMAX(max_high, high);
+}
+
+static void set_state(BufferControl *bc, int state, int64_t buffered, int64_t now){
+    fprintf(stdout, "buffering: %s -> %s after %lld ms, %lld ms buffered\n", state_names[bc->state], state_names[state],
+            (long long)((now - bc->state_time)/1000), (long long)(buffered/1000));
+    bc->state = state;
+    bc->state_time = now;
+}
+
+static void grow(BufferControl *bc){
+    if(bc->high >= bc->max_high)
+        return;
+    bc->high = FFMIN(bc->high*2, bc->max_high);
+    bc->low = FFMIN(bc->low*2, bc->high/2);
+    bc->grows++;
+    fprintf(stdout, "buffering: watermarks grown to %lld/%lld ms\n", (long long)(bc->low/1000), (long long)(bc->high/1000));
+}
+
+int buffer_update(BufferControl *bc, int64_t buffered, int eof){
+    int64_t now = av_gettime_relative();
+
+    switch(bc->state){
+    case BUFFER_PREBUFFER :
+        if(buffered >= bc->high || eof){
+            bc->start_latency = now - bc->init_time;
+            set_state(bc, BUFFER_PLAYING, buffered, now);
+        }
+        break;
+    case BUFFER_SEEKING :
+        if(buffered >= bc->low || eof)
+            set_state(bc, BUFFER_PLAYING, buffered, now);
+        break;
+    case BUFFER_REBUFFER :
+        if(buffered >= bc->high || eof){
+            bc->rebuffer_time += now - bc->state_time;
+            set_state(bc, BUFFER_PLAYING, buffered, now);
+        }
+        break;
+    case BUFFER_PLAYING :
+        //the queues run dry at the end of file, that is not an underrun
+        if(buffered < bc->low && !eof){
+            bc->rebuffers++;
+            if(bc->last_rebuffer && now - bc->last_rebuffer < BUFFER_GROW_WINDOW)
+                grow(bc);
+            bc->last_rebuffer = now;
+            set_state(bc, BUFFER_REBUFFER, buffered, now);
+        }
+        break;
+    default :
+        break;
+    }
+    return bc->state == BUFFER_PLAYING;
+}
+
+/* the queues are flushed by seeking, only the low watermark is waited for to keep seeking fast */
+void buffer_seek(BufferControl *bc){
+    int64_t now = av_gettime_relative();
+
+    if(bc->state == BUFFER_REBUFFER)
+        bc->rebuffer_time += now - bc->state_time;
+    if(bc->state != BUFFER_PREBUFFER){
+        bc->state = BUFFER_SEEKING;
+        bc->state_time = now;
+    }
+}
+
+int buffer_playing(BufferControl *bc){
+    return bc->state == BUFFER_PLAYING;
+}
+
+void buffer_log(BufferControl *bc){
+    fprintf(stdout, "buffering: startup %lld ms, %d rebuffers %lld ms, watermarks %lld/%lld ms grown %d times\n",
+            (long long)(bc->start_latency >= 0 ? bc->start_latency/1000 : -1), bc->rebuffers, (long long)(bc->rebuffer_time/1000),
+            (long long)(bc->low/1000), (long long)(bc->high/1000), bc->grows);
+}
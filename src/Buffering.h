@@ -0,0 +1,43 @@
+#ifndef __INCLUDED_BUFFERING_H__
+#define __INCLUDED_BUFFERING_H__
+#include <stdint.h>
+
+/* states of the buffering controller */
+#define BUFFER_PREBUFFER    0   //startup, the clock is held until the high watermark
+#define BUFFER_PLAYING      1
+#define BUFFER_REBUFFER     2   //fell below the low watermark, the clock is held until the high watermark
+#define BUFFER_SEEKING      3   //after a seek, the clock is held until the low watermark
+
+#define BUFFER_LOW_WATERMARK      200000   //usecond of buffered media per stream
+#define BUFFER_HIGH_WATERMARK    1000000
+#define BUFFER_MAX_HIGH_WATERMARK 8000000
+#define BUFFER_GROW_WINDOW      30000000   //usecond, a rebuffer this soon after the last one grows the watermarks
+
+/*
+ * Fed with the smallest buffered duration of the streams playing, queued packets plus decoded data.
+ * Repeated rebuffers mean the input cannot keep up with the watermarks,
+ * both of them are doubled up to max_high, BUFFER_MAX_HIGH_WATERMARK by default.
+ */
+typedef struct BufferControl{
+    int state;
+    int64_t low;
+    int64_t high;
+    int64_t max_high;           //the watermarks grow up to this
+    int64_t init_time;
+    int64_t state_time;         //wall time the state is entered
+    int64_t start_latency;      //usecond from init to playing
+    int64_t last_rebuffer;
+    int rebuffers;
+    int64_t rebuffer_time;      //usecond held in BUFFER_REBUFFER
+    int grows;
+}BufferControl;
+
+void buffer_init(BufferControl *bc);
+/* before playing, live input keeps the watermarks far below the defaults */
+void buffer_set_watermarks(BufferControl *bc, int64_t low, int64_t high, int64_t max_high);
+/* eof: nothing more will be buffered. Return 1 when the clock may run */
+int buffer_update(BufferControl *bc, int64_t buffered, int eof);
+void buffer_seek(BufferControl *bc);
+int buffer_playing(BufferControl *bc);
+void buffer_log(BufferControl *bc);
+#endif
@@ -16,6 +16,11 @@ int set_video_pts(SyncClock *sc, int64_t pts){
     return 0;
 }
 
+int hold_audio_clock(SyncClock *sc, int held){
+    sc->audio_held = held;
+    return 0;
+}
+
 inline int64_t get_audio_pts(SyncClock *sc){
     return sc->audio_pts;
 }
@@ -25,6 +30,8 @@ inline int64_t get_video_pts(SyncClock *sc){
 }
 
 inline int64_t get_audio_clock(SyncClock *sc){
+    if(sc->audio_held)
+        return sc->audio_pts;
     return sc->audio_pts_drift + av_gettime_relative();
 }
 
@@ -33,7 +40,9 @@ inline int64_t get_video_clock(SyncClock *sc){
 }
 
 int64_t adjust_delay(SyncClock *sc, int64_t delay){
-    int64_t av_delay = sc->video_pts_drift - sc->audio_pts_drift;
+    //a held audio clock stands still, its drift goes down with the wall time
+    int64_t audio_drift = sc->audio_held ? sc->audio_pts - av_gettime_relative() : sc->audio_pts_drift;
+    int64_t av_delay = sc->video_pts_drift - audio_drift;
     if(av_delay<sc->acceptable_delay && av_delay>-sc->acceptable_delay)
         return delay;
     else if(av_delay >= sc->acceptable_delay)
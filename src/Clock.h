@@ -11,6 +11,8 @@
  * av_delay        = cur_video_time_on_pts - cur_audio_time_on_pts 
  *                 = (video_pts_drift + av_gettime_relative()) - (audio_pts_drift + av_gettime_relative())
  *                 = video_pts_drift - audio_pts_drift
+ *
+ * While the audio device plays silence for want of data the audio clock is held at audio_pts.
  * */
 typedef struct SyncClock{
     int64_t audio_pts;
@@ -20,10 +22,12 @@ typedef struct SyncClock{
     int64_t audio_set_time;
     int64_t video_set_time;
     int64_t acceptable_delay;
+    int audio_held;
 }SyncClock;
 
 int set_audio_pts(SyncClock *sc, int64_t pts);
 int set_video_pts(SyncClock *sc, int64_t pts);
+int hold_audio_clock(SyncClock *sc, int held);
 int64_t get_audio_pts(SyncClock *sc);
 int64_t get_video_pts(SyncClock *sc);
 int64_t get_audio_clock(SyncClock *sc);
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <string.h>
+#include <libavutil/cpu.h>
+#include <libavutil/time.h>
+#include "DecoderThreads.h"
+
+void thread_config_default(ThreadConfig *tc){
+    tc->mode = DECODE_THROUGHPUT;
+    tc->thread_count = 0;
+    tc->thread_type = 0;
+}
+
+/*
+ * Must be called before avcodec_open2.
+ *   1. audio decoders are cheap, they always run in one thread
+ *   2. thread type is chosen from the capabilities of the codec and the mode,
+ *      an override not supported by the codec falls back to the other type
+ *   3. thread count is the number of cores, at most DECODE_MAX_THREADS
+ */
+int thread_config_apply(AVCodecContext *ctx, AVCodec *codec, ThreadConfig *tc){
+    int frame_cap = codec->capabilities & AV_CODEC_CAP_FRAME_THREADS;
+    int slice_cap = codec->capabilities & AV_CODEC_CAP_SLICE_THREADS;
+    int cores = av_cpu_count();
+    int type = 0, count;
+
+    if(ctx->codec_type != AVMEDIA_TYPE_VIDEO){
+        ctx->thread_count = 1;
+        ctx->thread_type = 0;
+        fprintf(stdout, "%s decoder: single thread\n", codec->name);
+        return 0;
+    }
+
+    if(tc->thread_type == FF_THREAD_FRAME && frame_cap)
+        type = FF_THREAD_FRAME;
+    else if(tc->thread_type == FF_THREAD_SLICE && slice_cap)
+        type = FF_THREAD_SLICE;
+    else if(tc->mode == DECODE_LATENCY)
+        type = slice_cap ? FF_THREAD_SLICE : (frame_cap ? FF_THREAD_FRAME : 0);
+    else
+        type = frame_cap ? FF_THREAD_FRAME : (slice_cap ? FF_THREAD_SLICE : 0);
+
+    if(tc->thread_count > 0)
+        count = tc->thread_count;
+    else
+        count = cores < DECODE_MAX_THREADS ? cores : DECODE_MAX_THREADS;
+
+    if(tc->mode == DECODE_LATENCY && type == FF_THREAD_FRAME && tc->thread_count <= 0 && count > 2)
+        count = 2;
+    if(!type)
+        count = 1;
+
+    ctx->thread_count = count;
+    ctx->thread_type = type;
+
+    fprintf(stdout, "%s decoder: %d %s threads, %s mode, %d cores%s\n", codec->name, count,
+            type == FF_THREAD_FRAME ? "frame" : (type == FF_THREAD_SLICE ? "slice" : "no"),
+            tc->mode == DECODE_LATENCY ? "latency" : "throughput", cores,
+            (tc->thread_count > 0 || tc->thread_type) ? ", overridden" : "");
+    return 0;
+}
+
+void decode_stats_init(DecodeStats *ds, const char *name){
+    memset(ds, 0, sizeof(DecodeStats));
+    ds->name = name;
+    ds->last_log_time = av_gettime_relative();
+}
+
+void decode_stats_begin(DecodeStats *ds){
+    ds->call_start = av_gettime_relative();
+}
+
+void decode_stats_end(DecodeStats *ds, int frames){
+    int64_t now = av_gettime_relative();
+
+    ds->busy_time += now - ds->call_start;
+    ds->frames += frames;
+
+    if(now - ds->last_log_time >= DECODE_LOG_INTERVAL){
+        int64_t busy = ds->busy_time - ds->last_log_busy_time;
+        int nb = ds->frames - ds->last_log_frames;
+
+        if(busy > 0)
+            fprintf(stdout, "%s: %d frames, decode %.1f fps\n", ds->name, nb, nb*1000000.0/busy);
+        ds->last_log_time = now;
+        ds->last_log_busy_time = ds->busy_time;
+        ds->last_log_frames = ds->frames;
+    }
+}
+
+void decode_stats_log(DecodeStats *ds){
+    if(ds->busy_time > 0)
+        fprintf(stdout, "%s: %d frames in total, decode %.1f fps\n", ds->name, ds->frames,
+                ds->frames*1000000.0/ds->busy_time);
+}
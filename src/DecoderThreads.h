@@ -0,0 +1,39 @@
+#ifndef __INCLUDED_DECODERTHREADS_H__
+#define __INCLUDED_DECODERTHREADS_H__
+#include <libavcodec/avcodec.h>
+
+/*
+ * DECODE_THROUGHPUT: frame threading first, every thread adds one frame of delay
+ * DECODE_LATENCY   : slice threading first, frame threading is limited to 2 threads
+ */
+#define DECODE_THROUGHPUT 0
+#define DECODE_LATENCY    1
+
+#define DECODE_MAX_THREADS 16
+#define DECODE_LOG_INTERVAL 5000000  //usecond
+
+typedef struct ThreadConfig{
+    int mode;           //DECODE_THROUGHPUT/DECODE_LATENCY
+    int thread_count;   //0 for auto
+    int thread_type;    //0 for auto, FF_THREAD_FRAME/FF_THREAD_SLICE for override
+}ThreadConfig;
+
+/* measured decoding speed, only the time spent in avcodec_send_packet/avcodec_receive_frame is counted */
+typedef struct DecodeStats{
+    const char *name;
+    int64_t busy_time;
+    int64_t call_start;
+    int64_t last_log_time;
+    int64_t last_log_busy_time;
+    int frames;
+    int last_log_frames;
+}DecodeStats;
+
+void thread_config_default(ThreadConfig *tc);
+int thread_config_apply(AVCodecContext *ctx, AVCodec *codec, ThreadConfig *tc);
+
+void decode_stats_init(DecodeStats *ds, const char *name);
+void decode_stats_begin(DecodeStats *ds);
+void decode_stats_end(DecodeStats *ds, int frames);
+void decode_stats_log(DecodeStats *ds);
+#endif
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <string.h>
+#include <libavutil/time.h>
+#include "Degrade.h"
+
+static const char *level_names[] = {
+    "full decoding",
+    "skip loop filter on non-ref frames",
+    "skip non-ref frames",
+    "reduced resolution",
+    "keyframes only",
+};
+
+void degrade_init(DegradeControl *dc, AVCodec *codec, AVRational frame_rate, int enabled){
+    memset(dc, 0, sizeof(DegradeControl));
+    dc->enabled = enabled;
+    dc->level = DEGRADE_NONE;
+    dc->max_lowres = codec->max_lowres;
+    if(frame_rate.num > 0 && frame_rate.den > 0)
+        dc->frame_duration = av_rescale(1000000, frame_rate.den, frame_rate.num);
+    else
+        dc->frame_duration = 40000;
+    dc->last_change = av_gettime_relative();
+    dc->recover_hold = DEGRADE_RECOVER_HOLD;
+}
+
+/* reduced resolution is skipped for the codecs not supporting lowres */
+static int next_level(DegradeControl *dc, int level, int step){
+    level += step;
+    if(level == DEGRADE_LOWRES && !dc->max_lowres)
+        level += step;
+    return level;
+}
+
+/*
+ * Called for every packet sent to the decoder.
+ * Return 1 when the level is changed, the caller should apply the new level.
+ */
+int degrade_update(DegradeControl *dc, int64_t busy_time, int queue_nb, int queue_max){
+    int64_t now;
+    int level;
+
+    if(!dc->enabled)
+        return 0;
+
+    dc->busy_time += busy_time;
+    dc->media_time += dc->frame_duration;
+    if(dc->media_time < DEGRADE_WINDOW)
+        return 0;
+
+    dc->load = dc->busy_time/(double)dc->media_time;
+    dc->busy_time = 0;
+    dc->media_time = 0;
+
+    now = av_gettime_relative();
+    level = dc->level;
+    //compared without dividing, a live queue of 3 frames has no quarter in integers
+    if(dc->load > DEGRADE_OVERLOAD && queue_nb*4 < queue_max
+            && dc->level < DEGRADE_KEYFRAME && now - dc->last_change >= DEGRADE_HOLD)
+        level = next_level(dc, dc->level, 1);
+    else if(dc->load < DEGRADE_HEADROOM && queue_nb*4 >= queue_max*3
+            && dc->level > DEGRADE_NONE && now - dc->last_change >= dc->recover_hold)
+        level = next_level(dc, dc->level, -1);
+
+    if(level == dc->level)
+        return 0;
+
+    fprintf(stdout, "degrade: level %d -> %d (%s), load %.2f, frame queue %d/%d\n", dc->level, level,
+            degrade_level_name(level), dc->load, queue_nb, queue_max);
+    if(level > dc->level){
+        if(dc->last_recover && now - dc->last_recover < DEGRADE_FLAP_WINDOW)
+            dc->recover_hold = FFMIN(dc->recover_hold*2, DEGRADE_RECOVER_MAX);
+        else
+            dc->recover_hold = DEGRADE_RECOVER_HOLD;
+    }else{
+        dc->last_recover = now;
+    }
+    dc->level = level;
+    dc->last_change = now;
+    dc->transitions++;
+    return 1;
+}
+
+/* lowres is not applied here, it needs reopening the decoder */
+void degrade_apply(DegradeControl *dc, AVCodecContext *ctx){
+    ctx->skip_loop_filter = dc->level >= DEGRADE_SKIP_LOOP ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    if(dc->level >= DEGRADE_KEYFRAME)
+        ctx->skip_frame = AVDISCARD_NONKEY;
+    else if(dc->level >= DEGRADE_SKIP_NONREF)
+        ctx->skip_frame = AVDISCARD_NONREF;
+    else
+        ctx->skip_frame = AVDISCARD_DEFAULT;
+}
+
+int degrade_lowres(DegradeControl *dc){
+    return dc->level >= DEGRADE_LOWRES && dc->max_lowres ? 1 : 0;
+}
+
+int degrade_level(DegradeControl *dc){
+    return dc->level;
+}
+
+const char *degrade_level_name(int level){
+    if(level < DEGRADE_NONE || level > DEGRADE_KEYFRAME)
+        return "unknown";
+    return level_names[level];
+}
@@ -0,0 +1,48 @@
+#ifndef __INCLUDED_DEGRADE_H__
+#define __INCLUDED_DEGRADE_H__
+#include <libavcodec/avcodec.h>
+
+/* degradation levels, each one includes the ones before it */
+#define DEGRADE_NONE        0
+#define DEGRADE_SKIP_LOOP   1   //skip loop filter on non-ref frames
+#define DEGRADE_SKIP_NONREF 2   //skip non-ref frames
+#define DEGRADE_LOWRES      3   //half resolution decoding, only for codecs supporting lowres
+#define DEGRADE_KEYFRAME    4   //keyframes only
+
+#define DEGRADE_WINDOW        500000  //usecond of media time for one evaluation
+#define DEGRADE_HOLD         1000000  //usecond between two degradations
+#define DEGRADE_RECOVER_HOLD 3000000  //usecond at one level before recovering
+#define DEGRADE_RECOVER_MAX 48000000  //longest hold before recovering, after repeated flapping
+#define DEGRADE_FLAP_WINDOW 10000000  //degrading again within it after a recovery is flapping
+#define DEGRADE_OVERLOAD        0.95  //decode time/media time above it is falling behind
+#define DEGRADE_HEADROOM        0.60  //decode time/media time below it has room for recovering
+
+/*
+ * Fed with the decoding time of every packet and the level of the frame queue.
+ * Falling behind: decoding one frame takes longer than its duration and the frame queue is draining.
+ * Headroom    : decoding is much faster than real time and the frame queue is nearly full.
+ * The load is measured at the degraded level, it looks lighter than at the level above.
+ * A recovery followed by a degradation within DEGRADE_FLAP_WINDOW doubles the hold before
+ * the next recovery, a degradation after a recovery that held resets it.
+ */
+typedef struct DegradeControl{
+    int enabled;
+    int level;
+    int max_lowres;
+    int64_t frame_duration;  //usecond
+    int64_t busy_time;       //decoding time in the current window
+    int64_t media_time;      //media time decoded in the current window
+    int64_t last_change;
+    int64_t last_recover;
+    int64_t recover_hold;    //usecond at one level before recovering
+    double load;
+    int transitions;
+}DegradeControl;
+
+void degrade_init(DegradeControl *dc, AVCodec *codec, AVRational frame_rate, int enabled);
+int degrade_update(DegradeControl *dc, int64_t busy_time, int queue_nb, int queue_max);
+void degrade_apply(DegradeControl *dc, AVCodecContext *ctx);
+int degrade_lowres(DegradeControl *dc);
+int degrade_level(DegradeControl *dc);
+const char *degrade_level_name(int level);
+#endif
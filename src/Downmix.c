@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <string.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/samplefmt.h>
+#include <libavutil/mem.h>
+#include <libavutil/common.h>
+#include "SampleConvert.h"
+#include "Downmix.h"
+
+#define DOWNMIX_SPEAKERS (AV_CH_FRONT_LEFT | AV_CH_FRONT_RIGHT | AV_CH_FRONT_CENTER | AV_CH_LOW_FREQUENCY \
+        | AV_CH_BACK_LEFT | AV_CH_BACK_RIGHT | AV_CH_BACK_CENTER | AV_CH_SIDE_LEFT | AV_CH_SIDE_RIGHT)
+
+int downmix_supported(uint64_t in_layout, uint64_t out_layout, int out_format){
+    if(in_layout == out_layout || !in_layout || !out_layout)
+        return 0;
+    if((in_layout & ~DOWNMIX_SPEAKERS) || (out_layout & ~DOWNMIX_SPEAKERS))
+        return 0;
+    if(av_get_channel_layout_nb_channels(in_layout) > DOWNMIX_MAX_CHANNELS
+            || av_get_channel_layout_nb_channels(out_layout) > DOWNMIX_MAX_CHANNELS)
+        return 0;
+    return out_format == AV_SAMPLE_FMT_FLT || out_format == AV_SAMPLE_FMT_S16;
+}
+
+int downmix_init(Downmix *dm){
+    memset(dm, 0, sizeof(Downmix));
+    dm->in = av_frame_alloc();
+    return dm->in ? 0 : AVERROR(ENOMEM);
+}
+
+/* add the input channel to the output speaker, 0 when the device has no such speaker */
+static int put(Downmix *dm, int in, uint64_t speaker, float gain){
+    int o = av_get_channel_layout_channel_index(dm->out_layout, speaker);
+
+    if(o < 0)
+        return 0;
+    dm->matrix[o*dm->in_channels+in] += gain;
+    return 1;
+}
+
+/* where a speaker the device lacks goes, in order of preference, b is 0 for one speaker */
+static const struct{
+    uint64_t speaker;
+    uint64_t a, b;
+    float gain;
+}fallbacks[] = {
+    { AV_CH_FRONT_CENTER, AV_CH_FRONT_LEFT,   AV_CH_FRONT_RIGHT, DOWNMIX_LEVEL },
+    { AV_CH_FRONT_LEFT,   AV_CH_FRONT_CENTER, 0,                 DOWNMIX_LEVEL },
+    { AV_CH_FRONT_RIGHT,  AV_CH_FRONT_CENTER, 0,                 DOWNMIX_LEVEL },
+    { AV_CH_SIDE_LEFT,    AV_CH_BACK_LEFT,    0,                 1.0f },
+    { AV_CH_SIDE_LEFT,    AV_CH_FRONT_LEFT,   0,                 DOWNMIX_LEVEL },
+    { AV_CH_SIDE_LEFT,    AV_CH_FRONT_CENTER, 0,                 DOWNMIX_LEVEL },
+    { AV_CH_SIDE_RIGHT,   AV_CH_BACK_RIGHT,   0,                 1.0f },
+    { AV_CH_SIDE_RIGHT,   AV_CH_FRONT_RIGHT,  0,                 DOWNMIX_LEVEL },
+    { AV_CH_SIDE_RIGHT,   AV_CH_FRONT_CENTER, 0,                 DOWNMIX_LEVEL },
+    { AV_CH_BACK_LEFT,    AV_CH_SIDE_LEFT,    0,                 1.0f },
+    { AV_CH_BACK_LEFT,    AV_CH_FRONT_LEFT,   0,                 DOWNMIX_LEVEL },
+    { AV_CH_BACK_LEFT,    AV_CH_FRONT_CENTER, 0,                 DOWNMIX_LEVEL },
+    { AV_CH_BACK_RIGHT,   AV_CH_SIDE_RIGHT,   0,                 1.0f },
+    { AV_CH_BACK_RIGHT,   AV_CH_FRONT_RIGHT,  0,                 DOWNMIX_LEVEL },
+    { AV_CH_BACK_RIGHT,   AV_CH_FRONT_CENTER, 0,                 DOWNMIX_LEVEL },
+    { AV_CH_BACK_CENTER,  AV_CH_BACK_LEFT,    AV_CH_BACK_RIGHT,  DOWNMIX_LEVEL },
+    { AV_CH_BACK_CENTER,  AV_CH_SIDE_LEFT,    AV_CH_SIDE_RIGHT,  DOWNMIX_LEVEL },
+    { AV_CH_BACK_CENTER,  AV_CH_FRONT_LEFT,   AV_CH_FRONT_RIGHT, DOWNMIX_LEVEL },
+    { AV_CH_BACK_CENTER,  AV_CH_FRONT_CENTER, 0,                 DOWNMIX_LEVEL },
+};
+
+/* LFE has no fallback, it is dropped without a subwoofer */
+static void route(Downmix *dm, int in, uint64_t speaker){
+    int i, n;
+
+    if(put(dm, in, speaker, 1.0f))
+        return;
+    for(i=0; i<FF_ARRAY_ELEMS(fallbacks); i++){
+        if(fallbacks[i].speaker != speaker)
+            continue;
+        n = put(dm, in, fallbacks[i].a, fallbacks[i].gain);
+        if(fallbacks[i].b)
+            n += put(dm, in, fallbacks[i].b, fallbacks[i].gain);
+        if(n)
+            return;
+    }
+}
+
+int downmix_config(Downmix *dm, uint64_t in_layout, uint64_t out_layout, int out_format){
+    float sum, max = 0.0f;
+    int i, o;
+
+    if(!downmix_supported(in_layout, out_layout, out_format))
+        return AVERROR(ENOSYS);
+
+    dm->in_layout = in_layout;
+    dm->out_layout = out_layout;
+    dm->in_channels = av_get_channel_layout_nb_channels(in_layout);
+    dm->out_channels = av_get_channel_layout_nb_channels(out_layout);
+    dm->out_format = out_format;
+    memset(dm->matrix, 0, sizeof(dm->matrix));
+    for(i=0; i<dm->in_channels; i++)
+        route(dm, i, av_channel_layout_extract_channel(in_layout, i));
+
+    for(o=0; o<dm->out_channels; o++){
+        sum = 0.0f;
+        for(i=0; i<dm->in_channels; i++)
+            sum += dm->matrix[o*dm->in_channels+i];
+        if(sum > max)
+            max = sum;
+    }
+    if(max > 1.0f)
+        for(i=0; i<dm->out_channels*dm->in_channels; i++)
+            dm->matrix[i] /= max;
+    return 0;
+}
+
+int downmix_frame(Downmix *dm, AVFrame *out){
+    AVFrame *in = dm->in;
+    float *planes[DOWNMIX_MAX_CHANNELS];
+    int nb_samples = in->nb_samples;
+    int o, ret;
+
+    av_fast_malloc(&dm->buf, &dm->buf_size, nb_samples*dm->out_channels*sizeof(float));
+    if(!dm->buf){
+        av_frame_unref(in);
+        return AVERROR(ENOMEM);
+    }
+    for(o=0; o<dm->out_channels; o++)
+        planes[o] = (float *)dm->buf + o*nb_samples;
+    sample_mix_fltp(planes, dm->out_channels, (const float **)in->extended_data, dm->in_channels,
+            dm->matrix, nb_samples);
+
+    out->format = dm->out_format;
+    out->channel_layout = dm->out_layout;
+    out->channels = dm->out_channels;
+    out->sample_rate = in->sample_rate;
+    out->nb_samples = nb_samples;
+    ret = av_frame_get_buffer(out, 0);
+    if(ret >= 0)
+        ret = av_frame_copy_props(out, in);
+    av_frame_unref(in);
+    if(ret < 0){
+        av_frame_unref(out);
+        return ret;
+    }
+
+    if(dm->out_format == AV_SAMPLE_FMT_FLT)
+        sample_interleave_flt((float *)out->data[0], (const float **)planes, dm->out_channels, nb_samples);
+    else
+        sample_fltp_to_s16((int16_t *)out->data[0], (const float **)planes, dm->out_channels, nb_samples);
+    return 0;
+}
+
+void downmix_uninit(Downmix *dm){
+    av_frame_free(&dm->in);
+    av_freep(&dm->buf);
+    dm->buf_size = 0;
+}
@@ -0,0 +1,35 @@
+#ifndef __INCLUDED_DOWNMIX_H__
+#define __INCLUDED_DOWNMIX_H__
+#include <stdint.h>
+#include <libavutil/frame.h>
+
+#define DOWNMIX_MAX_CHANNELS 8
+#define DOWNMIX_LEVEL        0.70710678f   //-3 dB, a speaker folded into two others or a neighbour
+
+/*
+ * Channel mixing between the decoder and the device, FLTP in, the packed FLT or S16 of the device out.
+ * The matrix is built once per pair of layouts from the speakers: a speaker the device has is kept,
+ * one it lacks goes to its neighbours at DOWNMIX_LEVEL, LFE is dropped. The rows are scaled
+ * down together when one of them could clip. Layouts with other speakers are left to libswresample.
+ */
+typedef struct Downmix{
+    uint64_t in_layout;
+    uint64_t out_layout;
+    int in_channels;
+    int out_channels;
+    int out_format;
+    float matrix[DOWNMIX_MAX_CHANNELS*DOWNMIX_MAX_CHANNELS];  //[out][in]
+    AVFrame *in;                //frame to mix, taken from the filter graph by the caller
+    uint8_t *buf;               //mixed planes before packing
+    unsigned int buf_size;
+}Downmix;
+
+/* 1 when the layouts differ and downmix_config takes them */
+int downmix_supported(uint64_t in_layout, uint64_t out_layout, int out_format);
+int downmix_init(Downmix *dm);
+/* build the matrix, AVERROR(ENOSYS) when not supported */
+int downmix_config(Downmix *dm, uint64_t in_layout, uint64_t out_layout, int out_format);
+/* mix dm->in into out, dm->in is unreferenced */
+int downmix_frame(Downmix *dm, AVFrame *out);
+void downmix_uninit(Downmix *dm);
+#endif
@@ -0,0 +1,577 @@
+#define _GNU_SOURCE     //O_DIRECT
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <libavutil/time.h>
+#include "FileIO.h"
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+static const char *mode_names[] = { "default", "mmap", "readahead", "uring", "uring_direct" };
+
+int file_io_mode(const char *name){
+    int i;
+
+    for(i=0; i<FF_ARRAY_ELEMS(mode_names); i++)
+        if(!strcmp(name, mode_names[i]))
+            return i;
+    return -1;
+}
+
+const char *file_io_mode_name(int mode){
+    if(mode < 0 || mode >= FF_ARRAY_ELEMS(mode_names))
+        return "unknown";
+    return mode_names[mode];
+}
+
+/* the mode asked for may have fallen back, io_uring to the read-ahead thread, O_DIRECT to buffered reads */
+int file_io_mode_used(FileIO *fio){
+    return fio->direct ? FILE_IO_URING_DIRECT : fio->mode;
+}
+
+static void file_io_account(FileIO *fio, int64_t start, int size){
+    int64_t t = av_gettime_relative() - start;
+
+    fio->stats.reads++;
+    fio->stats.read_time += t;
+    if(t > fio->stats.max_read_time)
+        fio->stats.max_read_time = t;
+    if(size > 0)
+        fio->stats.bytes_read += size;
+}
+
+static int mmap_read(void *opaque, uint8_t *buf, int size){
+    FileIO *fio = opaque;
+    int64_t start = av_gettime_relative();
+
+    if(fio->pos >= fio->size)
+        return AVERROR_EOF;
+    if(size > fio->size - fio->pos)
+        size = fio->size - fio->pos;
+
+    //page faults of the copy are the latency of the read
+    memcpy(buf, fio->map + fio->pos, size);
+    fio->pos += size;
+    file_io_account(fio, start, size);
+    return size;
+}
+
+/*
+ * The thread fills the free part of the ring behind win_start+win_len.
+ * The read is done without the lock, a refill from another position during
+ * the read is detected with generation and the data is thrown away.
+ */
+static int readahead_thread(void *arg){
+    FileIO *fio = arg;
+    int64_t fetch_pos;
+    int index, chunk, generation;
+    ssize_t ret;
+
+    SDL_LockMutex(fio->mutex);
+    while(!fio->abort_request){
+        if(fio->eof || fio->error || fio->win_len == fio->window_size){
+            SDL_CondWait(fio->cond, fio->mutex);
+            continue;
+        }
+
+        fetch_pos = fio->win_start + fio->win_len;
+        index = (fio->head + fio->win_len) % fio->window_size;
+        chunk = fio->window_size - fio->win_len;
+        if(chunk > fio->window_size - index)
+            chunk = fio->window_size - index;
+        if(chunk > FILE_IO_CHUNK)
+            chunk = FILE_IO_CHUNK;
+        generation = fio->generation;
+        SDL_UnlockMutex(fio->mutex);
+
+        ret = pread(fio->fd, fio->window + index, chunk, fetch_pos);
+
+        SDL_LockMutex(fio->mutex);
+        if(generation != fio->generation)
+            continue;
+        if(ret < 0){
+            fio->error = AVERROR(errno);
+        }else if(ret == 0){
+            fio->eof = 1;
+        }else{
+            fio->win_len += ret;
+            fio->stats.bytes_fetched += ret;
+        }
+        SDL_CondBroadcast(fio->cond);
+    }
+    SDL_UnlockMutex(fio->mutex);
+    return 0;
+}
+
+/* the demuxer jumped out of the window, the window restarts from its position */
+static void readahead_refill(FileIO *fio){
+    fio->head = 0;
+    fio->win_start = fio->pos;
+    fio->win_len = 0;
+    fio->eof = 0;
+    fio->error = 0;
+    fio->generation++;
+    SDL_CondBroadcast(fio->cond);
+}
+
+static int readahead_read(void *opaque, uint8_t *buf, int size){
+    FileIO *fio = opaque;
+    int64_t start = av_gettime_relative(), stall_start = 0;
+    int index, n, r2e, consumed;
+
+    SDL_LockMutex(fio->mutex);
+    if(fio->pos < fio->win_start || fio->pos > fio->win_start + fio->win_len)
+        readahead_refill(fio);
+
+    //one stall from the window running dry to data arriving, however many times the thread wakes us
+    while(fio->pos >= fio->win_start + fio->win_len){
+        if(fio->eof || fio->error){
+            if(stall_start)
+                fio->stats.stall_time += av_gettime_relative() - stall_start;
+            n = fio->error ? fio->error : AVERROR_EOF;
+            SDL_UnlockMutex(fio->mutex);
+            return n;
+        }
+        if(!stall_start){
+            stall_start = av_gettime_relative();
+            fio->stats.stalls++;
+        }
+        SDL_CondWait(fio->cond, fio->mutex);
+    }
+    if(stall_start)
+        fio->stats.stall_time += av_gettime_relative() - stall_start;
+
+    n = fio->win_start + fio->win_len - fio->pos;
+    if(n > size)
+        n = size;
+    index = (fio->head + (fio->pos - fio->win_start)) % fio->window_size;
+    r2e = fio->window_size - index;
+    if(n <= r2e){
+        memcpy(buf, fio->window + index, n);
+    }else{
+        memcpy(buf, fio->window + index, r2e);
+        memcpy(buf + r2e, fio->window, n - r2e);
+    }
+    fio->pos += n;
+
+    //the data before the demuxer is given back to the thread
+    consumed = fio->pos - fio->win_start;
+    fio->head = (fio->head + consumed) % fio->window_size;
+    fio->win_start += consumed;
+    fio->win_len -= consumed;
+    SDL_CondBroadcast(fio->cond);
+    SDL_UnlockMutex(fio->mutex);
+
+    file_io_account(fio, start, n);
+    return n;
+}
+
+#ifdef HAVE_LIBURING
+#define URING_FREE     0
+#define URING_INFLIGHT 1
+#define URING_READY    2
+
+typedef struct UringBlock{
+    uint8_t *data;
+    int64_t offset;     //file offset of data[0]
+    int len;            //bytes completed
+    int state;
+}UringBlock;
+
+/*
+ * blocks[first], blocks[first+1], ... cover consecutive FILE_IO_URING_BLOCK ranges
+ * of the file from blocks[first].offset, next_offset is behind the last one.
+ * The ring is driven by the demuxer thread in the read callback, there is no extra thread:
+ * the blocks behind the demuxer are submitted again for the next ranges at once.
+ */
+typedef struct UringReader{
+    struct io_uring ring;
+    UringBlock blocks[FILE_IO_URING_DEPTH];
+    int first;
+    int inflight;
+    int64_t next_offset;
+}UringReader;
+
+static void uring_submit(FileIO *fio, int i){
+    UringReader *ur = fio->uring;
+    UringBlock *b = &ur->blocks[i];
+    struct io_uring_sqe *sqe;
+
+    //nothing to read behind the end of file
+    if(b->offset + b->len >= fio->size){
+        b->state = URING_READY;
+        return;
+    }
+
+    sqe = io_uring_get_sqe(&ur->ring);
+    if(!sqe){
+        b->state = URING_READY;
+        fio->error = AVERROR(EAGAIN);
+        return;
+    }
+    //O_DIRECT reads the rest of a block from the aligned position before it, the bytes after are read again
+    if(fio->direct)
+        b->len &= ~(FILE_IO_ALIGN-1);
+    io_uring_prep_read(sqe, fio->fd, b->data + b->len, FILE_IO_URING_BLOCK - b->len, b->offset + b->len);
+    io_uring_sqe_set_data(sqe, (void *)(intptr_t)i);
+    b->state = URING_INFLIGHT;
+    ur->inflight++;
+}
+
+/* the free blocks are always behind the others, give them the next ranges and submit them in one call */
+static void uring_fill(FileIO *fio){
+    UringReader *ur = fio->uring;
+    UringBlock *b;
+    int k, submitted = 0;
+
+    for(k=0; k<FILE_IO_URING_DEPTH; k++){
+        b = &ur->blocks[(ur->first+k) % FILE_IO_URING_DEPTH];
+        if(b->state != URING_FREE)
+            continue;
+        b->offset = ur->next_offset;
+        b->len = 0;
+        ur->next_offset += FILE_IO_URING_BLOCK;
+        uring_submit(fio, (ur->first+k) % FILE_IO_URING_DEPTH);
+        submitted++;
+    }
+    if(submitted)
+        io_uring_submit(&ur->ring);
+}
+
+/* wait for one completion, read errors are kept in fio->error, return <0 only when waiting failed */
+static int uring_complete(FileIO *fio){
+    UringReader *ur = fio->uring;
+    struct io_uring_cqe *cqe;
+    UringBlock *b;
+    int ret, res, i;
+
+    ret = io_uring_wait_cqe(&ur->ring, &cqe);
+    if(ret < 0)
+        return ret;
+    i = (intptr_t)io_uring_cqe_get_data(cqe);
+    res = cqe->res;
+    io_uring_cqe_seen(&ur->ring, cqe);
+
+    b = &ur->blocks[i];
+    ur->inflight--;
+    if(res < 0){
+        fio->error = res;
+        b->state = URING_READY;
+        return 0;
+    }
+    b->len += res;
+    fio->stats.bytes_fetched += res;
+
+    //a short read in the middle of the file, read the rest of the block, up to the end of file
+    if(res > 0 && b->len < FILE_IO_URING_BLOCK){
+        uring_submit(fio, i);
+        io_uring_submit(&ur->ring);
+        return 0;
+    }
+    b->state = URING_READY;
+    return 0;
+}
+
+/* the demuxer jumped out of the ring, wait for the reads in flight and restart from its position */
+static void uring_restart(FileIO *fio){
+    UringReader *ur = fio->uring;
+    int i;
+
+    while(ur->inflight > 0 && uring_complete(fio) >= 0)
+        ;
+    for(i=0; i<FILE_IO_URING_DEPTH; i++)
+        ur->blocks[i].state = URING_FREE;
+    ur->first = 0;
+    ur->next_offset = fio->pos & ~(int64_t)(FILE_IO_ALIGN-1);
+    fio->error = 0;
+    uring_fill(fio);
+}
+
+static int uring_read(void *opaque, uint8_t *buf, int size){
+    FileIO *fio = opaque;
+    UringReader *ur = fio->uring;
+    int64_t start = av_gettime_relative(), stall_start;
+    UringBlock *b;
+    int off, n, freed = 0;
+
+    if(fio->pos >= fio->size)
+        return AVERROR_EOF;
+    if(fio->pos < ur->blocks[ur->first].offset || fio->pos >= ur->next_offset)
+        uring_restart(fio);
+
+    b = &ur->blocks[(ur->first + (fio->pos - ur->blocks[ur->first].offset)/FILE_IO_URING_BLOCK) % FILE_IO_URING_DEPTH];
+    if(b->state != URING_READY){
+        stall_start = av_gettime_relative();
+        while(b->state != URING_READY && !fio->error)
+            if(uring_complete(fio) < 0)
+                break;
+        fio->stats.stalls++;
+        fio->stats.stall_time += av_gettime_relative() - stall_start;
+    }
+    if(fio->error)
+        return fio->error;
+
+    //nothing read before the end of file, the file was cut behind our back
+    off = fio->pos - b->offset;
+    if(off >= b->len)
+        return b->offset + b->len >= fio->size ? AVERROR_EOF : AVERROR(EIO);
+    n = b->len - off;
+    if(n > size)
+        n = size;
+    memcpy(buf, b->data + off, n);
+    fio->pos += n;
+
+    //the blocks behind the demuxer are read again for the next part of the file
+    while(ur->blocks[ur->first].state == URING_READY
+            && fio->pos >= ur->blocks[ur->first].offset + FILE_IO_URING_BLOCK){
+        ur->blocks[ur->first].state = URING_FREE;
+        ur->first = (ur->first+1) % FILE_IO_URING_DEPTH;
+        freed++;
+    }
+    if(freed)
+        uring_fill(fio);
+
+    file_io_account(fio, start, n);
+    return n;
+}
+
+static void uring_close(FileIO *fio){
+    UringReader *ur = fio->uring;
+    int i;
+
+    if(!ur)
+        return;
+    while(ur->inflight > 0 && uring_complete(fio) >= 0)
+        ;
+    io_uring_queue_exit(&ur->ring);
+    for(i=0; i<FILE_IO_URING_DEPTH; i++)
+        free(ur->blocks[i].data);
+    av_freep(&fio->uring);
+}
+
+static int uring_open(FileIO *fio, const char *filename, int direct){
+    UringReader *ur;
+    int fd, i;
+
+    ur = av_mallocz(sizeof(UringReader));
+    if(!ur)
+        return -1;
+    if(io_uring_queue_init(FILE_IO_URING_DEPTH, &ur->ring, 0) < 0){
+        av_free(ur);
+        return -1;
+    }
+    fio->uring = ur;
+
+    //O_DIRECT needs aligned buffers
+    for(i=0; i<FILE_IO_URING_DEPTH; i++){
+        if(posix_memalign((void **)&ur->blocks[i].data, FILE_IO_ALIGN, FILE_IO_URING_BLOCK)){
+            ur->blocks[i].data = NULL;
+            uring_close(fio);
+            return -1;
+        }
+    }
+
+    if(direct){
+        fd = open(filename, O_RDONLY | O_DIRECT);
+        if(fd >= 0){
+            close(fio->fd);
+            fio->fd = fd;
+            fio->direct = 1;
+        }else{
+            fprintf(stderr, "O_DIRECT is not supported for %s, buffered reads are used\n", filename);
+        }
+    }
+
+    uring_restart(fio);
+    return 0;
+}
+#else
+static int uring_open(FileIO *fio, const char *filename, int direct){
+    return -1;
+}
+
+static void uring_close(FileIO *fio){
+}
+#endif
+
+static int64_t file_io_seek(void *opaque, int64_t offset, int whence){
+    FileIO *fio = opaque;
+    int64_t pos;
+
+    switch(whence & ~AVSEEK_FORCE){
+    case AVSEEK_SIZE :
+        return fio->size;
+    case SEEK_SET :
+        pos = offset;
+        break;
+    case SEEK_CUR :
+        pos = fio->pos + offset;
+        break;
+    case SEEK_END :
+        pos = fio->size + offset;
+        break;
+    default :
+        return AVERROR(EINVAL);
+    }
+    if(pos < 0)
+        return AVERROR(EINVAL);
+
+    if(fio->mutex)
+        SDL_LockMutex(fio->mutex);
+    fio->pos = pos;
+    fio->stats.seeks++;
+    if(fio->mutex)
+        SDL_UnlockMutex(fio->mutex);
+
+    //after a jump the kernel is asked for the next window at once
+    if(fio->map && pos < fio->size)
+        madvise(fio->map + (pos & ~(int64_t)(getpagesize()-1)),
+                FFMIN((int64_t)fio->window_size, fio->size - pos), MADV_WILLNEED);
+    return pos;
+}
+
+FileIO *file_io_open(const char *filename, int mode, int window_size){
+    FileIO *fio;
+    struct stat st;
+    uint8_t *buffer;
+    int (*read_packet)(void *opaque, uint8_t *buf, int size) = readahead_read;
+
+    fio = av_mallocz(sizeof(FileIO));
+    if(!fio)
+        return NULL;
+    fio->mode = mode;
+    fio->window_size = window_size > 0 ? window_size : FILE_IO_WINDOW;
+
+    fio->fd = open(filename, O_RDONLY);
+    if(fio->fd < 0 || fstat(fio->fd, &st) < 0){
+        fprintf(stderr, "open %s failed: %s\n", filename, strerror(errno));
+        goto fail;
+    }
+    fio->size = st.st_size;
+
+    if(mode == FILE_IO_URING || mode == FILE_IO_URING_DIRECT){
+        if(uring_open(fio, filename, mode == FILE_IO_URING_DIRECT) < 0){
+            fprintf(stderr, "io_uring is not available, fall back to the read-ahead thread\n");
+            fio->mode = mode = FILE_IO_READAHEAD;
+        }
+#ifdef HAVE_LIBURING
+        else{
+            read_packet = uring_read;
+        }
+#endif
+    }
+
+    if(mode == FILE_IO_MMAP){
+        fio->map = mmap(NULL, fio->size, PROT_READ, MAP_PRIVATE, fio->fd, 0);
+        if(fio->map == MAP_FAILED){
+            fio->map = NULL;
+            fprintf(stderr, "mmap %s failed: %s\n", filename, strerror(errno));
+            goto fail;
+        }
+        madvise(fio->map, fio->size, MADV_SEQUENTIAL);
+        read_packet = mmap_read;
+    }else if(mode == FILE_IO_READAHEAD){
+        fio->window = av_malloc(fio->window_size);
+        fio->mutex = SDL_CreateMutex();
+        fio->cond = SDL_CreateCond();
+        if(!fio->window || !fio->mutex || !fio->cond)
+            goto fail;
+        posix_fadvise(fio->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        fio->tid = SDL_CreateThread(readahead_thread, "ReadAheadThread", fio);
+        if(!fio->tid)
+            goto fail;
+    }
+
+    buffer = av_malloc(FILE_IO_BUFFER);
+    if(!buffer)
+        goto fail;
+    fio->pb = avio_alloc_context(buffer, FILE_IO_BUFFER, 0, fio, read_packet, NULL, file_io_seek);
+    if(!fio->pb){
+        av_free(buffer);
+        goto fail;
+    }
+    return fio;
+
+fail:
+    file_io_close(&fio);
+    return NULL;
+}
+
+void file_io_close(FileIO **pfio){
+    FileIO *fio = *pfio;
+
+    if(!fio)
+        return;
+
+    if(fio->tid){
+        SDL_LockMutex(fio->mutex);
+        fio->abort_request = 1;
+        SDL_CondBroadcast(fio->cond);
+        SDL_UnlockMutex(fio->mutex);
+        SDL_WaitThread(fio->tid, NULL);
+    }
+    if(fio->pb){
+        av_freep(&fio->pb->buffer);
+        avio_context_free(&fio->pb);
+    }
+    uring_close(fio);
+    if(fio->map)
+        munmap(fio->map, fio->size);
+    if(fio->fd >= 0)
+        close(fio->fd);
+    av_free(fio->window);
+    if(fio->mutex)
+        SDL_DestroyMutex(fio->mutex);
+    if(fio->cond)
+        SDL_DestroyCond(fio->cond);
+    av_freep(pfio);
+}
+
+void file_io_log(FileIO *fio){
+    FileIOStats *s = &fio->stats;
+
+    fprintf(stdout, "%s io: %lld bytes read in %lld reads, avg latency %lld us, max %lld us, "
+            "%lld stalls %lld ms, %lld seeks, %lld bytes fetched\n",
+            mode_names[file_io_mode_used(fio)],
+            (long long)s->bytes_read, (long long)s->reads, (long long)(s->reads ? s->read_time/s->reads : 0),
+            (long long)s->max_read_time, (long long)s->stalls, (long long)(s->stall_time/1000),
+            (long long)s->seeks, (long long)s->bytes_fetched);
+}
+
+int file_io_open_input(AVFormatContext **ps, const char *filename, int mode, int window_size, FileIO **pfio){
+    FileIO *fio = NULL;
+    int ret;
+
+    *pfio = NULL;
+    if(mode != FILE_IO_DEFAULT){
+        fio = file_io_open(filename, mode, window_size);
+        if(!fio)
+            fprintf(stderr, "%s: fall back to the file protocol\n", filename);
+    }
+
+    if(fio){
+        *ps = avformat_alloc_context();
+        if(!*ps){
+            file_io_close(&fio);
+            return AVERROR(ENOMEM);
+        }
+        (*ps)->pb = fio->pb;
+        (*ps)->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
+    //the custom AVIOContext is not freed by avformat on failure
+    ret = avformat_open_input(ps, filename, NULL, NULL);
+    if(ret < 0){
+        file_io_close(&fio);
+        return ret;
+    }
+    *pfio = fio;
+    return 0;
+}
@@ -0,0 +1,79 @@
+#ifndef __INCLUDED_FILEIO_H__
+#define __INCLUDED_FILEIO_H__
+#include <SDL2/SDL.h>
+#include <libavformat/avformat.h>
+
+/*
+ * FILE_IO_DEFAULT  : FFmpeg file protocol
+ * FILE_IO_MMAP     : the file is mapped, sequential access is hinted with madvise
+ * FILE_IO_READAHEAD: a thread reads ahead of the demuxer into a window of the file
+ * FILE_IO_URING    : several aligned reads are kept in flight with io_uring, the demuxer
+ *                    thread consumes the completed blocks, FILE_IO_URING_DIRECT adds O_DIRECT.
+ *                    Without liburing (HAVE_LIBURING) or kernel support it falls back to FILE_IO_READAHEAD
+ */
+#define FILE_IO_DEFAULT      0
+#define FILE_IO_MMAP         1
+#define FILE_IO_READAHEAD    2
+#define FILE_IO_URING        3
+#define FILE_IO_URING_DIRECT 4
+
+#define FILE_IO_BUFFER    (64*1024)         //buffer of AVIOContext
+#define FILE_IO_WINDOW    (8*1024*1024)     //default read-ahead window
+#define FILE_IO_CHUNK     (1024*1024)       //one read of the read-ahead thread at most
+
+#define FILE_IO_URING_DEPTH 8               //reads in flight
+#define FILE_IO_URING_BLOCK (256*1024)      //one read, multiple of FILE_IO_ALIGN
+#define FILE_IO_ALIGN       4096            //O_DIRECT alignment of buffer, offset and length
+
+typedef struct FileIOStats{
+    int64_t bytes_read;     //bytes given to the demuxer
+    int64_t bytes_fetched;  //bytes read from the file ahead of the demuxer
+    int64_t reads;          //read callbacks of the demuxer
+    int64_t read_time;      //usecond spent in the read callbacks
+    int64_t max_read_time;
+    int64_t stalls;         //read callbacks waiting for data
+    int64_t stall_time;     //usecond waiting for data
+    int64_t seeks;
+}FileIOStats;
+
+typedef struct FileIO{
+    int mode;
+    int fd;
+    int64_t size;
+    int64_t pos;            //position of the demuxer
+    int window_size;
+    int direct;             //fd is opened with O_DIRECT
+
+    /* mmap */
+    uint8_t *map;
+
+    /* read-ahead, window is a ring holding [win_start, win_start+win_len) of the file */
+    uint8_t *window;
+    int head;               //index of win_start in window
+    int64_t win_start;
+    int win_len;
+    int generation;         //increased by every refill from another position
+    int eof;
+    int error;
+    int abort_request;
+    SDL_Thread *tid;
+    SDL_mutex *mutex;
+    SDL_cond *cond;
+
+    /* io_uring, UringReader in FileIO.c */
+    void *uring;
+
+    AVIOContext *pb;
+    FileIOStats stats;
+}FileIO;
+
+int file_io_mode(const char *name);
+const char *file_io_mode_name(int mode);
+int file_io_mode_used(FileIO *fio);
+FileIO *file_io_open(const char *filename, int mode, int window_size);
+void file_io_close(FileIO **pfio);
+void file_io_log(FileIO *fio);
+
+/* avformat_open_input through FileIO, *pfio stays NULL for FILE_IO_DEFAULT */
+int file_io_open_input(AVFormatContext **ps, const char *filename, int mode, int window_size, FileIO **pfio);
+#endif
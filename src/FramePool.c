@@ -0,0 +1,147 @@
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include "FramePool.h"
+
+int frame_pool_init(FramePool *fp){
+    memset(fp, 0, sizeof(FramePool));
+    fp->mutex = SDL_CreateMutex();
+    if(!fp->mutex)
+        return -1;
+    return 0;
+}
+
+/* buffers still referenced by frames are freed when they are released */
+void frame_pool_uninit(FramePool *fp){
+    int i;
+
+    for(i=0; i<FRAME_POOL_CLASSES; i++)
+        av_buffer_pool_uninit(&fp->classes[i].pool);
+    SDL_DestroyMutex(fp->mutex);
+    memset(fp, 0, sizeof(FramePool));
+}
+
+static int class_size(int size){
+    int step = 1;
+
+    //step is a quarter of the largest power of 2 not greater than size
+    while(step*8 <= size)
+        step <<= 1;
+    return (size+step-1)/step*step;
+}
+
+static AVBufferRef *pool_alloc(void *opaque, int size){
+    FramePool *fp = opaque;
+
+    //called with fp->mutex held, only when the pool has no free buffer
+    fp->misses++;
+    return av_buffer_alloc(size);
+}
+
+static AVBufferRef *frame_pool_get(FramePool *fp, int size){
+    FrameSizeClass *fc = NULL, *oldest = NULL;
+    AVBufferRef *buf;
+    int i;
+
+    size = class_size(size);
+
+    SDL_LockMutex(fp->mutex);
+    fp->requests++;
+    for(i=0; i<FRAME_POOL_CLASSES; i++){
+        if(fp->classes[i].pool && fp->classes[i].size == size){
+            fc = &fp->classes[i];
+            break;
+        }
+        if(!oldest || fp->classes[i].last_used < oldest->last_used)
+            oldest = &fp->classes[i];
+    }
+
+    if(!fc){
+        //replace the least recently used class, its buffers in use are freed on release
+        fc = oldest;
+        av_buffer_pool_uninit(&fc->pool);
+        fc->pool = av_buffer_pool_init2(size, fp, pool_alloc, NULL);
+        fc->size = size;
+        if(!fc->pool){
+            SDL_UnlockMutex(fp->mutex);
+            return NULL;
+        }
+    }
+    fc->last_used = fp->requests;
+
+    buf = av_buffer_pool_get(fc->pool);
+    SDL_UnlockMutex(fp->mutex);
+    return buf;
+}
+
+static int frame_pool_get_buffer2(AVCodecContext *ctx, AVFrame *frame, int flags){
+    FramePool *fp = ctx->opaque;
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    int linesize[4];
+    uint8_t *data[4];
+    uint8_t *base;
+    int w = frame->width, h = frame->height;
+    int unaligned, size, i;
+
+    if(!desc || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL|AV_PIX_FMT_FLAG_PAL)) ||
+            !(ctx->codec->capabilities & AV_CODEC_CAP_DR1)){
+        SDL_LockMutex(fp->mutex);
+        fp->fallbacks++;
+        SDL_UnlockMutex(fp->mutex);
+        return avcodec_default_get_buffer2(ctx, frame, flags);
+    }
+
+    /* 
+     * 1. padding required by the codec
+     * 2. all linesizes aligned to FRAME_POOL_ALIGN, so every plane is aligned as well,
+     *    widen the picture instead of aligning planes one by one to keep the ratio of linesizes
+     */
+    avcodec_align_dimensions2(ctx, &w, &h, linesize_align);
+    do{
+        if(av_image_fill_linesizes(linesize, frame->format, w) < 0)
+            return AVERROR(EINVAL);
+        w += w & ~(w-1);
+        unaligned = 0;
+        for(i=0; i<4; i++)
+            unaligned |= linesize[i] % FRAME_POOL_ALIGN || (linesize_align[i] && linesize[i] % linesize_align[i]);
+    }while(unaligned);
+
+    size = av_image_fill_pointers(data, frame->format, h, NULL, linesize);
+    if(size < 0)
+        return size;
+
+    //16 bytes for the bitstream readers overreading, FRAME_POOL_ALIGN for aligning the base
+    frame->buf[0] = frame_pool_get(fp, size + 16 + FRAME_POOL_ALIGN - 1);
+    if(!frame->buf[0])
+        return AVERROR(ENOMEM);
+
+    base = (uint8_t *)FFALIGN((uintptr_t)frame->buf[0]->data, FRAME_POOL_ALIGN);
+    av_image_fill_pointers(frame->data, frame->format, h, base, linesize);
+    for(i=0; i<4; i++)
+        frame->linesize[i] = linesize[i];
+    frame->extended_data = frame->data;
+
+    return 0;
+}
+
+/* must be called before avcodec_open2 */
+int frame_pool_attach(FramePool *fp, AVCodecContext *ctx){
+    ctx->opaque = fp;
+    ctx->get_buffer2 = frame_pool_get_buffer2;
+    //frame threads can call get_buffer2 directly, the pool is locked by itself
+    ctx->thread_safe_callbacks = 1;
+    return 0;
+}
+
+void frame_pool_log(FramePool *fp){
+    int i;
+
+    SDL_LockMutex(fp->mutex);
+    fp->hits = fp->requests - fp->misses;
+    fprintf(stdout, "frame pool: %lld requests, %lld hits, %lld misses, %lld fallbacks\n",
+            (long long)fp->requests, (long long)fp->hits, (long long)fp->misses, (long long)fp->fallbacks);
+    for(i=0; i<FRAME_POOL_CLASSES; i++)
+        if(fp->classes[i].pool)
+            fprintf(stdout, "frame pool: size class %d bytes\n", fp->classes[i].size);
+    SDL_UnlockMutex(fp->mutex);
+}
@@ -0,0 +1,34 @@
+#ifndef __INCLUDED_FRAMEPOOL_H__
+#define __INCLUDED_FRAMEPOOL_H__
+#include <SDL2/SDL.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+
+#define FRAME_POOL_ALIGN   64  //linesize and plane alignment, enough for SIMD and texture upload
+#define FRAME_POOL_CLASSES 8
+
+/*
+ * Video frame buffers for get_buffer2.
+ * All planes of a frame are in one buffer, the buffer size is rounded up to a size class
+ * (a quarter of power of 2), so a resolution change within the class still hits the pool.
+ */
+typedef struct FrameSizeClass{
+    AVBufferPool *pool;
+    int size;
+    int64_t last_used;
+}FrameSizeClass;
+
+typedef struct FramePool{
+    FrameSizeClass classes[FRAME_POOL_CLASSES];
+    int64_t hits;
+    int64_t misses;      //buffers really allocated
+    int64_t fallbacks;   //frames allocated by avcodec_default_get_buffer2
+    int64_t requests;
+    SDL_mutex *mutex;
+}FramePool;
+
+int frame_pool_init(FramePool *fp);
+void frame_pool_uninit(FramePool *fp);
+int frame_pool_attach(FramePool *fp, AVCodecContext *ctx);
+void frame_pool_log(FramePool *fp);
+#endif
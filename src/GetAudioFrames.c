@@ -1,5 +1,6 @@
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
+#include "SampleConvert.h"
 
 #define SAVE_FRAMES 2000
 const char *codec_type ,*codec_nane;
@@ -18,10 +19,9 @@ void dumpAudioInfo(AVCodecContext *pCodecCtx){
 void SaveFrame2PCM(AVFrame *pFrame, int size, int iFrame){
     static FILE *pFile;
     char szFilename[32];
-    int itr = 0;
-    unsigned int sample_count, i;
-    float *channel0, *channel1;
-    short sample0, sample1;
+    static int16_t *pcm;
+    static unsigned int pcm_count;
+    unsigned int sample_count;
 
     //Open file
     if(iFrame==1){
@@ -32,18 +32,21 @@ void SaveFrame2PCM(AVFrame *pFrame, int size, int iFrame){
     }
 
     sample_count = pFrame->nb_samples;
-    channel0 = (float *)pFrame->extended_data[0];
-    channel1 = (float *)pFrame->extended_data[1];
-    
     //normal PCM is mixed(interleave) track, but fltp "p" means planar
     if(pFrame->format == AV_SAMPLE_FMT_FLTP) 
     {
-        for(i=0; i<sample_count; i++){ //stereo 
-            sample0 = (short)(channel0[i]*32767.0f);
-            sample1 = (short)(channel1[i]*32767.0f);
-            fwrite(&sample0, 2, 1, pFile);
-            fwrite(&sample1, 2, 1, pFile);
+        //stereo, converted at once and written with one call
+        if(sample_count > pcm_count){
+            av_free(pcm);
+            pcm = av_malloc(sample_count*2*sizeof(int16_t));
+            if(pcm == NULL){
+                pcm_count = 0;
+                return;
+            }
+            pcm_count = sample_count;
         }
+        sample_fltp_to_s16(pcm, (const float **)pFrame->extended_data, 2, sample_count);
+        fwrite(pcm, sizeof(int16_t), sample_count*2, pFile);
     }else{
         fwrite(pFrame->extended_data[0], 1, size, pFile);
     }
@@ -51,6 +54,8 @@ void SaveFrame2PCM(AVFrame *pFrame, int size, int iFrame){
     //Close FIle
     if(iFrame==SAVE_FRAMES){
         fclose(pFile);
+        av_freep(&pcm);
+        pcm_count = 0;
     }
 }
 
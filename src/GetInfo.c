@@ -1,169 +1,129 @@
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
+#include <libavutil/time.h>
+
+#include "FileIO.h"
+#include "StreamCache.h"
+#include "KeyIndex.h"
+
+/*
+ * Dump the info of a media file and build its keyframe index <mediafile>.spidx for SimplePlayer.
+ *   1. packets are only demuxed, nothing is decoded, streams other than audio/video are discarded
+ *   2. the file is read through the read-ahead FileIO to keep the disk busy
+ *   3. with an index of the same file, indexing goes on from where the last run stopped,
+ *      so a growing file (recording, live capture) costs only its new part.
+ *      Formats without byte seeking are indexed from the start again
+ */
+typedef struct IndexState{
+    int64_t last_pos;       //position of the last entry, entries are added in file order
+    int64_t last_ts;        //for audio thinning
+    int64_t added;
+}IndexState;
+
+static int64_t entry_ts(KeyIndexEntry *e){
+    return e->dts != AV_NOPTS_VALUE ? e->dts : e->pts;
+}
 
-#define SAVE_FRAMES 50
-#define START_FRAME 1
-#define END_FRAME 400
-
-typedef struct Codec{
-    AVFormatContext *FCtx;
-    AVCodecContext *CCtx;
-    AVCodec *Codec;
-    int stream;
-    int type;
-    int drained;
-    double time_base;
-}Codec;
-
-/**********************************************************
- * Param: type: 
- *              AVMEDIA_TYPE_VIDEO/AVMEDIA_TYPE_AUDIO
- *        pFormatCtx: 
- *              the AVFormatContext provides parameters for codec init
- *        c: 
- *              Codec struct for combination
- * ********************************************************/
-int CodecInit(int type, AVFormatContext *pFormatCtx, Codec *c){
-    AVCodecContext *pCodecCtx = NULL;
-    AVCodec *pCodec = NULL;
-    int audioVideo = -1;
-    int Stream = -1;
-
-    if(!pFormatCtx)
-        return -1;
-   
-    if(type == AVMEDIA_TYPE_AUDIO)
-        audioVideo = 0;
-    else if(type == AVMEDIA_TYPE_VIDEO)
-        audioVideo = 1;
-    
-    /* 
-     * 1. One file may have multipule streams ,only get the first video/audio stream
-     * 2. Allocate codec context which is the field maintainace all the info/context while codec working
-     * 3. Copy param from format context to codec context
-     * 4. Find the codec
-     * 5. Open the codec
-     */
-    Stream=-1;
-    Stream = av_find_best_stream(pFormatCtx, type, -1, -1, NULL, 0);
-    
-    if(Stream<0){
-        fprintf(stderr, "no video stream\n");
-        return -1;
-    }else{
-        fprintf(stdout, "stream %d is %s\n", Stream, audioVideo?"video":"audio");
-    }
-
-    pCodecCtx = avcodec_alloc_context3(NULL);
-
-    if(avcodec_parameters_to_context(pCodecCtx, pFormatCtx->streams[Stream]->codecpar)<0){
-        fprintf(stderr, "copy param from format context to codec context failed\n");
-        return -1;
-    }
-    
-    pCodec = avcodec_find_decoder(pCodecCtx->codec_id);
-    if(pCodec==NULL){
-        fprintf(stderr, "Unsupported codec,codec id %d\n", pCodecCtx->codec_id);
+static int ResumeIndex(AVFormatContext *pFormatCtx, KeyIndex *idx){
+    if(pFormatCtx->iformat->flags & AVFMT_NO_BYTE_SEEK){
+        fprintf(stdout, "%s cannot seek by byte, index from the start\n", pFormatCtx->iformat->name);
         return -1;
-    }else{
-        fprintf(stdout, "codec id is %d\n", pCodecCtx->codec_id);
     }
-
-    if(avcodec_open2(pCodecCtx, pCodec, NULL)<0){
-        fprintf(stderr, "open codec failed\n");
+    if(avformat_seek_file(pFormatCtx, -1, INT64_MIN, idx->resume_pos, INT64_MAX, AVSEEK_FLAG_BYTE) < 0){
+        fprintf(stdout, "seek to byte %lld failed, index from the start\n", (long long)idx->resume_pos);
         return -1;
     }
-
-    c->FCtx = pFormatCtx;
-    c->CCtx = pCodecCtx;
-    c->Codec = pCodec;
-    c->stream = Stream;
-    c->type = type;
-    c->time_base = av_q2d(pFormatCtx->streams[Stream]->time_base);
-
+    fprintf(stdout, "index from byte %lld, %lld entries already\n", (long long)idx->resume_pos, (long long)idx->nb_entries);
     return 0;
 }
 
-static int decode_packet(Codec *c, AVPacket *pkt, AVFrame *frame, FILE *file){
-    int ret;
-    double pkt_pts, frame_pts;
+static int BuildIndex(AVFormatContext *pFormatCtx, KeyIndex *idx, IndexState *state, int64_t *packets){
+    AVPacket packet;
+    AVStream *st;
+    KeyIndexEntry entry;
+    int type;
 
-    /* send the packet with the compressed data to the decoder */
-    ret = avcodec_send_packet(c->CCtx, pkt);
-    if (ret < 0) {
-        fprintf(stderr, "Error submitting the packet to the decoder\n");
-        exit(1);
-    }
+    while(av_read_frame(pFormatCtx, &packet)>=0){
+        st = pFormatCtx->streams[packet.stream_index];
+        type = st->codecpar->codec_type;
+        (*packets)++;
+        if(packet.pos >= 0)
+            idx->resume_pos = packet.pos;
 
-    /* read all the output frames (in general there may be any number of them */
-    while (ret >= 0) {
-        ret = avcodec_receive_frame(c->CCtx, frame);
-        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-            return 0;
-        else if (ret < 0) {
-            fprintf(stderr, "Error during decoding\n");
-            exit(1);
+        if(!(packet.flags & AV_PKT_FLAG_KEY) || packet.pos <= state[packet.stream_index].last_pos
+                || (type != AVMEDIA_TYPE_VIDEO && type != AVMEDIA_TYPE_AUDIO)){
+            av_packet_unref(&packet);
+            continue;
         }
-        //to do
-        pkt_pts = pkt->pts*c->time_base;
-        frame_pts = frame->best_effort_timestamp*c->time_base;
-        //fprintf(stdout, "%d\t %s pts = %d\n", VCodec.CCtx->frame_number, media_name, frame->pts);
-        fprintf(file, "%4d\t%10lf\t%10lf\n", c->CCtx->frame_number, pkt_pts, frame_pts);
 
-        av_frame_unref(frame);
-    }
-    return 1;
-}
+        entry.pts = packet.pts;
+        entry.dts = packet.dts;
+        entry.pos = packet.pos;
+        entry.size = packet.size;
+        entry.stream = packet.stream_index;
+        av_packet_unref(&packet);
 
-static int get_frame(Codec *c, AVPacket *pkt, AVFrame *frame, int *packet_consumed){
-    int ret;
-
-    do{
-        ret = avcodec_receive_frame(c->CCtx, frame);
-        if(ret==0)
-            return 1;
-        else if(ret==AVERROR(EAGAIN)){
-            avcodec_send_packet(c->CCtx, pkt);
-            *packet_consumed = 1;
-        }else if(ret==AVERROR_EOF){
-            return 0;
-            *packet_consumed = 1;
-        }else{
-            fprintf(stdout, "receive error, return %d\n", ret);
+        //every audio packet is a keyframe, a few of them are enough for seeking
+        if(type == AVMEDIA_TYPE_AUDIO && state[entry.stream].last_ts != AV_NOPTS_VALUE && entry_ts(&entry) != AV_NOPTS_VALUE
+                && av_rescale_q(entry_ts(&entry) - state[entry.stream].last_ts, st->time_base, AV_TIME_BASE_Q) < KEY_INDEX_AUDIO_INTERVAL)
+            continue;
+
+        if(key_index_add(idx, &entry) < 0)
             return -1;
-        }
-    }while(1);
-    return 1;
+        state[entry.stream].last_pos = entry.pos;
+        state[entry.stream].last_ts = entry_ts(&entry);
+        state[entry.stream].added++;
+    }
+    return 0;
 }
 
 int main(int argc, char *argv[]){
     AVFormatContext *pFormatCtx = NULL;
-    Codec VCodec, ACodec, *c;
-    AVPacket *packet;
-    AVFrame *frame;
-    FILE *vfile=NULL, *afile=NULL, *file=NULL;
-    int i;
-    
-    if(argc != 2){
-        fprintf(stderr, "Usage: GetInfo mediafile\n");
+    FileIO *fio = NULL;
+    KeyIndex *idx = NULL;
+    IndexState *state = NULL;
+    StreamCacheKey key;
+    int64_t start, elapsed, packets = 0, bytes;
+    int io_mode = FILE_IO_READAHEAD, rebuild = 0;
+    char *filename;
+    int i, ret = -1;
+
+    for(i=1; i<argc && argv[i][0]=='-'; i++){
+        if(!strcmp(argv[i], "-rebuild")){
+            rebuild = 1;
+        }else if(!strcmp(argv[i], "-io") && i+1<argc){
+            io_mode = file_io_mode(argv[++i]);
+            if(io_mode < 0)
+                break;
+        }else{
+            break;
+        }
+    }
+    if(i != argc-1 || io_mode < 0){
+        fprintf(stderr, "Usage: GetInfo [-rebuild] [-io default|mmap|readahead|uring|uring_direct] mediafile\n");
         return -1;
     }
+    filename = argv[i];
 
-    pFormatCtx = avformat_alloc_context();
+    if(stream_cache_key(filename, &key) < 0){
+        fprintf(stderr, "cannot read %s\n", filename);
+        return -1;
+    }
 
     //Open and get stream info
-    if(avformat_open_input(&pFormatCtx, argv[1], NULL, NULL)!=0){
+    if(file_io_open_input(&pFormatCtx, filename, io_mode, FILE_IO_WINDOW, &fio)!=0){
         fprintf(stderr, "open input failed\n");
         return -1;
     }
-    
-    if(avformat_find_stream_info(pFormatCtx, NULL)<0){
+
+    //probed in full every time, an info tool leaves no sidecar behind
+    if(stream_cache_find_stream_info(pFormatCtx, filename, 0)<0){
         fprintf(stderr, "find stream info failed\n");
-        return -1;
+        goto end;
     }
 
-    av_dump_format(pFormatCtx, 0, argv[1], 0);
-    
+    av_dump_format(pFormatCtx, 0, filename, 0);
+
     fprintf(stdout, "chapter number = %d\n", pFormatCtx->nb_chapters);
     for(i=0; i<pFormatCtx->nb_chapters; i++){
         AVChapter *chapter = pFormatCtx->chapters[i];
@@ -172,40 +132,63 @@ int main(int argc, char *argv[]){
         fprintf(stdout, "[%d] start = %lf, end = %lf\n", chapter->id, start, end);
     }
 
-    CodecInit(AVMEDIA_TYPE_VIDEO, pFormatCtx, &VCodec);
-    CodecInit(AVMEDIA_TYPE_AUDIO, pFormatCtx, &ACodec);
-
-    frame = av_frame_alloc();
-    packet = av_packet_alloc();
-
-    vfile = fopen("video.pts", "wb+");
-    afile = fopen("audio.pts", "wb+");
-    /*
-    //Read from stream into packet
-    while(av_read_frame(pFormatCtx, packet)>=0){
-        //deal with the video stream of the type "videoStream" and audioStream
-        if(packet->stream_index==VCodec.stream){
-            c = &VCodec;
-            file = vfile;
-        }else if(packet->stream_index==ACodec.stream){
-            c = &ACodec;
-            file = afile;
-        }else{
-            av_packet_unref(packet);
-            continue;
+    state = av_malloc_array(pFormatCtx->nb_streams, sizeof(IndexState));
+    if(!state)
+        goto end;
+    for(i=0; i<pFormatCtx->nb_streams; i++){
+        state[i].last_pos = -1;
+        state[i].last_ts = AV_NOPTS_VALUE;
+        state[i].added = 0;
+        if(pFormatCtx->streams[i]->codecpar->codec_type != AVMEDIA_TYPE_VIDEO
+                && pFormatCtx->streams[i]->codecpar->codec_type != AVMEDIA_TYPE_AUDIO)
+            pFormatCtx->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    if(!rebuild)
+        idx = key_index_load(filename);
+    if(idx && (!key_index_match(idx, pFormatCtx) || ResumeIndex(pFormatCtx, idx) < 0))
+        key_index_free(&idx);
+    if(idx){
+        for(i=0; i<idx->nb_entries; i++){
+            state[idx->entries[i].stream].last_pos = idx->entries[i].pos;
+            state[idx->entries[i].stream].last_ts = entry_ts(&idx->entries[i]);
         }
-        //fprintf(stdout, "packet size = %d\n", packet->size);
-        decode_packet(c, packet, frame, file);
-        av_packet_unref(packet);
-    }*/
+    }else{
+        idx = key_index_alloc(pFormatCtx);
+        if(!idx)
+            goto end;
+    }
 
+    start = av_gettime_relative();
+    bytes = avio_tell(pFormatCtx->pb);
+    if(BuildIndex(pFormatCtx, idx, state, &packets) < 0){
+        fprintf(stderr, "out of memory while indexing\n");
+        goto end;
+    }
+    elapsed = FFMAX(av_gettime_relative() - start, 1);
+    bytes = avio_tell(pFormatCtx->pb) - bytes;
+
+    idx->header_crc = key.header_crc;
+    idx->indexed_size = key.file_size;
+    if(key_index_save(idx, filename) < 0)
+        fprintf(stderr, "cannot write %s%s\n", filename, KEY_INDEX_SUFFIX);
+
+    fprintf(stdout, "indexed %lld bytes, %lld packets in %lld ms, %.1f MB/s\n",
+            (long long)bytes, (long long)packets, (long long)(elapsed/1000), bytes/(double)elapsed);
+    for(i=0; i<pFormatCtx->nb_streams; i++){
+        if(pFormatCtx->streams[i]->discard != AVDISCARD_ALL)
+            fprintf(stdout, "stream %d: %lld new entries\n", i, (long long)state[i].added);
+    }
+    fprintf(stdout, "%lld entries in %s%s\n", (long long)idx->nb_entries, filename, KEY_INDEX_SUFFIX);
+    if(fio)
+        file_io_log(fio);
+    ret = 0;
+
+end:
     //free buffers
-    av_free(frame);
-    av_free(packet);
-    avcodec_close(VCodec.CCtx);
-    avcodec_close(ACodec.CCtx);
+    key_index_free(&idx);
+    av_free(state);
     avformat_close_input(&pFormatCtx);
-    fclose(vfile);
-    fclose(afile);
-    return 0;
+    file_io_close(&fio);
+    return ret;
 }
@@ -0,0 +1,317 @@
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/time.h>
+
+#include <SDL2/SDL.h>
+
+#include "FileIO.h"
+
+#define MAX_SNAPSHOTS 64
+#define DEF_SNAPSHOTS 10
+#define DEF_WIDTH     320
+
+/*
+ * Snapshot mode of GetVideoFrames:
+ *   GetVideoFrames decodes every frame from the beginning of the file and only keeps
+ *   START_FRAME..END_FRAME. For thumbnails we only need one picture per timestamp, so
+ *   1. seek to the keyframe before every wanted timestamp
+ *   2. only key packets are sent to the decoder (skip_frame = AVDISCARD_NONKEY as well)
+ *   3. lowres is used when the decoder supports it, sws only does the rest of the scaling
+ *   4. each file is handled by one worker thread, workers run on all the cores
+ */
+typedef struct SnapshotParam{
+    char **files;
+    int nb_files;
+    SDL_atomic_t next_file;
+    int64_t timestamps[MAX_SNAPSHOTS];  //AV_TIME_BASE, only used when nb_timestamps > 0
+    int nb_timestamps;
+    int nb_snapshots;                   //evenly spaced snapshots when no timestamp is given
+    int width;                          //output width, height keeps the aspect ratio
+    int raw;                            //1: raw yuv420p frames, 0: ppm images
+    int io_mode;                        //FILE_IO_DEFAULT/FILE_IO_MMAP/FILE_IO_READAHEAD
+}SnapshotParam;
+
+static void SaveFrame2PPM(AVFrame *pFrame, const char *filename){
+    FILE *pFile;
+    int y;
+
+    pFile = fopen(filename, "wb");
+    if(pFile==NULL)
+        return;
+
+    fprintf(pFile, "P6\n%d %d\n255\n", pFrame->width, pFrame->height);
+    for(y=0; y<pFrame->height; y++)
+        fwrite(pFrame->data[0]+y*pFrame->linesize[0], 1, pFrame->width*3, pFile);
+
+    fclose(pFile);
+}
+
+static void SaveFrame2YUV(AVFrame *pFrame, const char *filename){
+    FILE *pFile;
+    int y;
+
+    pFile = fopen(filename, "wb");
+    if(pFile==NULL)
+        return;
+
+    //only write the visible part of the lines, yuv420p
+    for(y=0; y<pFrame->height; y++)
+        fwrite(pFrame->data[0]+y*pFrame->linesize[0], 1, pFrame->width, pFile);
+    for(y=0; y<(pFrame->height+1)/2; y++)
+        fwrite(pFrame->data[1]+y*pFrame->linesize[1], 1, (pFrame->width+1)/2, pFile);
+    for(y=0; y<(pFrame->height+1)/2; y++)
+        fwrite(pFrame->data[2]+y*pFrame->linesize[2], 1, (pFrame->width+1)/2, pFile);
+
+    fclose(pFile);
+}
+
+/*
+ * The lowres decoder scales by 1/2^lowres, choose the largest one
+ * which still keeps the decoded picture not smaller than the output.
+ */
+static int ChooseLowres(AVCodec *pCodec, int src_width, int dst_width){
+    int lowres = 0;
+
+    while(lowres < pCodec->max_lowres && (src_width>>(lowres+1)) >= dst_width)
+        lowres++;
+    return lowres;
+}
+
+/*
+ * Send key packets until the decoder outputs a picture.
+ * A keyframe is drained out of the decoder at once, so we do not have to wait for
+ * the following packets which would be skipped anyway.
+ */
+static int DecodeKeyFrame(AVFormatContext *pFormatCtx, AVCodecContext *pCodecCtx, int stream, AVPacket *pPacket, AVFrame *pFrame){
+    int ret;
+
+    while(av_read_frame(pFormatCtx, pPacket)>=0){
+        if(pPacket->stream_index!=stream || !(pPacket->flags&AV_PKT_FLAG_KEY)){
+            av_packet_unref(pPacket);
+            continue;
+        }
+
+        ret = avcodec_send_packet(pCodecCtx, pPacket);
+        av_packet_unref(pPacket);
+        if(ret<0)
+            continue;
+
+        //drain the keyframe, flush the decoder for the next seek
+        avcodec_send_packet(pCodecCtx, NULL);
+        ret = avcodec_receive_frame(pCodecCtx, pFrame);
+        avcodec_flush_buffers(pCodecCtx);
+        if(ret>=0)
+            return 0;
+    }
+    return -1;
+}
+
+static int SnapshotFile(SnapshotParam *param, const char *filename){
+    AVFormatContext *pFormatCtx = NULL;
+    FileIO *fio = NULL;
+    AVCodecContext *pCodecCtx = NULL;
+    AVCodec *pCodec = NULL;
+    AVPacket *pPacket = NULL;
+    AVFrame *pFrame = NULL, *pOutFrame = NULL;
+    struct SwsContext *pSwsCtx = NULL;
+    enum AVPixelFormat out_fmt = param->raw ? AV_PIX_FMT_YUV420P : AV_PIX_FMT_RGB24;
+    const char *basename;
+    char szFilename[512];
+    int64_t ts, start_time, duration, decode_start;
+    int nb, i, videoStream, out_width, out_height, saved = 0;
+
+    //the read-ahead window is small, only a few keyframes are read after every seek
+    if(file_io_open_input(&pFormatCtx, filename, param->io_mode, FILE_IO_CHUNK, &fio)!=0){
+        fprintf(stderr, "open input %s failed\n", filename);
+        return -1;
+    }
+    if(avformat_find_stream_info(pFormatCtx, NULL)<0){
+        fprintf(stderr, "find stream info of %s failed\n", filename);
+        goto end;
+    }
+
+    videoStream = av_find_best_stream(pFormatCtx, AVMEDIA_TYPE_VIDEO, -1, -1, &pCodec, 0);
+    if(videoStream<0 || !pCodec){
+        fprintf(stderr, "no video stream in %s\n", filename);
+        goto end;
+    }
+
+    //only the video stream is demuxed
+    for(i=0; i<pFormatCtx->nb_streams; i++)
+        if(i!=videoStream)
+            pFormatCtx->streams[i]->discard = AVDISCARD_ALL;
+
+    pCodecCtx = avcodec_alloc_context3(NULL);
+    if(avcodec_parameters_to_context(pCodecCtx, pFormatCtx->streams[videoStream]->codecpar)<0){
+        fprintf(stderr, "copy param from format context to codec context failed\n");
+        goto end;
+    }
+
+    //files are decoded in parallel, one thread for one decoder
+    pCodecCtx->thread_count = 1;
+    pCodecCtx->skip_frame = AVDISCARD_NONKEY;
+    pCodecCtx->lowres = ChooseLowres(pCodec, pCodecCtx->width, param->width);
+
+    if(avcodec_open2(pCodecCtx, pCodec, NULL)<0){
+        fprintf(stderr, "open codec failed\n");
+        goto end;
+    }
+
+    pPacket = av_packet_alloc();
+    pFrame = av_frame_alloc();
+    pOutFrame = av_frame_alloc();
+    if(pPacket == NULL || pFrame == NULL || pOutFrame == NULL){
+        fprintf(stderr, "cannot get buffer of frame or packet\n");
+        goto end;
+    }
+
+    start_time = pFormatCtx->start_time!=AV_NOPTS_VALUE ? pFormatCtx->start_time : 0;
+    duration = pFormatCtx->duration!=AV_NOPTS_VALUE ? pFormatCtx->duration : 0;
+    nb = param->nb_timestamps ? param->nb_timestamps : param->nb_snapshots;
+
+    basename = strrchr(filename, '/');
+    basename = basename ? basename+1 : filename;
+
+    decode_start = av_gettime_relative();
+    for(i=0; i<nb; i++){
+        if(param->nb_timestamps)
+            ts = start_time + param->timestamps[i];
+        else
+            ts = start_time + duration*(2*i+1)/(2*nb);
+
+        //land on the keyframe before ts
+        if(avformat_seek_file(pFormatCtx, -1, INT64_MIN, ts, ts, 0)<0){
+            fprintf(stderr, "%s seek to %lf failed\n", basename, ts/(double)AV_TIME_BASE);
+            continue;
+        }
+        avcodec_flush_buffers(pCodecCtx);
+
+        if(DecodeKeyFrame(pFormatCtx, pCodecCtx, videoStream, pPacket, pFrame)<0)
+            break;
+
+        out_width = param->width > pFrame->width ? pFrame->width : param->width;
+        out_height = av_rescale(pFrame->height, out_width, pFrame->width) & ~1;
+
+        pSwsCtx = sws_getCachedContext(pSwsCtx, pFrame->width, pFrame->height, pFrame->format,
+                out_width, out_height, out_fmt, SWS_BILINEAR, NULL, NULL, NULL);
+        if(!pSwsCtx){
+            fprintf(stderr, "cannot get sws context\n");
+            av_frame_unref(pFrame);
+            break;
+        }
+
+        pOutFrame->format = out_fmt;
+        pOutFrame->width = out_width;
+        pOutFrame->height = out_height;
+        if(av_frame_get_buffer(pOutFrame, 32)<0){
+            av_frame_unref(pFrame);
+            break;
+        }
+        sws_scale(pSwsCtx, (const uint8_t * const *)pFrame->data, pFrame->linesize, 0, pFrame->height,
+                pOutFrame->data, pOutFrame->linesize);
+
+        if(param->raw){
+            snprintf(szFilename, sizeof(szFilename), "%s_%02d_%dx%d.yuv", basename, i, out_width, out_height);
+            SaveFrame2YUV(pOutFrame, szFilename);
+        }else{
+            snprintf(szFilename, sizeof(szFilename), "%s_%02d.ppm", basename, i);
+            SaveFrame2PPM(pOutFrame, szFilename);
+        }
+        saved++;
+
+        av_frame_unref(pOutFrame);
+        av_frame_unref(pFrame);
+    }
+
+    fprintf(stdout, "%s: %d snapshots, lowres %d, %lld ms\n", basename, saved, pCodecCtx->lowres,
+            (long long)((av_gettime_relative()-decode_start)/1000));
+
+end:
+    sws_freeContext(pSwsCtx);
+    av_frame_free(&pOutFrame);
+    av_frame_free(&pFrame);
+    av_packet_free(&pPacket);
+    avcodec_free_context(&pCodecCtx);
+    avformat_close_input(&pFormatCtx);
+    if(fio){
+        file_io_log(fio);
+        file_io_close(&fio);
+    }
+    return saved ? 0 : -1;
+}
+
+int SnapshotThread(void *arg){
+    SnapshotParam *param = arg;
+    int i;
+
+    while((i = SDL_AtomicAdd(&param->next_file, 1)) < param->nb_files)
+        SnapshotFile(param, param->files[i]);
+
+    return 0;
+}
+
+static int ParseTimestamps(SnapshotParam *param, char *list){
+    char *token, *saveptr = NULL;
+
+    param->nb_timestamps = 0;
+    for(token = strtok_r(list, ",", &saveptr); token && param->nb_timestamps < MAX_SNAPSHOTS;
+            token = strtok_r(NULL, ",", &saveptr))
+        param->timestamps[param->nb_timestamps++] = (int64_t)(atof(token)*AV_TIME_BASE);
+
+    return param->nb_timestamps ? 0 : -1;
+}
+
+int main(int argc, char *argv[]){
+    SnapshotParam param;
+    SDL_Thread *tids[64];
+    int i, nb_threads;
+
+    memset(&param, 0, sizeof(param));
+    param.nb_snapshots = DEF_SNAPSHOTS;
+    param.width = DEF_WIDTH;
+
+    for(i=1; i<argc && argv[i][0]=='-'; i++){
+        if(!strcmp(argv[i], "-n") && i+1<argc){
+            param.nb_snapshots = atoi(argv[++i]);
+        }else if(!strcmp(argv[i], "-t") && i+1<argc){
+            if(ParseTimestamps(&param, argv[++i])<0)
+                goto usage;
+        }else if(!strcmp(argv[i], "-w") && i+1<argc){
+            param.width = atoi(argv[++i]);
+        }else if(!strcmp(argv[i], "-raw")){
+            param.raw = 1;
+        }else if(!strcmp(argv[i], "-io") && i+1<argc){
+            param.io_mode = file_io_mode(argv[++i]);
+            if(param.io_mode<0)
+                goto usage;
+        }else{
+            goto usage;
+        }
+    }
+
+    if(i>=argc || param.nb_snapshots<=0 || param.nb_snapshots>MAX_SNAPSHOTS || param.width<=0)
+        goto usage;
+
+    param.files = &argv[i];
+    param.nb_files = argc-i;
+    SDL_AtomicSet(&param.next_file, 0);
+
+    nb_threads = SDL_GetCPUCount();
+    if(nb_threads > param.nb_files)
+        nb_threads = param.nb_files;
+    if(nb_threads > 64)
+        nb_threads = 64;
+
+    for(i=0; i<nb_threads; i++)
+        tids[i] = SDL_CreateThread(SnapshotThread, "SnapshotThread", &param);
+    for(i=0; i<nb_threads; i++)
+        SDL_WaitThread(tids[i], NULL);
+
+    return 0;
+
+usage:
+    fprintf(stderr, "Usage: %s [-n count | -t sec1,sec2,...] [-w width] [-raw] [-io default|mmap|readahead|uring|uring_direct] mediafile...\n", argv[0]);
+    return -1;
+}
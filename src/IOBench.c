@@ -0,0 +1,158 @@
+#include <libavformat/avformat.h>
+#include <libavutil/time.h>
+
+#include <SDL2/SDL.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "FileIO.h"
+
+#define MAX_JOBS  64
+#define MAX_MODES 8
+
+/*
+ * Demux a whole file with every FileIO mode against the file protocol, on cold and warm cache.
+ *   cold: the pages of the file are dropped with POSIX_FADV_DONTNEED before the run,
+ *         only clean pages can be dropped, for a strict cold cache run as root after drop_caches
+ *   warm: the file has just been read by the cold run
+ * With -jobs n the file is demuxed by n threads at once, like n streams of a player.
+ */
+typedef struct BenchJob{
+    const char *filename;
+    int mode;
+    int used_mode;          //mode FileIO ended up with after its fallbacks
+    int64_t packets;
+    int ret;
+    FileIOStats stats;
+}BenchJob;
+
+static void DropCache(const char *filename){
+    int fd = open(filename, O_RDONLY);
+
+    if(fd < 0)
+        return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+static int DemuxThread(void *arg){
+    BenchJob *job = arg;
+    AVFormatContext *pFormatCtx = NULL;
+    FileIO *fio = NULL;
+    AVPacket packet;
+
+    job->ret = file_io_open_input(&pFormatCtx, job->filename, job->mode, FILE_IO_WINDOW, &fio);
+    if(job->ret < 0)
+        return -1;
+    job->used_mode = fio ? file_io_mode_used(fio) : FILE_IO_DEFAULT;
+
+    while(av_read_frame(pFormatCtx, &packet)>=0){
+        job->packets++;
+        av_packet_unref(&packet);
+    }
+
+    if(fio)
+        job->stats = fio->stats;
+    avformat_close_input(&pFormatCtx);
+    file_io_close(&fio);
+    return 0;
+}
+
+static void RunBench(const char *filename, const char *mode_name, int64_t file_size, int nb_jobs, int cold){
+    BenchJob jobs[MAX_JOBS];
+    SDL_Thread *tids[MAX_JOBS];
+    FileIOStats total;
+    int64_t start, elapsed, packets = 0;
+    int i, failed = 0, fallback = -1;
+
+    memset(jobs, 0, sizeof(jobs));
+    memset(&total, 0, sizeof(total));
+    if(cold)
+        DropCache(filename);
+
+    start = av_gettime_relative();
+    for(i=0; i<nb_jobs; i++){
+        jobs[i].filename = filename;
+        jobs[i].mode = file_io_mode(mode_name);
+        tids[i] = SDL_CreateThread(DemuxThread, "DemuxThread", &jobs[i]);
+    }
+    for(i=0; i<nb_jobs; i++)
+        SDL_WaitThread(tids[i], NULL);
+    elapsed = av_gettime_relative() - start;
+
+    for(i=0; i<nb_jobs; i++){
+        if(jobs[i].ret < 0)
+            failed++;
+        else if(jobs[i].used_mode != jobs[i].mode)
+            fallback = jobs[i].used_mode;
+        packets += jobs[i].packets;
+        total.reads += jobs[i].stats.reads;
+        total.read_time += jobs[i].stats.read_time;
+        total.stalls += jobs[i].stats.stalls;
+        total.stall_time += jobs[i].stats.stall_time;
+        if(jobs[i].stats.max_read_time > total.max_read_time)
+            total.max_read_time = jobs[i].stats.max_read_time;
+    }
+
+    fprintf(stdout, "%-13s %-5s %8.1f ms %9.1f MB/s %9lld pkts", mode_name, cold ? "cold" : "warm",
+            elapsed/1000.0, file_size*nb_jobs/(double)elapsed, (long long)packets);
+    if(total.reads)
+        fprintf(stdout, "  read avg %lld us max %lld us, %lld stalls %lld ms",
+                (long long)(total.read_time/total.reads), (long long)total.max_read_time,
+                (long long)total.stalls, (long long)(total.stall_time/1000));
+    //the row is labelled with the mode asked for, a fallback is marked so it is not taken for it
+    if(fallback >= 0)
+        fprintf(stdout, "  fell back to %s", file_io_mode_name(fallback));
+    if(failed)
+        fprintf(stdout, "  %d jobs failed", failed);
+    fprintf(stdout, "\n");
+}
+
+int main(int argc, char *argv[]){
+    char modes[] = "default,mmap,readahead,uring,uring_direct";
+    char *mode_list = modes, *mode_names[MAX_MODES], *token, *saveptr = NULL;
+    struct stat st;
+    int nb_modes = 0, nb_jobs = 1, runs = 3;
+    int i, j, k;
+
+    for(i=1; i<argc && argv[i][0]=='-'; i++){
+        if(!strcmp(argv[i], "-modes") && i+1<argc)
+            mode_list = argv[++i];
+        else if(!strcmp(argv[i], "-jobs") && i+1<argc)
+            nb_jobs = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-runs") && i+1<argc)
+            runs = atoi(argv[++i]);
+        else
+            goto usage;
+    }
+    if(i>=argc || nb_jobs<=0 || nb_jobs>MAX_JOBS || runs<=0)
+        goto usage;
+
+    for(token = strtok_r(mode_list, ",", &saveptr); token && nb_modes < MAX_MODES;
+            token = strtok_r(NULL, ",", &saveptr)){
+        if(file_io_mode(token) < 0)
+            goto usage;
+        mode_names[nb_modes++] = token;
+    }
+
+    if(stat(argv[i], &st) < 0){
+        fprintf(stderr, "cannot stat %s\n", argv[i]);
+        return -1;
+    }
+    av_log_set_level(AV_LOG_ERROR);
+
+    fprintf(stdout, "%s: %lld bytes, %d jobs, 1 cold + %d warm runs per mode\n",
+            argv[i], (long long)st.st_size, nb_jobs, runs);
+    for(j=0; j<nb_modes; j++){
+        RunBench(argv[i], mode_names[j], st.st_size, nb_jobs, 1);
+        for(k=0; k<runs; k++)
+            RunBench(argv[i], mode_names[j], st.st_size, nb_jobs, 0);
+    }
+    return 0;
+
+usage:
+    fprintf(stderr, "Usage: %s [-modes default,mmap,readahead,uring,uring_direct] [-jobs n] [-runs n] mediafile\n", argv[0]);
+    return -1;
+}
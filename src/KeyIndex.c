@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <string.h>
+#include "StreamCache.h"
+#include "KeyIndex.h"
+
+typedef struct KeyIndexHeader{
+    char magic[4];
+    int32_t version;
+    int32_t entry_size;
+    int32_t nb_streams;
+    uint32_t header_crc;
+    int64_t indexed_size;
+    int64_t resume_pos;
+    int64_t nb_entries;
+}KeyIndexHeader;
+
+static const char index_magic[4] = {'S', 'P', 'K', 'I'};
+
+KeyIndex *key_index_alloc(AVFormatContext *ctx){
+    KeyIndex *idx;
+    int i;
+
+    idx = av_mallocz(sizeof(KeyIndex));
+    if(!idx)
+        return NULL;
+    idx->nb_streams = ctx->nb_streams;
+    idx->streams = av_mallocz_array(ctx->nb_streams, sizeof(KeyIndexStream));
+    if(!idx->streams){
+        av_free(idx);
+        return NULL;
+    }
+    for(i=0; i<ctx->nb_streams; i++){
+        idx->streams[i].codec_type = ctx->streams[i]->codecpar->codec_type;
+        idx->streams[i].time_base = ctx->streams[i]->time_base;
+    }
+    return idx;
+}
+
+void key_index_free(KeyIndex **pidx){
+    KeyIndex *idx = *pidx;
+
+    if(!idx)
+        return;
+    av_free(idx->streams);
+    av_free(idx->entries);
+    av_freep(pidx);
+}
+
+int key_index_add(KeyIndex *idx, KeyIndexEntry *entry){
+    KeyIndexEntry *entries;
+
+    if(idx->nb_entries >= idx->allocated){
+        entries = av_realloc_array(idx->entries, idx->allocated ? idx->allocated*2 : 1024, sizeof(KeyIndexEntry));
+        if(!entries)
+            return -1;
+        idx->entries = entries;
+        idx->allocated = idx->allocated ? idx->allocated*2 : 1024;
+    }
+    idx->entries[idx->nb_entries++] = *entry;
+    return 0;
+}
+
+KeyIndex *key_index_load(const char *filename){
+    KeyIndexHeader header;
+    StreamCacheKey key;
+    KeyIndex *idx = NULL;
+    char path[1024];
+    FILE *pFile;
+    int64_t i;
+
+    if(stream_cache_key(filename, &key) < 0)
+        return NULL;
+    snprintf(path, sizeof(path), "%s%s", filename, KEY_INDEX_SUFFIX);
+    pFile = fopen(path, "rb");
+    if(!pFile)
+        return NULL;
+
+    //a grown file keeps its index, anything else is another file
+    if(fread(&header, sizeof(header), 1, pFile) != 1 || memcmp(header.magic, index_magic, 4)
+            || header.version != KEY_INDEX_VERSION || header.entry_size != sizeof(KeyIndexEntry)
+            || header.header_crc != key.header_crc || header.indexed_size > key.file_size
+            || header.nb_streams <= 0 || header.nb_entries < 0)
+        goto fail;
+
+    idx = av_mallocz(sizeof(KeyIndex));
+    if(!idx)
+        goto fail;
+    idx->header_crc = header.header_crc;
+    idx->indexed_size = header.indexed_size;
+    idx->resume_pos = header.resume_pos;
+    idx->nb_streams = header.nb_streams;
+    idx->nb_entries = header.nb_entries;
+    idx->allocated = FFMAX(header.nb_entries, 1);
+    idx->streams = av_mallocz_array(header.nb_streams, sizeof(KeyIndexStream));
+    idx->entries = av_malloc_array(idx->allocated, sizeof(KeyIndexEntry));
+    if(!idx->streams || !idx->entries
+            || fread(idx->streams, sizeof(KeyIndexStream), header.nb_streams, pFile) != header.nb_streams
+            || fread(idx->entries, sizeof(KeyIndexEntry), header.nb_entries, pFile) != header.nb_entries)
+        goto fail;
+    for(i=0; i<idx->nb_entries; i++){
+        if(idx->entries[i].stream < 0 || idx->entries[i].stream >= idx->nb_streams)
+            goto fail;
+    }
+
+    fclose(pFile);
+    return idx;
+
+fail:
+    key_index_free(&idx);
+    fclose(pFile);
+    return NULL;
+}
+
+/* written to a temporary file and renamed like the stream cache */
+int key_index_save(KeyIndex *idx, const char *filename){
+    KeyIndexHeader header;
+    char path[1024], tmp_path[1024];
+    FILE *pFile;
+
+    snprintf(path, sizeof(path), "%s%s", filename, KEY_INDEX_SUFFIX);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    pFile = fopen(tmp_path, "wb");
+    if(!pFile)
+        return -1;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, index_magic, 4);
+    header.version = KEY_INDEX_VERSION;
+    header.entry_size = sizeof(KeyIndexEntry);
+    header.nb_streams = idx->nb_streams;
+    header.header_crc = idx->header_crc;
+    header.indexed_size = idx->indexed_size;
+    header.resume_pos = idx->resume_pos;
+    header.nb_entries = idx->nb_entries;
+    fwrite(&header, sizeof(header), 1, pFile);
+    fwrite(idx->streams, sizeof(KeyIndexStream), idx->nb_streams, pFile);
+    fwrite(idx->entries, sizeof(KeyIndexEntry), idx->nb_entries, pFile);
+
+    if(fclose(pFile) != 0 || rename(tmp_path, path) != 0){
+        remove(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+int key_index_match(KeyIndex *idx, AVFormatContext *ctx){
+    int i;
+
+    if(idx->nb_streams != ctx->nb_streams)
+        return 0;
+    for(i=0; i<idx->nb_streams; i++){
+        if(idx->streams[i].codec_type != ctx->streams[i]->codecpar->codec_type
+                || av_cmp_q(idx->streams[i].time_base, ctx->streams[i]->time_base))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Entries go in with dts like the generic index of libavformat,
+ * streams with a container index keep it, the demuxer may depend on it.
+ */
+int key_index_attach(AVFormatContext *ctx, const char *filename){
+    KeyIndex *idx;
+    KeyIndexEntry *e;
+    int64_t i, added = 0;
+    int *attach;
+    int s;
+
+    idx = key_index_load(filename);
+    if(!idx)
+        return -1;
+    attach = av_mallocz_array(idx->nb_streams, sizeof(int));
+    if(!attach || !key_index_match(idx, ctx)){
+        fprintf(stderr, "key index of %s does not match the file\n", filename);
+        av_free(attach);
+        key_index_free(&idx);
+        return -1;
+    }
+
+    for(s=0; s<idx->nb_streams; s++)
+        attach[s] = ctx->streams[s]->nb_index_entries == 0;
+    for(i=0; i<idx->nb_entries; i++){
+        e = &idx->entries[i];
+        if(!attach[e->stream])
+            continue;
+        if(av_add_index_entry(ctx->streams[e->stream], e->pos, e->dts != AV_NOPTS_VALUE ? e->dts : e->pts,
+                    e->size, 0, AVINDEX_KEYFRAME) >= 0)
+            added++;
+    }
+
+    fprintf(stdout, "key index of %s: %lld of %lld entries attached, %lld bytes indexed\n",
+            filename, (long long)added, (long long)idx->nb_entries, (long long)idx->indexed_size);
+    av_free(attach);
+    key_index_free(&idx);
+    return added;
+}
@@ -0,0 +1,57 @@
+#ifndef __INCLUDED_KEYINDEX_H__
+#define __INCLUDED_KEYINDEX_H__
+#include <libavformat/avformat.h>
+
+/*
+ * Keyframe index of a media file, built by GetInfo into <mediafile>.spidx:
+ *   1. every keyframe of the video streams, audio streams at most one entry per KEY_INDEX_AUDIO_INTERVAL
+ *   2. entries are in file order, timestamps in the time base of their stream
+ *   3. resume_pos is where GetInfo goes on when the file has grown since the last run
+ * The player attaches it to the streams without a container index (TS, raw ES),
+ * so seeking and trick play find the keyframes without scanning the file.
+ */
+#define KEY_INDEX_SUFFIX         ".spidx"
+#define KEY_INDEX_VERSION        1
+#define KEY_INDEX_AUDIO_INTERVAL 500000     //usecond
+
+typedef struct KeyIndexEntry{
+    int64_t pts;
+    int64_t dts;
+    int64_t pos;
+    int32_t size;
+    int32_t stream;
+}KeyIndexEntry;
+
+typedef struct KeyIndexStream{
+    int32_t codec_type;
+    AVRational time_base;
+}KeyIndexStream;
+
+typedef struct KeyIndex{
+    uint32_t header_crc;        //StreamCacheKey.header_crc of the file indexed
+    int64_t indexed_size;       //file size when indexed
+    int64_t resume_pos;         //byte position to go on indexing from
+    int nb_streams;
+    KeyIndexStream *streams;
+    KeyIndexEntry *entries;
+    int64_t nb_entries;
+    int64_t allocated;
+}KeyIndex;
+
+KeyIndex *key_index_alloc(AVFormatContext *ctx);
+void key_index_free(KeyIndex **pidx);
+int key_index_add(KeyIndex *idx, KeyIndexEntry *entry);
+
+/* NULL when there is no index or it belongs to another file */
+KeyIndex *key_index_load(const char *filename);
+int key_index_save(KeyIndex *idx, const char *filename);
+
+/* return 1 if the index has the streams of ctx */
+int key_index_match(KeyIndex *idx, AVFormatContext *ctx);
+
+/*
+ * Load the index of filename and add its entries to the streams without index entries.
+ * Return the number of entries added, <0 when there is no usable index.
+ */
+int key_index_attach(AVFormatContext *ctx, const char *filename);
+#endif
@@ -6,6 +6,7 @@
 #include <SDL2/SDL.h>
 
 #include "Queue.h"
+#include "SampleConvert.h"
 
 #define DEF_SAMPLES 2048
 #define DATATEST 30
@@ -222,13 +223,11 @@ int AudioThread(void *arg){
     AVPacket packet;
     AVFrame *pFrame = NULL;
     int Stream = c->stream;
-    int i = 0, frameFinished, size=0;
+    int frameFinished, size=0;
     void *buf=NULL, *ptr;
     short *itr;
     int frame_size, write_size, left_size;
     unsigned int sample_count;
-    float *channel0, *channel1;
-    short sample0, sample1;
     unsigned int audio_sleep;
     int ret;
 
@@ -259,17 +258,11 @@ int AudioThread(void *arg){
                 itr = (short *)buf;
                 
                 sample_count = pFrame->nb_samples;
-                channel0 = (float *)pFrame->data[0];
-                channel1 = (float *)pFrame->data[1];
                 //normal PCM is mixed track, but fltp "p" means planar
                 if(pFrame->format == AV_SAMPLE_FMT_FLTP) 
                 {
-                    for(i=0; i<sample_count; i++){ //stereo 
-                        sample0 = (short)(channel0[i]*32767.0f);
-                        sample1 = (short)(channel1[i]*32767.0f);
-                        itr[2*i] = sample0;
-                        itr[2*i+1] = sample1;
-                    }
+                    //stereo
+                    sample_fltp_to_s16(itr, (const float **)pFrame->data, 2, sample_count);
                     frame_size = sample_count*4;
                 }else{
                     memcpy(itr, pFrame->data[0], pFrame->linesize[0]);
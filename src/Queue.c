@@ -69,6 +69,9 @@ int packet_queue_put(PacketQueue *q, AVPacket *pkt){
     q->last_pkt = pkt_node;
     q->nb_packets++;
     q->size += pkt_node->pkt.size;
+    q->duration += pkt_node->pkt.duration;
+    if(pkt_node->pkt.size > 0 && pkt_node->pkt.duration <= 0)
+        q->nb_unknown++;
     SDL_CondSignal(q->cond_getable);
     
     SDL_UnlockMutex(q->mutex);
@@ -97,6 +100,9 @@ int packet_queue_get(PacketQueue *q, AVPacket *pkt){
     q->first_pkt = q->first_pkt->next;
     q->nb_packets--;
     q->size -= pkt_node->pkt.size;
+    q->duration -= pkt_node->pkt.duration;
+    if(pkt_node->pkt.size > 0 && pkt_node->pkt.duration <= 0)
+        q->nb_unknown--;
     if(!q->first_pkt){
         q->last_pkt = NULL;
     }
@@ -112,6 +118,59 @@ int packet_queue_nb_packets(PacketQueue *q){
     return q->nb_packets;
 }
 
+/*
+ * Duration of the packets queued. Without packet durations it is the pts span of the
+ * packets, summed over the runs between the markers of loops, items and seeks,
+ * where the pts start over. Those markers carry no data.
+ */
+int64_t packet_queue_duration(PacketQueue *q){
+    AVPacketList *pkt_node;
+    int64_t duration, span = 0, first = AV_NOPTS_VALUE, last = AV_NOPTS_VALUE;
+
+    SDL_LockMutex(q->mutex);
+    duration = q->duration;
+    if(q->nb_unknown){
+        for(pkt_node = q->first_pkt; pkt_node; pkt_node = pkt_node->next){
+            if(pkt_node->pkt.size <= 0){
+                if(first != AV_NOPTS_VALUE)
+                    span += last - first;
+                first = last = AV_NOPTS_VALUE;
+            }else if(pkt_node->pkt.pts != AV_NOPTS_VALUE){
+                if(first == AV_NOPTS_VALUE || pkt_node->pkt.pts < first)
+                    first = pkt_node->pkt.pts;
+                if(last == AV_NOPTS_VALUE || pkt_node->pkt.pts > last)
+                    last = pkt_node->pkt.pts;
+            }
+        }
+        if(first != AV_NOPTS_VALUE)
+            span += last - first;
+        duration = FFMAX(duration, span);
+    }
+    SDL_UnlockMutex(q->mutex);
+    return duration;
+}
+
+/* drop all the queued packets, a putter waiting for space will be woken up */
+int packet_queue_flush(PacketQueue *q){
+    AVPacketList *pkt_node;
+
+    SDL_LockMutex(q->mutex);
+    for(; q->first_pkt;){
+        pkt_node = q->first_pkt;
+        q->first_pkt = q->first_pkt->next;
+        av_packet_unref(&pkt_node->pkt);
+        av_free(pkt_node);
+    }
+    q->last_pkt = NULL;
+    q->nb_packets = 0;
+    q->size = 0;
+    q->duration = 0;
+    q->nb_unknown = 0;
+    SDL_CondSignal(q->cond_putable);
+    SDL_UnlockMutex(q->mutex);
+    return 0;
+}
+
 
 int frame_queue_init(FrameQueue *frameq, const char *name){
     int i;
@@ -124,16 +183,30 @@ int frame_queue_init(FrameQueue *frameq, const char *name){
     frameq->read_index = 0;
     frameq->nb = 0;
     frameq->abort_request = 0;
-    for(i = 0; i < frameq->max_nb; i++)
+    for(i = 0; i < FRAME_QUEUE_MAX; i++)
         if(!(frameq->queue[i].frame = av_frame_alloc()))
             return AVERROR(ENOMEM);
     return 0;
 }
 
+/*
+ * Frames queued at most, fewer for less latency or more for buffering. The indexes wrap at
+ * FRAME_QUEUE_MAX, so the limit may change at any time, a writer waiting for space is woken up.
+ */
+int frame_queue_limit(FrameQueue *frameq, int max_nb){
+    if(max_nb < 1 || max_nb > FRAME_QUEUE_MAX)
+        return -1;
+    SDL_LockMutex(frameq->mutex);
+    frameq->max_nb = max_nb;
+    SDL_CondSignal(frameq->writable_cond);
+    SDL_UnlockMutex(frameq->mutex);
+    return 0;
+}
+
 int frame_queue_uninit(FrameQueue *frameq){
     int i;
 
-    for(i = 0; i < frameq->max_nb; i++)
+    for(i = 0; i < FRAME_QUEUE_MAX; i++)
         av_free(frameq->queue[i].frame);
 
     SDL_DestroyMutex(frameq->mutex);
@@ -170,10 +243,12 @@ int queue_frame(FrameQueue *frameq, FrameNode *fn){
 
     f = &frameq->queue[frameq->write_index];
     av_frame_move_ref(f->frame, fn->frame);
+    f->serial = fn->serial;
+    f->item = fn->item;
     //av_frame_unref(fn->frame);
     frameq->write_index++;
     frameq->nb++;
-    if(frameq->write_index == frameq->max_nb)
+    if(frameq->write_index == FRAME_QUEUE_MAX)
         frameq->write_index = 0;
     SDL_CondSignal(frameq->readable_cond);
     SDL_UnlockMutex(frameq->mutex);
@@ -198,10 +273,12 @@ int dequeue_frame(FrameQueue *frameq, FrameNode *fn){
 
     f = &frameq->queue[frameq->read_index];
     av_frame_move_ref(fn->frame, f->frame);
+    fn->serial = f->serial;
+    fn->item = f->item;
     //av_frame_unref(f->frame);
     frameq->read_index++;
     frameq->nb--;
-    if(frameq->read_index == frameq->max_nb)
+    if(frameq->read_index == FRAME_QUEUE_MAX)
         frameq->read_index = 0;
     SDL_CondSignal(frameq->writable_cond);
     SDL_UnlockMutex(frameq->mutex);
@@ -209,10 +286,53 @@ int dequeue_frame(FrameQueue *frameq, FrameNode *fn){
     return 0;
 }
 
+/* for the audio callback, return 0 at once when the queue is empty, 1 for a frame */
+int dequeue_frame_nowait(FrameQueue *frameq, FrameNode *fn){
+    FrameNode *f;
+
+    if(frameq->abort_request)
+        return -1;
+
+    SDL_LockMutex(frameq->mutex);
+    if(frameq->nb <= 0){
+        SDL_UnlockMutex(frameq->mutex);
+        return 0;
+    }
+
+    f = &frameq->queue[frameq->read_index];
+    av_frame_move_ref(fn->frame, f->frame);
+    fn->serial = f->serial;
+    fn->item = f->item;
+    frameq->read_index++;
+    frameq->nb--;
+    if(frameq->read_index == FRAME_QUEUE_MAX)
+        frameq->read_index = 0;
+    SDL_CondSignal(frameq->writable_cond);
+    SDL_UnlockMutex(frameq->mutex);
+
+    return 1;
+}
+
 int frame_nb(FrameQueue *frameq){
     return frameq->nb;
 }
 
+/* unref all the queued frames, a writer waiting for space will be woken up */
+int frame_queue_flush(FrameQueue *frameq){
+
+    SDL_LockMutex(frameq->mutex);
+    while(frameq->nb > 0){
+        av_frame_unref(frameq->queue[frameq->read_index].frame);
+        frameq->read_index++;
+        frameq->nb--;
+        if(frameq->read_index == FRAME_QUEUE_MAX)
+            frameq->read_index = 0;
+    }
+    SDL_CondSignal(frameq->writable_cond);
+    SDL_UnlockMutex(frameq->mutex);
+    return 0;
+}
+
 
 void RB_Init(RingBuffer *rb, int len){
     rb->pHead = malloc(len);
@@ -304,4 +424,3 @@ int RB_PullData(RingBuffer *rb, void *data, int size){
     SDL_UnlockMutex(rb->mutex);
     return read_size;
 }
-
@@ -4,7 +4,8 @@
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 
-#define FRAME_QUEUE_NUMBER 20
+#define FRAME_QUEUE_NUMBER 20  //frames queued by default
+#define FRAME_QUEUE_MAX    64  //frames a queue can be limited to
 
 typedef struct PacketQueue{
     AVPacketList *first_pkt;
@@ -12,6 +13,8 @@ typedef struct PacketQueue{
     int nb_packets;
     int max_packets;
     int size;
+    int64_t duration;   //sum of the packet durations, time base of the stream
+    int nb_unknown;     //packets queued without a duration
     char * name;
     int abort_request;
     SDL_cond *cond_putable;
@@ -21,10 +24,12 @@ typedef struct PacketQueue{
 
 typedef struct FrameNode{
     AVFrame *frame;
+    int serial;     //seek serial the frame is decoded in
+    int item;       //playlist item the frame belongs to
 }FrameNode;
 
 typedef struct FrameQueue{
-    FrameNode queue[FRAME_QUEUE_NUMBER];
+    FrameNode queue[FRAME_QUEUE_MAX];
     int read_index;
     int write_index;
     int nb;
@@ -53,13 +58,18 @@ int packet_queue_abort(PacketQueue *q);
 int packet_queue_put(PacketQueue *q, AVPacket *pkt);
 int packet_queue_get(PacketQueue *q, AVPacket *pkt);
 int packet_queue_nb_packets(PacketQueue *q);
+int64_t packet_queue_duration(PacketQueue *q);
+int packet_queue_flush(PacketQueue *q);
 
 int frame_queue_init(FrameQueue *frameq, const char *name);
+int frame_queue_limit(FrameQueue *frameq, int max_nb);
 int frame_queue_uninit(FrameQueue *frameq);
 int frame_queue_abort(FrameQueue *frameq);
 int queue_frame(FrameQueue *frameq, FrameNode *fn);
 int dequeue_frame(FrameQueue *frameq, FrameNode *fn);
+int dequeue_frame_nowait(FrameQueue *frameq, FrameNode *fn);
 int frame_nb(FrameQueue *frameq);
+int frame_queue_flush(FrameQueue *frameq);
 
 void RB_Init(RingBuffer *rb, int len);
 void RB_Uninit(RingBuffer *rb);
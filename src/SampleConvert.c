@@ -0,0 +1,526 @@
+#include <math.h>
+#include "SampleConvert.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+typedef struct SampleKernels{
+    void (*interleave_flt)(float *dst, const float **src, int channels, int nb_samples);
+    void (*interleave_s16)(int16_t *dst, const int16_t **src, int channels, int nb_samples);
+    void (*fltp_to_s16)(int16_t *dst, const float **src, int channels, int nb_samples);
+    void (*mix_fltp)(float **dst, int out_channels, const float **src, int in_channels, const float *matrix, int nb_samples);
+    void (*flt_to_s16)(int16_t *dst, const float *src, int n);
+    void (*s16_to_flt)(float *dst, const int16_t *src, int n);
+    void (*gain_flt)(float *data, float gain, int n);
+    void (*gain_s16)(int16_t *data, float gain, int n);
+}SampleKernels;
+
+static const char *kernel_names[] = {
+    "scalar",
+    "sse2",
+    "avx2",
+};
+
+/*
+ * The clamp is written like minps/maxps, the second operand wins for NaN,
+ * lrintf rounds like cvtps2dq in the default rounding mode.
+ */
+static inline int16_t clamp_s16(float x){
+    x = x < 32767.0f ? x : 32767.0f;
+    x = x > -32768.0f ? x : -32768.0f;
+    return (int16_t)lrintf(x);
+}
+
+/************************************ scalar ************************************/
+
+static void interleave_flt_c(float *dst, const float **src, int channels, int nb_samples){
+    int i, ch;
+
+    for(i=0; i<nb_samples; i++)
+        for(ch=0; ch<channels; ch++)
+            dst[i*channels+ch] = src[ch][i];
+}
+
+static void interleave_s16_c(int16_t *dst, const int16_t **src, int channels, int nb_samples){
+    int i, ch;
+
+    for(i=0; i<nb_samples; i++)
+        for(ch=0; ch<channels; ch++)
+            dst[i*channels+ch] = src[ch][i];
+}
+
+/* samples from start on, the SIMD versions finish their tails with it */
+static void fltp_to_s16_tail(int16_t *dst, const float **src, int channels, int start, int nb_samples){
+    int i, ch;
+
+    for(i=start; i<nb_samples; i++)
+        for(ch=0; ch<channels; ch++)
+            dst[i*channels+ch] = clamp_s16(src[ch][i]*32768.0f);
+}
+
+static void fltp_to_s16_c(int16_t *dst, const float **src, int channels, int nb_samples){
+    fltp_to_s16_tail(dst, src, channels, 0, nb_samples);
+}
+
+/* samples from start on of one output channel */
+static void mix_row_tail(float *dst, const float **src, int in_channels, const float *row, int start, int nb_samples){
+    float acc;
+    int i, k;
+
+    for(k=start; k<nb_samples; k++){
+        acc = 0.0f;
+        for(i=0; i<in_channels; i++)
+            if(row[i] != 0.0f)
+                acc += row[i]*src[i][k];
+        dst[k] = acc;
+    }
+}
+
+static void mix_fltp_c(float **dst, int out_channels, const float **src, int in_channels, const float *matrix, int nb_samples){
+    int o;
+
+    for(o=0; o<out_channels; o++)
+        mix_row_tail(dst[o], src, in_channels, matrix + o*in_channels, 0, nb_samples);
+}
+
+static void flt_to_s16_c(int16_t *dst, const float *src, int n){
+    int i;
+
+    for(i=0; i<n; i++)
+        dst[i] = clamp_s16(src[i]*32768.0f);
+}
+
+static void s16_to_flt_c(float *dst, const int16_t *src, int n){
+    int i;
+
+    for(i=0; i<n; i++)
+        dst[i] = src[i]*(1.0f/32768.0f);
+}
+
+static void gain_flt_c(float *data, float gain, int n){
+    int i;
+
+    for(i=0; i<n; i++)
+        data[i] *= gain;
+}
+
+static void gain_s16_c(int16_t *data, float gain, int n){
+    int i;
+
+    for(i=0; i<n; i++)
+        data[i] = clamp_s16(data[i]*gain);
+}
+
+static const SampleKernels kernels_c = {
+    interleave_flt_c,
+    interleave_s16_c,
+    fltp_to_s16_c,
+    mix_fltp_c,
+    flt_to_s16_c,
+    s16_to_flt_c,
+    gain_flt_c,
+    gain_s16_c,
+};
+
+#ifdef HAVE_X86_KERNELS
+/************************************ SSE2 ************************************/
+
+/* 4 floats scaled, clamped and converted to int32 */
+TARGET_SSE2 static inline __m128i cvt_s32_sse2(__m128 x, __m128 scale){
+    x = _mm_mul_ps(x, scale);
+    x = _mm_min_ps(x, _mm_set1_ps(32767.0f));
+    x = _mm_max_ps(x, _mm_set1_ps(-32768.0f));
+    return _mm_cvtps_epi32(x);
+}
+
+/* 8 int16 sign extended to two vectors of floats */
+TARGET_SSE2 static inline void cvt_flt_sse2(__m128i v, __m128 *lo, __m128 *hi){
+    *lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+    *hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+}
+
+TARGET_SSE2 static void interleave_flt_sse2(float *dst, const float **src, int channels, int nb_samples){
+    const float *l = src[0], *r;
+    __m128 a, b;
+    int i = 0, ch;
+
+    if(channels != 2){
+        interleave_flt_c(dst, src, channels, nb_samples);
+        return;
+    }
+    r = src[1];
+    for(; i+4<=nb_samples; i+=4){
+        a = _mm_loadu_ps(l+i);
+        b = _mm_loadu_ps(r+i);
+        _mm_storeu_ps(dst+2*i,   _mm_unpacklo_ps(a, b));
+        _mm_storeu_ps(dst+2*i+4, _mm_unpackhi_ps(a, b));
+    }
+    for(; i<nb_samples; i++)
+        for(ch=0; ch<2; ch++)
+            dst[2*i+ch] = src[ch][i];
+}
+
+TARGET_SSE2 static void interleave_s16_sse2(int16_t *dst, const int16_t **src, int channels, int nb_samples){
+    const int16_t *l = src[0], *r;
+    __m128i a, b;
+    int i = 0, ch;
+
+    if(channels != 2){
+        interleave_s16_c(dst, src, channels, nb_samples);
+        return;
+    }
+    r = src[1];
+    for(; i+8<=nb_samples; i+=8){
+        a = _mm_loadu_si128((const __m128i *)(l+i));
+        b = _mm_loadu_si128((const __m128i *)(r+i));
+        _mm_storeu_si128((__m128i *)(dst+2*i),   _mm_unpacklo_epi16(a, b));
+        _mm_storeu_si128((__m128i *)(dst+2*i+8), _mm_unpackhi_epi16(a, b));
+    }
+    for(; i<nb_samples; i++)
+        for(ch=0; ch<2; ch++)
+            dst[2*i+ch] = src[ch][i];
+}
+
+TARGET_SSE2 static void fltp_to_s16_sse2(int16_t *dst, const float **src, int channels, int nb_samples){
+    const float *l = src[0], *r;
+    __m128 scale = _mm_set1_ps(32768.0f);
+    __m128i a, b;
+    int i = 0;
+
+    if(channels != 2){
+        fltp_to_s16_c(dst, src, channels, nb_samples);
+        return;
+    }
+    r = src[1];
+    for(; i+8<=nb_samples; i+=8){
+        a = _mm_packs_epi32(cvt_s32_sse2(_mm_loadu_ps(l+i), scale), cvt_s32_sse2(_mm_loadu_ps(l+i+4), scale));
+        b = _mm_packs_epi32(cvt_s32_sse2(_mm_loadu_ps(r+i), scale), cvt_s32_sse2(_mm_loadu_ps(r+i+4), scale));
+        _mm_storeu_si128((__m128i *)(dst+2*i),   _mm_unpacklo_epi16(a, b));
+        _mm_storeu_si128((__m128i *)(dst+2*i+8), _mm_unpackhi_epi16(a, b));
+    }
+    fltp_to_s16_tail(dst, src, 2, i, nb_samples);
+}
+
+TARGET_SSE2 static void mix_fltp_sse2(float **dst, int out_channels, const float **src, int in_channels, const float *matrix, int nb_samples){
+    const float *row;
+    __m128 acc;
+    int o, i, k;
+
+    for(o=0; o<out_channels; o++){
+        row = matrix + o*in_channels;
+        for(k=0; k+4<=nb_samples; k+=4){
+            acc = _mm_setzero_ps();
+            for(i=0; i<in_channels; i++)
+                if(row[i] != 0.0f)
+                    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(row[i]), _mm_loadu_ps(src[i]+k)));
+            _mm_storeu_ps(dst[o]+k, acc);
+        }
+        mix_row_tail(dst[o], src, in_channels, row, k, nb_samples);
+    }
+}
+
+TARGET_SSE2 static void flt_to_s16_sse2(int16_t *dst, const float *src, int n){
+    __m128 scale = _mm_set1_ps(32768.0f);
+    int i = 0;
+
+    for(; i+8<=n; i+=8)
+        _mm_storeu_si128((__m128i *)(dst+i), _mm_packs_epi32(cvt_s32_sse2(_mm_loadu_ps(src+i), scale),
+                    cvt_s32_sse2(_mm_loadu_ps(src+i+4), scale)));
+    flt_to_s16_c(dst+i, src+i, n-i);
+}
+
+TARGET_SSE2 static void s16_to_flt_sse2(float *dst, const int16_t *src, int n){
+    __m128 scale = _mm_set1_ps(1.0f/32768.0f);
+    __m128 lo, hi;
+    int i = 0;
+
+    for(; i+8<=n; i+=8){
+        cvt_flt_sse2(_mm_loadu_si128((const __m128i *)(src+i)), &lo, &hi);
+        _mm_storeu_ps(dst+i,   _mm_mul_ps(lo, scale));
+        _mm_storeu_ps(dst+i+4, _mm_mul_ps(hi, scale));
+    }
+    s16_to_flt_c(dst+i, src+i, n-i);
+}
+
+TARGET_SSE2 static void gain_flt_sse2(float *data, float gain, int n){
+    __m128 g = _mm_set1_ps(gain);
+    int i = 0;
+
+    for(; i+4<=n; i+=4)
+        _mm_storeu_ps(data+i, _mm_mul_ps(_mm_loadu_ps(data+i), g));
+    gain_flt_c(data+i, gain, n-i);
+}
+
+TARGET_SSE2 static void gain_s16_sse2(int16_t *data, float gain, int n){
+    __m128 g = _mm_set1_ps(gain);
+    __m128 lo, hi;
+    int i = 0;
+
+    for(; i+8<=n; i+=8){
+        cvt_flt_sse2(_mm_loadu_si128((const __m128i *)(data+i)), &lo, &hi);
+        _mm_storeu_si128((__m128i *)(data+i), _mm_packs_epi32(cvt_s32_sse2(lo, g), cvt_s32_sse2(hi, g)));
+    }
+    gain_s16_c(data+i, gain, n-i);
+}
+
+static const SampleKernels kernels_sse2 = {
+    interleave_flt_sse2,
+    interleave_s16_sse2,
+    fltp_to_s16_sse2,
+    mix_fltp_sse2,
+    flt_to_s16_sse2,
+    s16_to_flt_sse2,
+    gain_flt_sse2,
+    gain_s16_sse2,
+};
+
+/************************************ AVX2 ************************************/
+
+TARGET_AVX2 static inline __m256i cvt_s32_avx2(__m256 x, __m256 scale){
+    x = _mm256_mul_ps(x, scale);
+    x = _mm256_min_ps(x, _mm256_set1_ps(32767.0f));
+    x = _mm256_max_ps(x, _mm256_set1_ps(-32768.0f));
+    return _mm256_cvtps_epi32(x);
+}
+
+/* 16 floats to 16 int16 in order, packs works within 128-bit lanes */
+TARGET_AVX2 static inline __m256i pack_s16_avx2(__m256 x0, __m256 x1, __m256 scale){
+    __m256i v = _mm256_packs_epi32(cvt_s32_avx2(x0, scale), cvt_s32_avx2(x1, scale));
+    return _mm256_permute4x64_epi64(v, 0xD8);
+}
+
+TARGET_AVX2 static void interleave_flt_avx2(float *dst, const float **src, int channels, int nb_samples){
+    const float *l = src[0], *r;
+    __m256 a, b, lo, hi;
+    int i = 0, ch;
+
+    if(channels != 2){
+        interleave_flt_c(dst, src, channels, nb_samples);
+        return;
+    }
+    r = src[1];
+    for(; i+8<=nb_samples; i+=8){
+        a = _mm256_loadu_ps(l+i);
+        b = _mm256_loadu_ps(r+i);
+        lo = _mm256_unpacklo_ps(a, b);
+        hi = _mm256_unpackhi_ps(a, b);
+        _mm256_storeu_ps(dst+2*i,   _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(dst+2*i+8, _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+    for(; i<nb_samples; i++)
+        for(ch=0; ch<2; ch++)
+            dst[2*i+ch] = src[ch][i];
+}
+
+TARGET_AVX2 static void interleave_s16_avx2(int16_t *dst, const int16_t **src, int channels, int nb_samples){
+    const int16_t *l = src[0], *r;
+    __m256i a, b, lo, hi;
+    int i = 0, ch;
+
+    if(channels != 2){
+        interleave_s16_c(dst, src, channels, nb_samples);
+        return;
+    }
+    r = src[1];
+    for(; i+16<=nb_samples; i+=16){
+        a = _mm256_loadu_si256((const __m256i *)(l+i));
+        b = _mm256_loadu_si256((const __m256i *)(r+i));
+        lo = _mm256_unpacklo_epi16(a, b);
+        hi = _mm256_unpackhi_epi16(a, b);
+        _mm256_storeu_si256((__m256i *)(dst+2*i),    _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(dst+2*i+16), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    for(; i<nb_samples; i++)
+        for(ch=0; ch<2; ch++)
+            dst[2*i+ch] = src[ch][i];
+}
+
+TARGET_AVX2 static void fltp_to_s16_avx2(int16_t *dst, const float **src, int channels, int nb_samples){
+    const float *l = src[0], *r;
+    __m256 scale = _mm256_set1_ps(32768.0f);
+    __m256i a, b, lo, hi;
+    int i = 0;
+
+    if(channels != 2){
+        fltp_to_s16_c(dst, src, channels, nb_samples);
+        return;
+    }
+    r = src[1];
+    for(; i+16<=nb_samples; i+=16){
+        a = pack_s16_avx2(_mm256_loadu_ps(l+i), _mm256_loadu_ps(l+i+8), scale);
+        b = pack_s16_avx2(_mm256_loadu_ps(r+i), _mm256_loadu_ps(r+i+8), scale);
+        lo = _mm256_unpacklo_epi16(a, b);
+        hi = _mm256_unpackhi_epi16(a, b);
+        _mm256_storeu_si256((__m256i *)(dst+2*i),    _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(dst+2*i+16), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    fltp_to_s16_tail(dst, src, 2, i, nb_samples);
+}
+
+TARGET_AVX2 static void mix_fltp_avx2(float **dst, int out_channels, const float **src, int in_channels, const float *matrix, int nb_samples){
+    const float *row;
+    __m256 acc;
+    int o, i, k;
+
+    for(o=0; o<out_channels; o++){
+        row = matrix + o*in_channels;
+        for(k=0; k+8<=nb_samples; k+=8){
+            acc = _mm256_setzero_ps();
+            for(i=0; i<in_channels; i++)
+                if(row[i] != 0.0f)
+                    acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(row[i]), _mm256_loadu_ps(src[i]+k)));
+            _mm256_storeu_ps(dst[o]+k, acc);
+        }
+        mix_row_tail(dst[o], src, in_channels, row, k, nb_samples);
+    }
+}
+
+TARGET_AVX2 static void flt_to_s16_avx2(int16_t *dst, const float *src, int n){
+    __m256 scale = _mm256_set1_ps(32768.0f);
+    int i = 0;
+
+    for(; i+16<=n; i+=16)
+        _mm256_storeu_si256((__m256i *)(dst+i), pack_s16_avx2(_mm256_loadu_ps(src+i), _mm256_loadu_ps(src+i+8), scale));
+    flt_to_s16_c(dst+i, src+i, n-i);
+}
+
+TARGET_AVX2 static void s16_to_flt_avx2(float *dst, const int16_t *src, int n){
+    __m256 scale = _mm256_set1_ps(1.0f/32768.0f);
+    __m256i v;
+    int i = 0;
+
+    for(; i+8<=n; i+=8){
+        v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src+i)));
+        _mm256_storeu_ps(dst+i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    s16_to_flt_c(dst+i, src+i, n-i);
+}
+
+TARGET_AVX2 static void gain_flt_avx2(float *data, float gain, int n){
+    __m256 g = _mm256_set1_ps(gain);
+    int i = 0;
+
+    for(; i+8<=n; i+=8)
+        _mm256_storeu_ps(data+i, _mm256_mul_ps(_mm256_loadu_ps(data+i), g));
+    gain_flt_c(data+i, gain, n-i);
+}
+
+TARGET_AVX2 static void gain_s16_avx2(int16_t *data, float gain, int n){
+    __m256 g = _mm256_set1_ps(gain);
+    __m256 x0, x1;
+    int i = 0;
+
+    for(; i+16<=n; i+=16){
+        x0 = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(data+i))));
+        x1 = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(data+i+8))));
+        _mm256_storeu_si256((__m256i *)(data+i), pack_s16_avx2(x0, x1, g));
+    }
+    gain_s16_c(data+i, gain, n-i);
+}
+
+static const SampleKernels kernels_avx2 = {
+    interleave_flt_avx2,
+    interleave_s16_avx2,
+    fltp_to_s16_avx2,
+    mix_fltp_avx2,
+    flt_to_s16_avx2,
+    s16_to_flt_avx2,
+    gain_flt_avx2,
+    gain_s16_avx2,
+};
+#endif
+
+static const SampleKernels *kernels;
+static int kernel_level;
+static int cpu_level = -1;
+
+static int detect_level(void){
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return SAMPLE_KERNEL_AVX2;
+    if(__builtin_cpu_supports("sse2"))
+        return SAMPLE_KERNEL_SSE2;
+#endif
+    return SAMPLE_KERNEL_SCALAR;
+}
+
+int sample_kernel_force(int level){
+    if(cpu_level < 0)
+        cpu_level = detect_level();
+    if(level > cpu_level)
+        level = cpu_level;
+    if(level < SAMPLE_KERNEL_SCALAR)
+        level = SAMPLE_KERNEL_SCALAR;
+
+    switch(level){
+#ifdef HAVE_X86_KERNELS
+    case SAMPLE_KERNEL_AVX2 :
+        kernels = &kernels_avx2;
+        break;
+    case SAMPLE_KERNEL_SSE2 :
+        kernels = &kernels_sse2;
+        break;
+#endif
+    default :
+        kernels = &kernels_c;
+        break;
+    }
+    kernel_level = level;
+    return level;
+}
+
+/* the first call picks the kernels, threads racing here pick the same ones */
+static const SampleKernels *get_kernels(void){
+    if(!kernels)
+        sample_kernel_force(SAMPLE_KERNEL_AVX2);
+    return kernels;
+}
+
+int sample_kernel_level(void){
+    get_kernels();
+    return kernel_level;
+}
+
+const char *sample_kernel_name(int level){
+    if(level < SAMPLE_KERNEL_SCALAR || level > SAMPLE_KERNEL_AVX2)
+        return "unknown";
+    return kernel_names[level];
+}
+
+void sample_interleave_flt(float *dst, const float **src, int channels, int nb_samples){
+    get_kernels()->interleave_flt(dst, src, channels, nb_samples);
+}
+
+void sample_interleave_s16(int16_t *dst, const int16_t **src, int channels, int nb_samples){
+    get_kernels()->interleave_s16(dst, src, channels, nb_samples);
+}
+
+void sample_fltp_to_s16(int16_t *dst, const float **src, int channels, int nb_samples){
+    get_kernels()->fltp_to_s16(dst, src, channels, nb_samples);
+}
+
+void sample_mix_fltp(float **dst, int out_channels, const float **src, int in_channels,
+        const float *matrix, int nb_samples){
+    get_kernels()->mix_fltp(dst, out_channels, src, in_channels, matrix, nb_samples);
+}
+
+void sample_flt_to_s16(int16_t *dst, const float *src, int n){
+    get_kernels()->flt_to_s16(dst, src, n);
+}
+
+void sample_s16_to_flt(float *dst, const int16_t *src, int n){
+    get_kernels()->s16_to_flt(dst, src, n);
+}
+
+void sample_gain_flt(float *data, float gain, int n){
+    get_kernels()->gain_flt(data, gain, n);
+}
+
+void sample_gain_s16(int16_t *data, float gain, int n){
+    get_kernels()->gain_s16(data, gain, n);
+}
@@ -0,0 +1,40 @@
+#ifndef __INCLUDED_SAMPLECONVERT_H__
+#define __INCLUDED_SAMPLECONVERT_H__
+#include <stdint.h>
+
+/*
+ * Sample format kernels for the conversions done outside libswresample,
+ * the PCM dumps and the tools playing S16 directly.
+ * Every kernel has a scalar, SSE2 and AVX2 version, the best one the CPU runs
+ * is picked on first use. All versions give the same result to the bit:
+ *   float -> S16: x*32768 clamped to [-32768, 32767], rounded to nearest even
+ *   S16 -> float: x/32768
+ * Buffers need no alignment.
+ */
+#define SAMPLE_KERNEL_SCALAR 0
+#define SAMPLE_KERNEL_SSE2   1
+#define SAMPLE_KERNEL_AVX2   2
+
+int sample_kernel_level(void);
+/* pick a lower level for benchmarks and tests, clamped to what the CPU runs, return the level set */
+int sample_kernel_force(int level);
+const char *sample_kernel_name(int level);
+
+/* planar -> interleaved, src[channels][nb_samples] */
+void sample_interleave_flt(float *dst, const float **src, int channels, int nb_samples);
+void sample_interleave_s16(int16_t *dst, const int16_t **src, int channels, int nb_samples);
+/* FLTP -> interleaved S16 with saturation, the usual decoder output to the usual device input */
+void sample_fltp_to_s16(int16_t *dst, const float **src, int channels, int nb_samples);
+/*
+ * planar mixing, dst[o] = sum of matrix[o*in_channels+i]*src[i] over the inputs in order,
+ * zero coefficients are skipped
+ */
+void sample_mix_fltp(float **dst, int out_channels, const float **src, int in_channels,
+        const float *matrix, int nb_samples);
+
+/* n values, any layout */
+void sample_flt_to_s16(int16_t *dst, const float *src, int n);
+void sample_s16_to_flt(float *dst, const int16_t *src, int n);
+void sample_gain_flt(float *data, float gain, int n);
+void sample_gain_s16(int16_t *data, float gain, int n);
+#endif
@@ -12,10 +12,48 @@
 
 #include "Queue.h"
 #include "Clock.h"
+#include "DecoderThreads.h"
+#include "FramePool.h"
+#include "Degrade.h"
+#include "FileIO.h"
+#include "StreamCache.h"
+#include "KeyIndex.h"
+#include "Buffering.h"
+#include "AudioBuffer.h"
+#include "Downmix.h"
+#include "AudioPush.h"
 
-#define DEF_SAMPLES 2048
 #define DATATEST 30
 
+#define SEEK_STEP_SHORT   10000000  //usecond, left/right key
+#define SEEK_STEP_LONG    60000000  //usecond, down/up key
+#define SEEK_ACCURATE     1         //land on the exact frame instead of the nearest keyframe
+
+#define TRICK_MIN_SPEED   8
+#define TRICK_MAX_SPEED   32
+#define TRICK_INTERVAL    100000    //usecond, wall time between two stills at least
+#define TRICK_MAX_STILL   1000000   //usecond, wall time one still is displayed at most
+#define TRICK_QUEUE       2         //keyframes read ahead in trick play
+
+#define LOOP_DECLICK      64        //samples, crossfade from the last sample at the loop point
+#define AUDIO_CONCEAL_FADE 256      //samples, fade into and out of the silence of an underrun
+
+#define PLAYLIST_PREFILL  32        //packets per stream read ahead for the next playlist item
+
+#define ATRACK_LEAD       100000    //usecond, the new audio track starts this far ahead of the clock
+
+#define LIVE_TARGET       150000    //usecond, latency from packet arrival to presentation
+#define LIVE_QUEUE_MS     200       //media duration the packet queues hold in live mode
+#define LIVE_AUDIO_MS     60        //audio buffer target, device buffer plus decoded audio queued
+#define LIVE_FRAMES       3         //decoded video frames queued
+#define LIVE_SPEEDUP      20        //one of LIVE_SPEEDUP sample frames is dropped to catch up, 5% faster
+#define LIVE_DROP_MARGIN  100000    //usecond over the target, video frames are dropped beyond it
+#define LIVE_PROBESIZE    65536
+#define LIVE_ANALYZEDURATION 100000
+#define LIVE_LOW_WATERMARK   20000
+#define LIVE_HIGH_WATERMARK  60000
+#define LIVE_LOG_INTERVAL 5000000
+
 typedef struct SDL_Output{
     SDL_Window *window;
     SDL_Renderer *renderer;
@@ -23,14 +61,39 @@ typedef struct SDL_Output{
     SDL_Texture *texture;
     SDL_Rect rect;
     SDL_AudioDeviceID audio_dev;
-    unsigned char *YPlane;
-    unsigned char *UPlane;
-    unsigned char *VPlane;
+    int audio_samples;      //samples per callback of the device opened
+    int audio_freq;         //native format of the device, the filter graph converts to it
+    int audio_channels;
+    uint64_t audio_channel_layout;  //speakers in the channel order of SDL
+    int audio_sample_fmt;   //packed AVSampleFormat
+    int audio_silence;
     int window_width;
     int window_height;
-    int buf_size;
 }SDL_Output;
 
+/*
+ * Latency of one stream in live mode: the packet read last arrived at last_arrival,
+ * the data presented at now with pts has waited now - last_arrival + last_pts - pts
+ */
+typedef struct LiveStats{
+    int64_t last_pts;           //AV_TIME_BASE
+    int64_t last_arrival;
+    int64_t latency;            //last measured
+    int64_t sum;                //over the log interval
+    int64_t max;
+    int64_t count;
+    int64_t dropped;            //video frames or audio sample frames dropped to catch up
+}LiveStats;
+
+/* cost of the filter graph per frame, only the time in the buffer source and the sink is counted */
+typedef struct FilterStats{
+    const char *name;
+    int64_t frames;             //through the graph
+    int64_t unchecked;          //of them handed over without the format check
+    int64_t bypassed;           //queued straight from the decoder
+    int64_t time;
+}FilterStats;
+
 typedef struct VideoState{
     /* video display parameter */
     int64_t frame_cur_pts;
@@ -45,6 +108,7 @@ typedef struct VideoState{
     int64_t audio_bytes_consumed;
     SyncClock sc;
     AVFrame *cur_frame;
+    int frame_serial;   //seek serial of cur_frame
 
     /* audio/video stream info  */
     int has_video;
@@ -52,6 +116,69 @@ typedef struct VideoState{
     AVFormatContext *FCtx;
     int AStream;
     int VStream;
+    SDL_AudioDeviceID audio_dev;
+
+    /* packets of the streams not selected that still reach ReadThread */
+    int64_t discarded_packets;
+    int64_t discarded_bytes;
+
+    /* seek, requested by main thread and done by ReadThread */
+    int seek_req;
+    int seek_flags;
+    int64_t seek_target;        //AV_TIME_BASE
+    int64_t seek_request_time;  //for measuring seek latency
+    int seek_serial;            //increased by every seek, frames of older serial are dropped
+    int abort_request;
+
+    /* trick play, only keyframes are read, decoded and displayed */
+    int trick_req;
+    int trick_req_speed;
+    int trick_speed;            //0 for normal play, negative for rewind
+    int64_t trick_pos;          //AV_TIME_BASE, pts of the last keyframe read
+
+    /* gapless loop, the timeline goes on over the loops */
+    int loop_count;
+    int64_t loop_duration;      //AV_TIME_BASE, from start_time to the end of the longest stream
+    int64_t loop_offset;        //AV_TIME_BASE, added to the pts of the current loop
+
+    /* playlist */
+    int64_t item_offset;        //AV_TIME_BASE, timeline position of the start of the current item
+    int frame_item;             //playlist item of cur_frame
+    int item_switched;          //cur_frame is the first frame of a new item
+    int64_t item_pts_delay;     //pts distance from the last frame of the previous item
+
+    /* audio track switch, the decoder is opened by AudioTrackThread, the switch is done by ReadThread */
+    int atrack_req;
+    int atrack_stream;          //stream being opened
+    int64_t atrack_request_time;
+    SDL_Thread *atrack_tid;
+    SDL_atomic_t atrack_ready;  //1: opened, -1: failed
+    SDL_atomic_t atrack_pending;    //atrack_pkt is in APQ, AudioThread has not taken it yet
+    int64_t audio_offset;       //loop_offset of the packets AudioThread is decoding
+    int audio_serial;           //seek serial the audio clock has been reset for
+
+    /* buffering, the clock is held from hold_time on */
+    int64_t hold_time;
+
+    /* live mode */
+    LiveStats live_audio;
+    LiveStats live_video;
+    int64_t live_log_time;
+    uint8_t *live_buf;          //audio pulled from AFQ before decimation
+    int live_buf_size;
+
+    /* audio frame the callback is playing, taken from AFQ */
+    AVFrame *audio_frame;
+    int audio_frame_pos;        //bytes played
+    int audio_frame_size;       //bytes
+    int audio_frame_bytes;      //bytes of one sample frame played
+    int audio_silence;          //byte value of silence in the device format
+    int audio_frame_samples;    //samples per frame of the filter graph, the samples per callback
+    int audio_channels;         //of the device
+    int audio_sample_fmt;
+    int audio_gap;              //the last callback ended in silence
+    uint8_t *audio_last_frame;  //last sample frame played
+    uint8_t *audio_silence_frame;
 }VideoState;
 
 typedef struct Codec{
@@ -62,53 +189,462 @@ typedef struct Codec{
     AVFilterContext *in_filter;
     AVFilterContext *out_filter;
     int stream;
+    VideoState *vs;
+
+    /* output of the filter graph, the items of a playlist share the devices of the first one */
+    int out_sample_rate;
+    int out_channels;
+    uint64_t out_channel_layout;
+    int mix;                    //the graph keeps the layout of the decoder, the audio thread mixes it down
+    int out_frame_size;         //samples, one audio callback
+    int out_sample_fmt;
+    int out_width;
+    int out_height;
+    int out_pix_fmt;
+    const char *filters;        //graph string between the source and the sink, NULL for none
 }Codec;
 
+#define MAX_FILTER_GRAPHS 8
+
+/*
+ * The graph strings of -vf/-af, switched during playback. The graph wanted is built by
+ * FilterBuildThread from the parameters of the decoder while the one in use goes on,
+ * then the decoder thread drains the old graph into the frame queue and swaps them between
+ * two packets, nothing queued is dropped.
+ */
+typedef struct FilterSwitch{
+    const char *kind;
+    const char *graphs[MAX_FILTER_GRAPHS+1];    //graphs[nb] is NULL, no graph string
+    int nb;
+    int cur;                    //graph wanted, set by the main thread
+    int failed;                 //graph that could not be built, not tried again until asked for
+    int64_t request_time;
+
+    /* owned by the decoder thread */
+    SDL_Thread *tid;
+    SDL_atomic_t ready;
+    Codec build;                //graph being built
+    const char *building;
+    int build_err;              //result of the build, the failure is recorded here by FilterBuildThread
+    int64_t build_time;
+}FilterSwitch;
+
+/*
+ * The next playlist item is opened, probed and prefilled by PrefetchThread
+ * while the current one plays, decoders take its contexts at the boundary.
+ * A NULL CCtx in ACodec/VCodec means the parameters match the current item
+ * and the decoder context in use is kept.
+ */
+typedef struct PlayItem{
+    char *filename;
+    AVFormatContext *FCtx;
+    FileIO *fio;                //NULL with the file protocol
+    Codec ACodec;
+    Codec VCodec;
+    PacketQueue APQ;            //prefilled packets, moved to the main queues at the boundary
+    PacketQueue VPQ;
+    int prefilled;              //APQ/VPQ initialized
+    int ready;                  //1: opened and prefilled, -1: failed
+    struct PlayItem *prev;      //the item playing while this one was prefetched
+    VideoState *vs;
+    SDL_Thread *tid;
+}PlayItem;
+
+typedef struct Playlist{
+    PlayItem *items;
+    int nb_items;
+    int cur;                    //item read by ReadThread
+    int audio_item;             //item decoded by AudioThread
+    int video_item;             //item decoded by VideoThread
+}Playlist;
+
 FrameQueue AFQ, VFQ;
-RingBuffer ring_buffer;
 PacketQueue APQ, VPQ;
 SDL_Thread *read_tid;
 SDL_Thread *audio_tid;
+SDL_Thread *audio_push_tid;
 SDL_Thread *video_tid;
 
 int read_finished;
 
+ThreadConfig thread_config;
+FramePool frame_pool;
+DegradeControl degrade;
+BufferControl buffering;
+AudioBufferControl audio_buffer;
+AudioPush audio_push;
+FilterSwitch video_filters = { .kind = "video", .failed = -1 };
+FilterSwitch audio_filters = { .kind = "audio", .failed = -1 };
+int degrade_enabled = 1;
+int filter_bypass = 1;          //frames the plain video graph would not touch skip it
+int loop_enabled = 0;
+int io_mode = FILE_IO_DEFAULT;
+int io_window = FILE_IO_WINDOW;
+int fast_start = 0;
+int live_mode = 0;
+int64_t live_target = LIVE_TARGET;
+int audio_buffer_ms = 0;        //0 for AUDIO_BUFFER_MS, LIVE_AUDIO_MS in live mode
+int audio_adaptive = 0;
+int audio_conceal = 0;
+int audio_push_mode = 0;        //queue the audio with SDL_QueueAudio instead of the callback pulling it
+
+/* stream selection, -1 for the best stream of the type, -2 for disabled */
+int wanted_stream[AVMEDIA_TYPE_NB] = {
+    [AVMEDIA_TYPE_VIDEO] = -1,
+    [AVMEDIA_TYPE_AUDIO] = -1,
+};
+
+/* time to first frame, from the start of main to the first video frame or audio sample played */
+int64_t open_time;
+int stream_info_cached;
+SDL_atomic_t first_frame_reported;
+
+/*
+ * flush_pkt is put into the packet queues after a seek,
+ * decoder threads flush the codec and their output queue when getting it.
+ *   flush_pkt.pts = accurate seek target in AV_TIME_BASE, AV_NOPTS_VALUE for fast seek
+ *   flush_pkt.pos = seek serial
+ */
+AVPacket flush_pkt;
+
+/*
+ * loop_pkt is put into the packet queues when ReadThread loops back to the start,
+ * decoders drain the last loop through the normal path and flush themselves after it,
+ * queued packets and frames are kept so there is no gap.
+ *   loop_pkt.pts = offset of the new loop in AV_TIME_BASE
+ */
+AVPacket loop_pkt;
+
+/*
+ * item_pkt is put into the packet queues at the boundary of two playlist items,
+ * decoders drain the last item and switch to the decoder context of the next one.
+ *   item_pkt.pts = offset of the new item in AV_TIME_BASE
+ *   item_pkt.pos = index of the new item
+ */
+AVPacket item_pkt;
+Playlist playlist;
+
+/*
+ * atrack_pkt is put into the flushed APQ when switching the audio track,
+ * AudioThread takes the decoder in atrack_codec, flushes AFQ and
+ * starts the new track at the target with the audio clock reset.
+ *   atrack_pkt.pts = target in AV_TIME_BASE, media time of the current item
+ *   atrack_pkt.pos = timeline offset of the current loop/item
+ */
+AVPacket atrack_pkt;
+Codec atrack_codec;
+
 double audio_frame_pts;
 //int ii = 0;
 //int jj = 0;
 
-void SimpleCallback(void* userdata, Uint8 *stream, int queryLen){
-    void *buf;
-    int read_size = 0, len;
-    VideoState *vs = (VideoState *)userdata;
-    
-    len = queryLen;
-    buf = (void *)stream;
-    
-    while(len > 0){
-        read_size = RB_PullData(&ring_buffer, buf, len);
-        
-        //fprintf(stdout, "frame.format = %d, chennels = %d, samplerate = %d, nb_samples=%d\n", fn.frame->format, fn.frame->channels, fn.frame->sample_rate, fn.frame->nb_samples);
-        if(!read_size){
-            //fprintf(stdout, "no data to play\n");
-            memset(buf, 0, len);
-            break;
-        }else if(read_size<0){
-            memset(stream, 0, queryLen);
-            break;
+void ReportFirstFrame(const char *what){
+    if(!SDL_AtomicCAS(&first_frame_reported, 0, 1))
+        return;
+    fprintf(stdout, "time to first %s %lld ms, stream info %s\n", what, (long long)((av_gettime_relative()-open_time)/1000),
+            stream_info_cached ? "from cache" : "probed");
+}
+
+/* a packet of a live stream is read */
+void LiveArrival(LiveStats *ls, AVStream *st, AVPacket *pkt){
+    int64_t pts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+
+    if(pts == AV_NOPTS_VALUE)
+        return;
+    ls->last_pts = av_rescale_q(pts, st->time_base, AV_TIME_BASE_Q);
+    ls->last_arrival = av_gettime_relative();
+}
+
+int64_t LiveLatency(LiveStats *ls, int64_t now, int64_t pts){
+    return now - ls->last_arrival + ls->last_pts - pts;
+}
+
+/* the data with pts is presented at now, return its latency */
+int64_t LivePresent(LiveStats *ls, int64_t now, int64_t pts){
+    if(!ls->last_arrival || pts == AV_NOPTS_VALUE)
+        return ls->latency;
+    ls->latency = LiveLatency(ls, now, pts);
+    ls->sum += ls->latency;
+    ls->max = FFMAX(ls->max, ls->latency);
+    ls->count++;
+    return ls->latency;
+}
+
+/*
+ * Copy up to size bytes of the frames in AFQ without waiting. The frames have
+ * the size of one callback, so a callback takes exactly one frame with one copy,
+ * only a frame cut at a seek target is spread over two callbacks.
+ * Return the bytes copied, -1 after abort.
+ */
+int AudioPull(VideoState *vs, uint8_t *buf, int size){
+    FrameNode fn;
+    int copied = 0, n, ret;
+
+    fn.frame = vs->audio_frame;
+    while(copied < size){
+        if(vs->audio_frame_pos >= vs->audio_frame_size){
+            av_frame_unref(vs->audio_frame);
+            vs->audio_frame_pos = vs->audio_frame_size = 0;
+            ret = dequeue_frame_nowait(&AFQ, &fn);
+            if(ret <= 0)
+                return copied ? copied : ret;
+            vs->audio_frame_size = vs->audio_frame->nb_samples*vs->audio_frame_bytes;
+            //the first frame of a new loop or item carries its pts on the timeline, the clock is rebased to it
+            if(vs->audio_frame->pts != AV_NOPTS_VALUE)
+                vs->audio_bytes_consumed = vs->audio_frame->pts/vs->usecond_per_byte - copied;
         }
-        len = len - read_size;
-        buf = buf + read_size;
+        n = FFMIN(size - copied, vs->audio_frame_size - vs->audio_frame_pos);
+        memcpy(buf + copied, vs->audio_frame->data[0] + vs->audio_frame_pos, n);
+        vs->audio_frame_pos += n;
+        copied += n;
+    }
+    return copied;
+}
+
+/*
+ * Play faster than real time by dropping one of LIVE_SPEEDUP sample frames,
+ * the clock goes on with the bytes pulled from AFQ, returned in consumed.
+ * Return the bytes of audio written to stream, the rest is silence.
+ */
+int PullDecimated(VideoState *vs, Uint8 *stream, int queryLen, int *consumed){
+    int frame_bytes = vs->audio_frame_bytes;
+    int nb = queryLen/frame_bytes;
+    int read_size, in, out = 0, i;
+
+    read_size = AudioPull(vs, vs->live_buf, (nb + nb/(LIVE_SPEEDUP-1))*frame_bytes);
+    *consumed = FFMAX(read_size, 0);
+    if(read_size <= 0){
+        memset(stream, vs->audio_silence, queryLen);
+        return 0;
+    }
+
+    in = read_size/frame_bytes;
+    for(i=0; i<in && out<nb; i++){
+        if(i%LIVE_SPEEDUP == LIVE_SPEEDUP-1)
+            continue;
+        memcpy(stream + out*frame_bytes, vs->live_buf + i*frame_bytes, frame_bytes);
+        out++;
+    }
+    vs->live_audio.dropped += in - out;
+    memset(stream + out*frame_bytes, vs->audio_silence, queryLen - out*frame_bytes);
+    return out*frame_bytes;
+}
+
+/*
+ * AFQ running dry is an underrun unless nothing more is coming or the queues are
+ * drained on purpose, by a seek not done yet, trick play or an audio track switch.
+ */
+int AudioUnderrun(VideoState *vs){
+    return !read_finished && !vs->seek_req && vs->audio_serial == vs->seek_serial
+        && !vs->trick_speed && !vs->atrack_request_time;
+}
+
+void Declick(uint8_t *data, int nb_samples, int channels, int format, const uint8_t *last, int length);
+
+/*
+ * The device plays filled bytes of data and silence up to len.
+ * The silence of an underrun is accounted, and with -conceal faded into from the last
+ * sample played and out of into the audio coming back instead of cutting hard.
+ */
+void AudioGap(VideoState *vs, Uint8 *stream, int filled, int len){
+    int frame_bytes = vs->audio_frame_bytes;
+
+    if(filled < len && AudioUnderrun(vs))
+        audio_buffer_underrun(&audio_buffer, (int64_t)((len - filled)*vs->usecond_per_byte));
+    else
+        audio_buffer_played(&audio_buffer);
+
+    if(audio_conceal && vs->audio_last_frame){
+        if(vs->audio_gap && filled > 0)
+            Declick(stream, filled/frame_bytes, vs->audio_channels, vs->audio_sample_fmt,
+                    vs->audio_silence_frame, AUDIO_CONCEAL_FADE);
+        if(filled > 0)
+            memcpy(vs->audio_last_frame, stream + filled - frame_bytes, frame_bytes);
+        if(!vs->audio_gap && filled < len)
+            Declick(stream + filled, (len - filled)/frame_bytes, vs->audio_channels, vs->audio_sample_fmt,
+                    vs->audio_last_frame, AUDIO_CONCEAL_FADE);
     }
+    vs->audio_gap = filled < len;
+}
+
+/*
+ * Fill len bytes of one device buffer from AFQ, return the bytes of audio at its head, the rest is silence.
+ * audio_bytes_consumed goes on with the bytes taken from AFQ, called with the device locked.
+ */
+int AudioFill(VideoState *vs, Uint8 *stream, int len){
+    int consumed, filled;
+
+    //live mode catches up while the audio latency is over the target
+    if(vs->live_buf && vs->live_audio.latency > live_target && len*2 <= vs->live_buf_size){
+        filled = PullDecimated(vs, stream, len, &consumed);
+    }else{
+        //what AFQ cannot fill is silence
+        consumed = filled = FFMAX(AudioPull(vs, stream, len), 0);
+        memset(stream + consumed, vs->audio_silence, len - consumed);
+    }
+    AudioGap(vs, stream, filled, len);
+
+    if(consumed > 0 && !vs->has_video)
+        ReportFirstFrame("audio sample");
+    vs->audio_bytes_consumed += consumed;
+    return filled;
+}
 
-    vs->audio_bytes_consumed += (queryLen-len);
-    set_audio_pts(&vs->sc, vs->audio_bytes_consumed * (vs->usecond_per_byte));
+void SimpleCallback(void* userdata, Uint8 *stream, int queryLen){
+    VideoState *vs = (VideoState *)userdata;
+    int filled = AudioFill(vs, stream, queryLen);
+    int underrun = filled < queryLen && AudioUnderrun(vs);
+
+    /*
+     * the audio clock is held while the device plays the silence of an underrun, the media does not go on.
+     * Other silence, after the end of the audio, before a seek or a track switch is played, lets it run on
+     * from the audio played last, so video goes on at its pace
+     */
+    hold_audio_clock(&vs->sc, underrun);
+    if(filled > 0 || underrun)
+        set_audio_pts(&vs->sc, vs->audio_bytes_consumed * (vs->usecond_per_byte));
+    if(live_mode && filled > 0)
+        LivePresent(&vs->live_audio, av_gettime_relative(), get_audio_pts(&vs->sc));
     //if(get_audio_pts(&vs->sc)>32000000)
     //    fprintf(stdout, "[%d]video pts %lld, audio pts %lld\n", ii, get_video_pts(&vs->sc), get_audio_pts(&vs->sc));
     //ii++;
 }
 
-int AudioFilterInit(Codec *c){
+/* AFQ has audio for the device */
+int AudioAvailable(VideoState *vs){
+    return vs->audio_frame_pos < vs->audio_frame_size || frame_nb(&AFQ) > 0;
+}
+
+/*
+ * Push mode, the device buffers are filled here the way the callback fills them and queued ahead of
+ * the device, the callback of SDL only copies the queue. The device is locked while filling like for the
+ * callback, so flushes, seeks and the clock reset are kept out the same way. Silence is queued only
+ * when the device is about to run dry while playing, where the callback would have played it.
+ * The clock is taken from the queue as it drains, one wakeup period late at most.
+ */
+int AudioPushThread(void *arg){
+    VideoState *vs = arg;
+    AudioPush *ap = &audio_push;
+    uint8_t *buf;
+    int64_t pts;
+    int filled, held = 0;
+
+    fprintf(stdout, "AudioPushThread start\n");
+    buf = av_malloc(ap->chunk);
+    if(!buf){
+        fprintf(stderr, "cannot allocate the audio push buffer\n");
+        return -1;
+    }
+    while(!vs->abort_request){
+        SDL_LockAudioDevice(vs->audio_dev);
+        while(audio_push_room(ap) && (AudioAvailable(vs) || (audio_push_starving(ap)
+                        && SDL_GetAudioDeviceStatus(vs->audio_dev) == SDL_AUDIO_PLAYING))){
+            filled = AudioFill(vs, buf, ap->chunk);
+            if(audio_push(ap, buf, filled, vs->audio_bytes_consumed*vs->usecond_per_byte) < 0)
+                break;
+        }
+        if(audio_push_clock(ap, &pts, &held)){
+            //the clock runs on over silence that is no underrun, as in the callback
+            if(!held || AudioUnderrun(vs))
+                set_audio_pts(&vs->sc, pts);
+            if(live_mode && !held)
+                LivePresent(&vs->live_audio, av_gettime_relative(), pts);
+        }
+        //the queue may stay dry without a change, the hold is released once the silence is no underrun
+        hold_audio_clock(&vs->sc, held && AudioUnderrun(vs));
+        SDL_UnlockAudioDevice(vs->audio_dev);
+        audio_push_wait(ap);
+    }
+    av_free(buf);
+    fprintf(stdout, "AudioPushThread exit\n");
+    return 0;
+}
+
+/* some decoders leave the layout unset, the default one of the channel count is meant */
+uint64_t CodecChannelLayout(AVCodecContext *pCodecCtx){
+    if(pCodecCtx->channel_layout && av_get_channel_layout_nb_channels(pCodecCtx->channel_layout) == pCodecCtx->channels)
+        return pCodecCtx->channel_layout;
+    return av_get_default_channel_layout(pCodecCtx->channels);
+}
+
+/* what the filter graph does between the decoder and the device, logged once per decoder */
+void LogAudioConversion(Codec *c){
+    AVCodecContext *pCodecCtx = c->CCtx;
+    const char *in_name = av_get_sample_fmt_name(pCodecCtx->sample_fmt);
+    uint64_t in_layout = CodecChannelLayout(pCodecCtx);
+    char in_layout_name[64], out_layout_name[64];
+
+    if(c->out_sample_rate > 0 && downmix_supported(in_layout, c->out_channel_layout, c->out_sample_fmt)){
+        av_get_channel_layout_string(in_layout_name, sizeof(in_layout_name), 0, in_layout);
+        av_get_channel_layout_string(out_layout_name, sizeof(out_layout_name), 0, c->out_channel_layout);
+        fprintf(stdout, "audio mix: %s -> %s on the audio thread\n", in_layout_name, out_layout_name);
+    }
+
+    if(pCodecCtx->sample_rate != c->out_sample_rate || pCodecCtx->channels != c->out_channels
+            || av_get_packed_sample_fmt(pCodecCtx->sample_fmt) != c->out_sample_fmt)
+        fprintf(stdout, "audio conversion: %s %d Hz %d ch -> %s %d Hz %d ch\n",
+                in_name, pCodecCtx->sample_rate, pCodecCtx->channels,
+                av_get_sample_fmt_name(c->out_sample_fmt), c->out_sample_rate, c->out_channels);
+    else if(pCodecCtx->sample_fmt != c->out_sample_fmt)
+        fprintf(stdout, "audio conversion: %s interleaved only\n", in_name);
+    else
+        fprintf(stdout, "audio conversion: none, %s %d Hz %d ch is native to the device\n",
+                in_name, pCodecCtx->sample_rate, pCodecCtx->channels);
+}
+
+const char *FilterWanted(FilterSwitch *fs){
+    return fs->graphs[fs->cur];
+}
+
+void FilterLogFailure(FilterSwitch *fs, const char *filters, int err){
+    fprintf(stderr, "%s filter graph \"%s\" not used: %s\n", fs->kind, filters, av_err2str(err));
+}
+
+/* a graph string that does not parse or configure is not tried again until asked for, on the decoder thread */
+void FilterFailed(FilterSwitch *fs, const char *filters, int err){
+    int i;
+
+    FilterLogFailure(fs, filters, err);
+    for(i=0; i<fs->nb; i++)
+        if(fs->graphs[i] == filters)
+            fs->failed = i;
+}
+
+/*
+ * Put the graph string between the buffer source and the sink, or link them directly without one.
+ * The string has one input and one output, like -vf/-af of ffmpeg.
+ */
+int LinkFilters(AVFilterGraph *graph, const char *filters, AVFilterContext *src, AVFilterContext *sink){
+    AVFilterInOut *outputs, *inputs;
+    int ret;
+
+    if(!filters)
+        return avfilter_link(src, 0, sink, 0);
+
+    outputs = avfilter_inout_alloc();
+    inputs = avfilter_inout_alloc();
+    if(!outputs || !inputs){
+        avfilter_inout_free(&outputs);
+        avfilter_inout_free(&inputs);
+        return AVERROR(ENOMEM);
+    }
+    outputs->name = av_strdup("in");
+    outputs->filter_ctx = src;
+    outputs->pad_idx = 0;
+    outputs->next = NULL;
+    inputs->name = av_strdup("out");
+    inputs->filter_ctx = sink;
+    inputs->pad_idx = 0;
+    inputs->next = NULL;
+
+    ret = avfilter_graph_parse_ptr(graph, filters, &inputs, &outputs, NULL);
+    avfilter_inout_free(&inputs);
+    avfilter_inout_free(&outputs);
+    return ret;
+}
+
+/* build the audio graph of c, a graph string that fails is returned with nothing built */
+int AudioFilterBuild(Codec *c){
     int ret;
 
     // input format, sample rate, layout, buffersrc must set this options while initializing
@@ -116,10 +652,10 @@ int AudioFilterInit(Codec *c){
     const char    *in_sample_fmt_name  = av_get_sample_fmt_name(c->CCtx->sample_fmt);
     int           in_sample_rate       = c->CCtx->sample_rate;
     int           in_channels          = c->CCtx->channels;
-    int64_t       in_channel_layout    = c->CCtx->channel_layout;
+    uint64_t      in_channel_layout    = CodecChannelLayout(c->CCtx);
 
-    snprintf(args, sizeof(args), "sample_rate=%d:sample_fmt=%s:channels=%d:time_base=%d/%d:channel_layout=0x%lld",
-            in_sample_rate, in_sample_fmt_name, in_channels, 1, in_sample_rate, in_channel_layout);
+    snprintf(args, sizeof(args), "sample_rate=%d:sample_fmt=%s:channels=%d:time_base=%d/%d:channel_layout=0x%llx",
+            in_sample_rate, in_sample_fmt_name, in_channels, 1, in_sample_rate, (unsigned long long)in_channel_layout);
 
     
     AVFilterContext *in_audio_filter = NULL, *out_audio_filter = NULL;
@@ -136,15 +672,35 @@ int AudioFilterInit(Codec *c){
     av_opt_show2(in_audio_filter->priv, NULL, 8|(1<<16), 0);
     av_opt_show2(out_audio_filter->priv, NULL, 8|(1<<16), 0);
 
-    // output format
-    static const enum AVSampleFormat out_sample_fmts[2]     = { AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_NONE };
+    // output format, the native one of the audio device, this is the only conversion on the way
+    // the speakers Downmix knows are mixed after the graph, it hands out planar float in the layout of the decoder
+    c->mix = c->out_sample_rate > 0 && downmix_supported(in_channel_layout, c->out_channel_layout, c->out_sample_fmt);
+    enum AVSampleFormat out_sample_fmts[2] = { c->out_sample_rate > 0 ? c->out_sample_fmt : AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_NONE };
+    if(c->mix)
+        out_sample_fmts[0] = AV_SAMPLE_FMT_FLTP;
     ret = av_opt_set_int_list(out_audio_filter, "sample_fmts",     out_sample_fmts,     AV_SAMPLE_FMT_NONE, AV_OPT_SEARCH_CHILDREN);
     if(ret !=0)
         fprintf(stderr, "set sample_fmts error %s\n", av_err2str(ret));
 
-    avfilter_link(in_audio_filter, 0, out_audio_filter, 0);
-    
-    avfilter_graph_config(filter_graph, NULL);
+    //resample to the audio device
+    if(c->out_sample_rate > 0){
+        int out_sample_rates[2] = { c->out_sample_rate, -1 };
+        int64_t out_channel_layouts[2] = { c->mix ? in_channel_layout : c->out_channel_layout, -1 };
+        av_opt_set_int_list(out_audio_filter, "sample_rates", out_sample_rates, -1, AV_OPT_SEARCH_CHILDREN);
+        av_opt_set_int_list(out_audio_filter, "channel_layouts", out_channel_layouts, -1, AV_OPT_SEARCH_CHILDREN);
+    }
+
+    ret = LinkFilters(filter_graph, c->filters, in_audio_filter, out_audio_filter);
+    if(ret >= 0)
+        ret = avfilter_graph_config(filter_graph, NULL);
+    if(ret < 0 && c->filters){
+        avfilter_graph_free(&filter_graph);
+        return ret;
+    }
+
+    //every frame out of the graph fills one audio callback
+    if(c->out_frame_size > 0)
+        av_buffersink_set_frame_size(out_audio_filter, c->out_frame_size);
 
     c->filter_graph = filter_graph;
     c->in_filter    = in_audio_filter;
@@ -152,7 +708,20 @@ int AudioFilterInit(Codec *c){
     return 0;
 }
 
-int VideoFilterInit(Codec *c){
+/* a graph string that fails is dropped, the plain graph is used instead */
+int AudioFilterInit(Codec *c){
+    int ret = AudioFilterBuild(c);
+
+    if(ret < 0 && c->filters){
+        FilterLogFailure(&audio_filters, c->filters, ret);
+        c->filters = NULL;
+        ret = AudioFilterBuild(c);
+    }
+    return ret;
+}
+
+/* build the video graph of c, a graph string that fails is returned with nothing built */
+int VideoFilterBuild(Codec *c){
     // input format, sample rate, layout, buffersrc must set this options while initializing
     char args[256] = {0};
     int        width     = c->CCtx->width;
@@ -167,7 +736,9 @@ int VideoFilterInit(Codec *c){
     
     AVFilterContext *in_video_filter = NULL;
     AVFilterContext *out_video_filter = NULL;
+    AVFilterContext *scale_filter = NULL;
     AVFilterGraph *filter_graph = NULL;
+    int ret;
 
     const AVFilter *buffersrc  = avfilter_get_by_name("buffer");
     const AVFilter *buffersink = avfilter_get_by_name("buffersink");
@@ -177,9 +748,25 @@ int VideoFilterInit(Codec *c){
     avfilter_graph_create_filter(&in_video_filter, buffersrc, "in", args, NULL, filter_graph);
     avfilter_graph_create_filter(&out_video_filter, buffersink, "out", NULL, NULL, filter_graph);
     
-    avfilter_link(in_video_filter, 0, out_video_filter, 0);
+    //playlist items are converted to the texture created for the first item, so is what a graph string makes
+    if(c->out_width && (c->filters || c->out_width != width || c->out_height != height || c->out_pix_fmt != pix_fmt)){
+        enum AVPixelFormat out_pix_fmts[2] = { c->out_pix_fmt, AV_PIX_FMT_NONE };
+        snprintf(args, sizeof(args), "%d:%d", c->out_width, c->out_height);
+        avfilter_graph_create_filter(&scale_filter, avfilter_get_by_name("scale"), "scale", args, NULL, filter_graph);
+        av_opt_set_int_list(out_video_filter, "pix_fmts", out_pix_fmts, AV_PIX_FMT_NONE, AV_OPT_SEARCH_CHILDREN);
+        ret = LinkFilters(filter_graph, c->filters, in_video_filter, scale_filter);
+        if(ret >= 0)
+            ret = avfilter_link(scale_filter, 0, out_video_filter, 0);
+    }else{
+        ret = LinkFilters(filter_graph, c->filters, in_video_filter, out_video_filter);
+    }
 
-    avfilter_graph_config(filter_graph, NULL);
+    if(ret >= 0)
+        ret = avfilter_graph_config(filter_graph, NULL);
+    if(ret < 0 && c->filters){
+        avfilter_graph_free(&filter_graph);
+        return ret;
+    }
 
     c->filter_graph = filter_graph;
     c->in_filter    = in_video_filter;
@@ -187,6 +774,109 @@ int VideoFilterInit(Codec *c){
     return 0;
 }
 
+/* a graph string that fails is dropped, the plain graph is used instead */
+int VideoFilterInit(Codec *c){
+    int ret = VideoFilterBuild(c);
+
+    if(ret < 0 && c->filters){
+        FilterLogFailure(&video_filters, c->filters, ret);
+        c->filters = NULL;
+        ret = VideoFilterBuild(c);
+    }
+    return ret;
+}
+
+/* a context with the parameters of the decoder only, for building a graph on another thread */
+AVCodecContext *CodecParamsCopy(AVCodecContext *pCodecCtx){
+    AVCodecContext *copy = avcodec_alloc_context3(NULL);
+    AVCodecParameters *par = avcodec_parameters_alloc();
+
+    if(!copy || !par || avcodec_parameters_from_context(par, pCodecCtx) < 0
+            || avcodec_parameters_to_context(copy, par) < 0)
+        avcodec_free_context(&copy);
+    avcodec_parameters_free(&par);
+    return copy;
+}
+
+int FilterBuildThread(void *arg){
+    FilterSwitch *fs = arg;
+    Codec *b = &fs->build;
+    int64_t start = av_gettime_relative();
+
+    //no plain graph is built when the string fails, the decoder thread keeps the one in use
+    if(b->CCtx->codec_type == AVMEDIA_TYPE_VIDEO)
+        fs->build_err = VideoFilterBuild(b);
+    else
+        fs->build_err = AudioFilterBuild(b);
+    fs->build_time = av_gettime_relative() - start;
+    avcodec_free_context(&b->CCtx);
+    SDL_AtomicSet(&fs->ready, 1);
+    return 0;
+}
+
+/*
+ * Called by the decoder thread between two packets, start building the graph wanted when it is not
+ * the one in use. Return 1 when it has been built, the caller drains c and calls FilterSwitchTake.
+ */
+int FilterSwitchPoll(FilterSwitch *fs, Codec *c){
+    const char *wanted = FilterWanted(fs);
+    int cur = fs->cur;
+
+    if(fs->tid){
+        if(!SDL_AtomicGet(&fs->ready))
+            return 0;
+        SDL_WaitThread(fs->tid, NULL);
+        fs->tid = NULL;
+        //the string failed, the one in use goes on
+        if(fs->build_err < 0){
+            FilterFailed(fs, fs->building, fs->build_err);
+            return 0;
+        }
+        return 1;
+    }
+    if(wanted == c->filters || cur == fs->failed)
+        return 0;
+
+    fs->build = *c;
+    fs->build.filter_graph = NULL;
+    fs->build.in_filter = fs->build.out_filter = NULL;
+    fs->build.filters = fs->building = wanted;
+    fs->build.CCtx = CodecParamsCopy(c->CCtx);
+    if(!fs->build.CCtx)
+        return 0;
+    if(!fs->request_time)
+        fs->request_time = av_gettime_relative();
+    SDL_AtomicSet(&fs->ready, 0);
+    fs->tid = SDL_CreateThread(FilterBuildThread, "FilterBuildThread", fs);
+    if(!fs->tid)
+        avcodec_free_context(&fs->build.CCtx);
+    return 0;
+}
+
+/* the old graph has been drained, the new one takes over */
+void FilterSwitchTake(FilterSwitch *fs, Codec *c){
+    avfilter_graph_free(&c->filter_graph);
+    c->filter_graph = fs->build.filter_graph;
+    c->in_filter = fs->build.in_filter;
+    c->out_filter = fs->build.out_filter;
+    c->mix = fs->build.mix;
+    c->filters = fs->build.filters;
+    fs->build.filter_graph = NULL;
+    fprintf(stdout, "%s filter graph %s: built in %.1f ms, swapped %lld ms after the request\n", fs->kind,
+            c->filters ? c->filters : "none", fs->build_time/1000.0,
+            (long long)((av_gettime_relative() - fs->request_time)/1000));
+    fs->request_time = 0;
+}
+
+/* the parameters of the graph being built are gone, at an item switch or the exit */
+void FilterSwitchCancel(FilterSwitch *fs){
+    if(!fs->tid)
+        return;
+    SDL_WaitThread(fs->tid, NULL);
+    fs->tid = NULL;
+    avfilter_graph_free(&fs->build.filter_graph);
+}
+
 int VideoStateInit(VideoState *pVS){
 
     memset(pVS, 0, sizeof(VideoState));
@@ -194,11 +884,12 @@ int VideoStateInit(VideoState *pVS){
     pVS->last_frame_displayed = 0;
     pVS->is_first_frame = 1;
     pVS->cur_frame = av_frame_alloc();
+    pVS->audio_frame = av_frame_alloc();
 
     return 0;
 }
 
-int VideoStateSetForComputingPTS(VideoState *vs, int freq, int channels){
+int VideoStateSetForComputingPTS(VideoState *vs, int freq, int channels, int bytes_per_sample){
 
     /* 
      * [Important] for computing audio pts 
@@ -208,15 +899,74 @@ int VideoStateSetForComputingPTS(VideoState *vs, int freq, int channels){
      *             1000000 * (audio_stream_len/audio_bytes_per_second) = usecond of stream
      *             usecond_per_byte = 1000000 * audio_bytes_per_second
      *             usecond of stream = usecond_per_byte * audio_stream_len
-     *             2 for wanted.format = AUDIO_S16SYS;
+     *             bytes_per_sample of the format the device is opened with
      */
-    vs->usecond_per_byte = 1000000.0f/(freq*2*channels); 
+    vs->usecond_per_byte = 1000000.0f/(freq*bytes_per_sample*channels); 
     fprintf(stdout, "usecond per byte is %lf\n", vs->usecond_per_byte);
 
     return 0;
 }
 
-int InitSDLAudioOutput(SDL_Output *pOutput, VideoState *vs, int freq, int channels){
+/* the speakers of SDL for a channel count, in the order it expects the samples */
+uint64_t SDLChannelLayout(int channels){
+    switch(channels){
+    case 1 :
+        return AV_CH_LAYOUT_MONO;
+    case 2 :
+        return AV_CH_LAYOUT_STEREO;
+    case 3 :
+        return AV_CH_LAYOUT_2POINT1;
+    case 4 :
+        return AV_CH_LAYOUT_QUAD;
+    case 5 :
+        return AV_CH_LAYOUT_QUAD | AV_CH_LOW_FREQUENCY;
+    case 6 :
+        return AV_CH_LAYOUT_5POINT1;
+    case 7 :
+        return AV_CH_LAYOUT_6POINT1;
+    case 8 :
+        return AV_CH_LAYOUT_7POINT1;
+    default :
+        return av_get_default_channel_layout(channels);
+    }
+}
+
+/* the packed sample format of an SDL audio format, AV_SAMPLE_FMT_NONE when there is none */
+int SampleFormatFromSDL(SDL_AudioFormat format){
+    switch(format){
+    case AUDIO_U8 :
+        return AV_SAMPLE_FMT_U8;
+    case AUDIO_S16SYS :
+        return AV_SAMPLE_FMT_S16;
+    case AUDIO_S32SYS :
+        return AV_SAMPLE_FMT_S32;
+    case AUDIO_F32SYS :
+        return AV_SAMPLE_FMT_FLT;
+    default :
+        return AV_SAMPLE_FMT_NONE;
+    }
+}
+
+SDL_AudioFormat SampleFormatToSDL(int sample_fmt){
+    switch(av_get_packed_sample_fmt(sample_fmt)){
+    case AV_SAMPLE_FMT_U8 :
+        return AUDIO_U8;
+    case AV_SAMPLE_FMT_S32 :
+        return AUDIO_S32SYS;
+    case AV_SAMPLE_FMT_FLT :
+    case AV_SAMPLE_FMT_DBL :
+        return AUDIO_F32SYS;
+    default :
+        return AUDIO_S16SYS;
+    }
+}
+
+/*
+ * The device is asked for the format of the decoder and any change is allowed,
+ * so SDL hands out its native format and converts nothing itself.
+ * A format without AVSampleFormat is opened again as S16.
+ */
+int InitSDLAudioOutput(SDL_Output *pOutput, VideoState *vs, int freq, int channels, int sample_fmt){
     SDL_AudioSpec wanted, obtained;
     int ret = 0;
 
@@ -233,18 +983,32 @@ int InitSDLAudioOutput(SDL_Output *pOutput, VideoState *vs, int freq, int channe
     /*init SDL Audio Output*/
     memset(&wanted, 0, sizeof(wanted));
     wanted.freq = freq;
-    wanted.format = AUDIO_S16SYS;
+    wanted.format = SampleFormatToSDL(sample_fmt);
     wanted.channels = channels;
-    wanted.samples = DEF_SAMPLES;
+    wanted.samples = audio_buffer_wanted_samples(&audio_buffer, freq);
     wanted.silence = 0;
-    wanted.callback = SimpleCallback;
+    wanted.callback = audio_push_mode ? NULL : SimpleCallback;
     wanted.userdata = (void *)(vs);
 
-    pOutput->audio_dev = SDL_OpenAudioDevice(NULL, 0, &wanted, &obtained, 0);
+    pOutput->audio_dev = SDL_OpenAudioDevice(NULL, 0, &wanted, &obtained, SDL_AUDIO_ALLOW_ANY_CHANGE);
+    if(pOutput->audio_dev && SampleFormatFromSDL(obtained.format) == AV_SAMPLE_FMT_NONE){
+        SDL_CloseAudioDevice(pOutput->audio_dev);
+        wanted.format = AUDIO_S16SYS;
+        pOutput->audio_dev = SDL_OpenAudioDevice(NULL, 0, &wanted, &obtained,
+                SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE);
+    }
     if(!pOutput->audio_dev){
         fprintf(stderr, "SDL Open Audio failed, reason:%s\n", SDL_GetError());
         return -1;
     }
+    pOutput->audio_samples = obtained.samples;
+    pOutput->audio_freq = obtained.freq;
+    pOutput->audio_channels = obtained.channels;
+    pOutput->audio_channel_layout = SDLChannelLayout(obtained.channels);
+    pOutput->audio_sample_fmt = SampleFormatFromSDL(obtained.format);
+    pOutput->audio_silence = obtained.silence;
+    fprintf(stdout, "audio device: %s %d Hz %d ch, %d samples per callback\n",
+            av_get_sample_fmt_name(pOutput->audio_sample_fmt), obtained.freq, obtained.channels, obtained.samples);
 
     return 0;
 }
@@ -252,9 +1016,6 @@ int InitSDLVideoOutput(SDL_Output *pOutput, VideoState *vs, int width, int heigh
     SDL_Window *window;
     SDL_Renderer *renderer;
     SDL_Texture *texture;
-    unsigned char *YPlane;
-    unsigned char *UPlane;
-    unsigned char *VPlane;
     int ret = 0;
 
     if(SDL_WasInit(0)) {
@@ -290,176 +1051,1385 @@ int InitSDLVideoOutput(SDL_Output *pOutput, VideoState *vs, int width, int heigh
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
     SDL_RenderClear(renderer);
 
-    YPlane = (unsigned char *)malloc(width*height);
-    UPlane = (unsigned char *)malloc(width*height/4);
-    VPlane = (unsigned char *)malloc(width*height/4);
-
     pOutput->window = window;
     pOutput->renderer = renderer;
     pOutput->texture = texture;
-    pOutput->YPlane = YPlane;
-    pOutput->UPlane = UPlane;
-    pOutput->VPlane = VPlane;
     pOutput->window_width = width;
     pOutput->window_height = height;
-    pOutput->buf_size = width*height;
 
     return 0;
 }
 
-void UninitSDLVideoOutput(SDL_Output *pOutput){
-    if(!pOutput)
-        return;
-    if(pOutput->texture)
-        SDL_DestroyTexture(pOutput->texture);
-    if(pOutput->renderer)
-        SDL_DestroyRenderer(pOutput->renderer);
-    if(pOutput->window)
-        SDL_DestroyWindow(pOutput->window);
-    if(pOutput->YPlane)
-        free(pOutput->YPlane);
-    if(pOutput->UPlane)
-        free(pOutput->UPlane);
-    if(pOutput->VPlane)
-        free(pOutput->VPlane);
+void UninitSDLVideoOutput(SDL_Output *pOutput){
+    if(!pOutput)
+        return;
+    if(pOutput->texture)
+        SDL_DestroyTexture(pOutput->texture);
+    if(pOutput->renderer)
+        SDL_DestroyRenderer(pOutput->renderer);
+    if(pOutput->window)
+        SDL_DestroyWindow(pOutput->window);
+}
+
+void UninitSDLAudioOutput(SDL_Output *pOutput){
+    if(!pOutput)
+        return;
+    if(pOutput->audio_dev)
+        SDL_CloseAudioDevice(pOutput->audio_dev);
+}
+
+/*
+ * The frame buffers come from frame_pool with aligned planes and linesizes,
+ * they are uploaded to the texture directly without copying to a staging buffer.
+ */
+void DisplayFrame(SDL_Output *pOutput, AVFrame *frame){
+    SDL_Rect rect = {0, 0, frame->width, frame->height};
+
+    //frames decoded in reduced resolution only fill part of the texture, it is scaled up while rendering
+    if(rect.w > pOutput->window_width || rect.h > pOutput->window_height){
+        rect.w = pOutput->window_width;
+        rect.h = pOutput->window_height;
+    }
+
+    if(0!=SDL_UpdateYUVTexture(pOutput->texture, &rect, \
+                frame->data[0], frame->linesize[0], \
+                frame->data[1], frame->linesize[1], \
+                frame->data[2], frame->linesize[2])){
+        fprintf(stdout, "Render Update Texture failed, reason: %s\n", SDL_GetError());
+    }
+    SDL_RenderCopyEx(pOutput->renderer, pOutput->texture, &rect, NULL, 0, NULL, 0);
+    SDL_RenderPresent(pOutput->renderer);
+}
+
+/* live mode, the decoder outputs every frame as soon as it can, non-spec-compliant speedups allowed */
+void ApplyLiveFlags(AVCodecContext *pCodecCtx){
+    if(!live_mode)
+        return;
+    pCodecCtx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    pCodecCtx->flags2 |= AV_CODEC_FLAG2_FAST;
+}
+
+/*
+ * lowres can only be set before avcodec_open2, so the decoder is reopened.
+ * The reference frames are lost, it must be called before sending a keyframe.
+ */
+int CodecReopen(Codec *c, int lowres){
+    AVCodecContext *pCodecCtx = avcodec_alloc_context3(NULL);
+
+    if(!pCodecCtx)
+        return -1;
+
+    if(avcodec_parameters_to_context(pCodecCtx, c->FCtx->streams[c->stream]->codecpar)<0){
+        avcodec_free_context(&pCodecCtx);
+        return -1;
+    }
+    thread_config_apply(pCodecCtx, c->Codec, &thread_config);
+    frame_pool_attach(&frame_pool, pCodecCtx);
+    ApplyLiveFlags(pCodecCtx);
+    pCodecCtx->lowres = lowres;
+
+    if(avcodec_open2(pCodecCtx, c->Codec, NULL)<0){
+        fprintf(stderr, "reopen codec with lowres %d failed\n", lowres);
+        avcodec_free_context(&pCodecCtx);
+        return -1;
+    }
+
+    avcodec_free_context(&c->CCtx);
+    c->CCtx = pCodecCtx;
+    return 0;
+}
+
+/* trick play decodes keyframes only on top of the degradation level */
+void ApplyDecodeLevel(VideoState *vs, AVCodecContext *pCodecCtx){
+    degrade_apply(&degrade, pCodecCtx);
+    if(vs->trick_speed)
+        pCodecCtx->skip_frame = AVDISCARD_NONKEY;
+}
+
+/*
+ * Called by the decoder threads at item_pkt after draining the last item.
+ * The decoder context of the next item replaces the one in use,
+ * or the one in use is only flushed when the parameters match.
+ */
+int CodecParamsMatch(AVCodecParameters *a, AVCodecParameters *b);
+int CodecOpen(AVFormatContext *pFormatCtx, int Stream, Codec *c);
+
+void TakeItemCodec(Codec *c, Codec *next){
+    //the audio track was switched after the item had been prefetched, the decoder in use does not fit
+    if(!next->CCtx && !CodecParamsMatch(c->FCtx->streams[c->stream]->codecpar, next->FCtx->streams[next->stream]->codecpar)
+            && CodecOpen(next->FCtx, next->stream, next) == 0){
+        if(next->CCtx->codec_type == AVMEDIA_TYPE_AUDIO)
+            AudioFilterInit(next);
+        else
+            VideoFilterInit(next);
+    }
+
+    if(next->CCtx){
+        avcodec_free_context(&c->CCtx);
+        avfilter_graph_free(&c->filter_graph);
+        c->CCtx = next->CCtx;
+        c->Codec = next->Codec;
+        c->filter_graph = next->filter_graph;
+        c->in_filter = next->in_filter;
+        c->out_filter = next->out_filter;
+        c->mix = next->mix;
+        c->filters = next->filters;
+        next->CCtx = NULL;
+        next->filter_graph = NULL;
+    }else{
+        avcodec_flush_buffers(c->CCtx);
+    }
+    c->FCtx = next->FCtx;
+    c->stream = next->stream;
+}
+
+/* queue the frames out of the filter graph, return what the sink returned last */
+int QueueVideoFrames(Codec *c, AVFrame *pFrame, FrameNode *fn, AVRational base_tb, int64_t pts_offset, FilterStats *fs){
+    int64_t start = av_gettime_relative();
+    int ret;
+
+    while((ret = av_buffersink_get_frame_flags(c->out_filter, pFrame, 0))>=0){
+        fs->time += av_gettime_relative() - start;
+        //the timeline goes on over loops and items, all in the time base of the first item
+        if(pFrame->pts != AV_NOPTS_VALUE)
+            pFrame->pts = av_rescale_q(pFrame->pts, av_buffersink_get_time_base(c->out_filter), base_tb) + pts_offset;
+
+        fn->frame = pFrame;
+        //fprintf(stdout, "filtered frame pts = %d\n", pFrame->pts);
+        ret = queue_frame(&VFQ, fn);
+        if(ret<0)
+            return ret;
+        start = av_gettime_relative();
+    }
+    fs->time += av_gettime_relative() - start;
+    return ret;
+}
+
+/*
+ * The frame has the parameters the buffer source was configured with, its check can be skipped.
+ * A frame without a channel layout is not, the buffer source fills it in while checking.
+ */
+int FrameMatchesGraph(Codec *c, AVFrame *frame){
+    AVFilterLink *link = c->in_filter->outputs[0];
+
+    if(link->type == AVMEDIA_TYPE_VIDEO)
+        return frame->width == link->w && frame->height == link->h && frame->format == link->format;
+    return frame->format == link->format && frame->sample_rate == link->sample_rate
+        && frame->channels == link->channels && frame->channel_layout && frame->channel_layout == link->channel_layout;
+}
+
+/*
+ * Hand a decoded frame to the buffer source. The reference is moved into the graph, which costs less
+ * than AV_BUFFERSRC_FLAG_KEEP_REF since the frame is not used after.
+ */
+int FilterAddFrame(Codec *c, AVFrame *pFrame, FilterStats *fs){
+    int64_t start = av_gettime_relative();
+    int flags = 0, ret;
+
+    if(FrameMatchesGraph(c, pFrame)){
+        flags = AV_BUFFERSRC_FLAG_NO_CHECK_FORMAT;
+        fs->unchecked++;
+    }
+    ret = av_buffersrc_add_frame_flags(c->in_filter, pFrame, flags);
+    fs->time += av_gettime_relative() - start;
+    fs->frames++;
+    if(ret < 0)
+        fprintf(stderr, "filter error\n");
+    return ret;
+}
+
+/*
+ * Without a graph string the video graph only scales the frames that do not fit the texture,
+ * the others are queued straight from the decoder. Return like the sink, negative once queued.
+ */
+int FilterVideoFrame(Codec *c, AVFrame *pFrame, FrameNode *fn, AVRational in_tb, AVRational base_tb,
+        int64_t pts_offset, FilterStats *fs){
+    int ret;
+
+    if(filter_bypass && !c->filters && pFrame->format == c->out_pix_fmt
+            && pFrame->width <= c->out_width && pFrame->height <= c->out_height){
+        if(pFrame->pts != AV_NOPTS_VALUE)
+            pFrame->pts = av_rescale_q(pFrame->pts, in_tb, base_tb) + pts_offset;
+        fn->frame = pFrame;
+        fs->bypassed++;
+        ret = queue_frame(&VFQ, fn);
+        return ret < 0 ? ret : AVERROR(EAGAIN);
+    }
+
+    FilterAddFrame(c, pFrame, fs);
+    return QueueVideoFrames(c, pFrame, fn, base_tb, pts_offset, fs);
+}
+
+void FilterStatsLog(FilterStats *fs){
+    fprintf(stdout, "%s: %lld frames through the graph, %.2f us per frame, %lld unchecked, %lld frames bypassed\n",
+            fs->name, (long long)fs->frames, fs->frames ? (double)fs->time/fs->frames : 0.0,
+            (long long)fs->unchecked, (long long)fs->bypassed);
+}
+
+int VideoThread(void *arg){
+    fprintf(stdout, "VideoThread start\n");
+    Codec *c = arg;
+    VideoState *vs = c->vs;
+    AVFrame *pFrame;
+    AVCodecContext *pCodecCtx = c->CCtx;
+    AVStream *st = c->FCtx->streams[c->stream];
+    AVRational base_tb = st->time_base;         //time base of vs->time_base, the first item
+    AVPacket packet;
+    FrameNode fn;
+    AVFilterGraph *graph;
+    DecodeStats ds;
+    FilterStats fs = { .name = "video filter" };
+    int64_t preroll_target = AV_NOPTS_VALUE;
+    int64_t busy_time;
+    int64_t pts_offset = 0, next_offset = 0;   //base_tb
+    int serial = 0;
+    int loop = 0;
+    int item = 0, next_item = -1;
+    int trick;
+    int ret, queued;
+
+    pFrame = av_frame_alloc();
+    if(pFrame == NULL){
+        fprintf(stderr, "cannot get buffer of frame\n");
+        return -1;
+    }
+    decode_stats_init(&ds, "video decoder");
+    degrade_init(&degrade, c->Codec, av_guess_frame_rate(c->FCtx, st, NULL), degrade_enabled);
+
+    while(1){
+        ret = packet_queue_get(&VPQ, &packet);
+        if(ret<0)
+            break;
+
+        if(packet.data == flush_pkt.data){
+            /* 
+             * 1. drop the reference frames and the frames not displayed yet
+             * 2. for accurate seek, decode from the keyframe before the target and drop
+             *    the frames before the target here, before they hit filter/conversion/upload
+             * 3. the loop filter is skipped for the non-ref pre-roll frames, the reference
+             *    frames keep it, the frame shown and the rest of the GOP are built on them
+             */
+            avcodec_flush_buffers(pCodecCtx);
+            frame_queue_flush(&VFQ);
+            serial = packet.pos;
+            preroll_target = packet.pts;
+            pts_offset = 0;
+            loop = 0;
+            next_item = -1;
+            ApplyDecodeLevel(vs, pCodecCtx);
+            continue;
+        }
+
+        if(packet.data == loop_pkt.data){
+            //drain the tail of the last loop, the offset is taken after it
+            next_offset = av_rescale_q(packet.pts, AV_TIME_BASE_Q, base_tb);
+            loop = 1;
+            packet.data = NULL;
+            packet.size = 0;
+        }
+
+        if(packet.data == item_pkt.data){
+            //drain the last item the same way, then switch to the decoder of the next one
+            next_offset = av_rescale_q(packet.pts, AV_TIME_BASE_Q, base_tb);
+            next_item = packet.pos;
+            loop = 1;
+            packet.data = NULL;
+            packet.size = 0;
+        }
+
+        //reduced resolution decoding is switched on a keyframe, not within the pre-roll of a seek
+        if(degrade_lowres(&degrade) != pCodecCtx->lowres && (packet.flags & AV_PKT_FLAG_KEY)
+                && preroll_target == AV_NOPTS_VALUE){
+            //the frames still in the old decoder are queued before it is freed
+            fn.serial = serial;
+            fn.item = item;
+            avcodec_send_packet(pCodecCtx, NULL);
+            while(avcodec_receive_frame(pCodecCtx, pFrame) >= 0){
+                queued = FilterVideoFrame(c, pFrame, &fn, st->time_base, base_tb, pts_offset, &fs);
+                if(queued < 0 && queued != AVERROR(EAGAIN) && queued != AVERROR_EOF)
+                    break;
+            }
+            if(CodecReopen(c, degrade_lowres(&degrade)) == 0){
+                pCodecCtx = c->CCtx;
+                //the buffer source has the size of the old decoder, the graph is drained and rebuilt
+                FilterSwitchCancel(&video_filters);
+                av_buffersrc_add_frame(c->in_filter, NULL);
+                QueueVideoFrames(c, pFrame, &fn, base_tb, pts_offset, &fs);
+                avfilter_graph_free(&c->filter_graph);
+                VideoFilterInit(c);
+            }else{
+                //the old decoder takes packets again after its drain
+                avcodec_flush_buffers(pCodecCtx);
+                degrade.max_lowres = 0;
+            }
+            ApplyDecodeLevel(vs, pCodecCtx);
+        }
+
+        if(preroll_target != AV_NOPTS_VALUE){
+            //non-ref frames before the target are not needed by anyone
+            ApplyDecodeLevel(vs, pCodecCtx);
+            pCodecCtx->skip_loop_filter = FFMAX(pCodecCtx->skip_loop_filter, AVDISCARD_NONREF);
+            if(packet.pts != AV_NOPTS_VALUE && av_rescale_q(packet.pts, st->time_base, AV_TIME_BASE_Q) < preroll_target)
+                pCodecCtx->skip_frame = FFMAX(pCodecCtx->skip_frame, AVDISCARD_NONREF);
+        }
+
+        //a graph built in the background takes over between two packets, the old one is drained first
+        if(FilterSwitchPoll(&video_filters, c)){
+            fn.serial = serial;
+            fn.item = item;
+            av_buffersrc_add_frame(c->in_filter, NULL);
+            QueueVideoFrames(c, pFrame, &fn, base_tb, pts_offset, &fs);
+            FilterSwitchTake(&video_filters, c);
+        }
+
+        busy_time = ds.busy_time;
+        trick = vs->trick_speed;
+        decode_stats_begin(&ds);
+        ret = avcodec_send_packet(pCodecCtx, &packet);
+        //in trick play every keyframe is drained out at once instead of waiting for the next one
+        if(ret>=0 && trick)
+            avcodec_send_packet(pCodecCtx, NULL);
+        decode_stats_end(&ds, 0);
+
+        //receive video frame
+        while(ret>=0){
+            decode_stats_begin(&ds);
+            ret = avcodec_receive_frame(pCodecCtx, pFrame);
+            decode_stats_end(&ds, ret>=0);
+            if(ret>=0){
+                if(preroll_target != AV_NOPTS_VALUE){
+                    //a frame without a timestamp cannot be placed before the target, it is shown
+                    if(pFrame->best_effort_timestamp != AV_NOPTS_VALUE
+                            && av_rescale_q(pFrame->best_effort_timestamp, st->time_base, AV_TIME_BASE_Q) < preroll_target){
+                        av_frame_unref(pFrame);
+                        continue;
+                    }
+                    //reach the target, decode normally
+                    preroll_target = AV_NOPTS_VALUE;
+                    ApplyDecodeLevel(vs, pCodecCtx);
+                }
+
+                fn.serial = serial;
+                fn.item = item;
+                //the graph running dry does not end the receiving, a drain takes every frame out of the decoder
+                queued = FilterVideoFrame(c, pFrame, &fn, st->time_base, base_tb, pts_offset, &fs);
+                if(queued < 0 && queued != AVERROR(EAGAIN) && queued != AVERROR_EOF)
+                    break;
+            }
+        }
+        av_packet_unref(&packet);
+
+        if(loop){
+            if(next_item >= 0){
+                //the frames the graph still holds belong to the last item, they are drained before the swap
+                fn.serial = serial;
+                fn.item = item;
+                av_buffersrc_add_frame(c->in_filter, NULL);
+                QueueVideoFrames(c, pFrame, &fn, base_tb, pts_offset, &fs);
+                graph = c->filter_graph;
+                FilterSwitchCancel(&video_filters);
+                TakeItemCodec(c, &playlist.items[next_item].VCodec);
+                //a reused graph has been drained, the new item starts in a new one
+                if(c->filter_graph == graph){
+                    avfilter_graph_free(&c->filter_graph);
+                    VideoFilterInit(c);
+                }
+                pCodecCtx = c->CCtx;
+                st = c->FCtx->streams[c->stream];
+                degrade.max_lowres = c->Codec->max_lowres;
+                ApplyDecodeLevel(vs, pCodecCtx);
+                item = next_item;
+                playlist.video_item = item;
+                next_item = -1;
+            }else{
+                avcodec_flush_buffers(pCodecCtx);
+            }
+            pts_offset = next_offset;
+            loop = 0;
+            continue;
+        }
+
+        if(trick){
+            avcodec_flush_buffers(pCodecCtx);
+            continue;
+        }
+
+        if(degrade_update(&degrade, ds.busy_time-busy_time, frame_nb(&VFQ), VFQ.max_nb)
+                && preroll_target == AV_NOPTS_VALUE)
+            ApplyDecodeLevel(vs, pCodecCtx);
+    }
+
+    decode_stats_log(&ds);
+    FilterStatsLog(&fs);
+    frame_pool_log(&frame_pool);
+    fprintf(stdout, "degrade: level %d (%s), %d transitions\n", degrade_level(&degrade),
+            degrade_level_name(degrade_level(&degrade)), degrade.transitions);
+    av_frame_free(&pFrame);
+    avcodec_close(pCodecCtx);
+    FilterSwitchCancel(&video_filters);
+    avfilter_graph_free(&(c->filter_graph));
+    
+    fprintf(stdout, "VideoThread exit\n");
+    return 0;
+}
+
+/*
+ * The waveform jumps at the loop point, crossfade from the last sample played
+ * into the new loop within length samples so there is no click.
+ * Interleaved in the format of the device.
+ */
+void Declick(uint8_t *data, int nb_samples, int channels, int format, const uint8_t *last, int length){
+    int n = FFMIN(nb_samples, length);
+    int i, ch, k;
+
+    for(i=0; i<n; i++){
+        for(ch=0; ch<channels; ch++){
+            k = i*channels+ch;
+            switch(format){
+            case AV_SAMPLE_FMT_FLT :
+                ((float *)data)[k] = (((const float *)last)[ch]*(n-i) + ((float *)data)[k]*i)/n;
+                break;
+            case AV_SAMPLE_FMT_S32 :
+                ((int32_t *)data)[k] = (((const int32_t *)last)[ch]*(int64_t)(n-i) + ((int32_t *)data)[k]*(int64_t)i)/n;
+                break;
+            case AV_SAMPLE_FMT_S16 :
+                ((int16_t *)data)[k] = (((const int16_t *)last)[ch]*(n-i) + ((int16_t *)data)[k]*i)/n;
+                break;
+            default :
+                data[k] = (last[ch]*(n-i) + data[k]*i)/n;
+                break;
+            }
+        }
+    }
+}
+
+/* a frame out of the filter graph in the format of the device, mixed down here when the graph leaves it */
+int AudioFilterGetFrame(Codec *c, AVFrame *pFrame, Downmix *dm){
+    int ret;
+
+    if(!c->mix)
+        return av_buffersink_get_frame_flags(c->out_filter, pFrame, 0);
+    ret = av_buffersink_get_frame_flags(c->out_filter, dm->in, 0);
+    if(ret < 0)
+        return ret;
+    //a new track or item may bring another layout, the matrix is built again
+    if(dm->in->channel_layout != dm->in_layout || c->out_channel_layout != dm->out_layout
+            || c->out_sample_fmt != dm->out_format){
+        ret = downmix_config(dm, dm->in->channel_layout, c->out_channel_layout, c->out_sample_fmt);
+        if(ret < 0){
+            fprintf(stderr, "audio mix error %s\n", av_err2str(ret));
+            av_frame_unref(dm->in);
+            return ret;
+        }
+    }
+    return downmix_frame(dm, pFrame);
+}
+
+/*
+ * The sink hands out whole callbacks only, the samples short of one stay in the graph.
+ * At the end of a loop, an item or the file they are pushed out with EOF
+ * and come as a shorter frame, the graph takes no more frames after that.
+ */
+int DrainAudioFilter(Codec *c, AVFrame *pFrame, Downmix *dm, FrameNode *fn, uint8_t *last_sample, int bytes_per_sample){
+    av_buffersrc_add_frame(c->in_filter, NULL);
+    while(AudioFilterGetFrame(c, pFrame, dm) >= 0){
+        if(last_sample && pFrame->nb_samples > 0)
+            memcpy(last_sample, pFrame->data[0] + (pFrame->nb_samples-1)*bytes_per_sample, bytes_per_sample);
+        pFrame->pts = AV_NOPTS_VALUE;
+        fn->frame = pFrame;
+        if(queue_frame(&AFQ, fn) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* usecond on the timeline of a frame out of the sink, offset is the loop_offset it is decoded in */
+int64_t AudioTimelinePts(Codec *c, AVFrame *frame, int64_t offset){
+    if(frame->pts == AV_NOPTS_VALUE)
+        return AV_NOPTS_VALUE;
+    return av_rescale_q(frame->pts, av_buffersink_get_time_base(c->out_filter), AV_TIME_BASE_Q) + offset;
+}
+
+void ResetAudioFilter(Codec *c){
+    avfilter_graph_free(&c->filter_graph);
+    AudioFilterInit(c);
+}
+
+/* usecond of the decoded audio not played yet */
+int64_t AudioQueuedDuration(VideoState *vs){
+    int64_t queued = frame_nb(&AFQ)*vs->audio_frame_samples*vs->audio_frame_bytes
+        + vs->audio_frame_size - vs->audio_frame_pos;
+
+    if(audio_push_mode)
+        queued += audio_push_queued(&audio_push);
+    return (int64_t)(queued*vs->usecond_per_byte);
+}
+
+/* drop the audio not played yet, the callback is kept out while its frame is dropped */
+void FlushAudioOutput(VideoState *vs){
+    SDL_LockAudioDevice(vs->audio_dev);
+    if(audio_push_mode)
+        audio_push_clear(&audio_push);
+    frame_queue_flush(&AFQ);
+    av_frame_unref(vs->audio_frame);
+    vs->audio_frame_pos = vs->audio_frame_size = 0;
+    SDL_UnlockAudioDevice(vs->audio_dev);
+}
+
+int AudioThread(void *arg){
+    fprintf(stdout, "AudioThread start\n");
+    Codec *c = arg;
+    VideoState *vs = c->vs;
+    AVCodecContext *pCodecCtx = c->CCtx;
+    AVRational tb = c->FCtx->streams[c->stream]->time_base;
+    AVPacket packet;
+    int next_item = -1;
+    AVFrame *pFrame = NULL;
+    FrameNode fn;
+    int skip_size;
+    int bytes_per_sample = vs->audio_frame_bytes;
+    int64_t preroll_target = AV_NOPTS_VALUE;
+    int64_t frame_pts = AV_NOPTS_VALUE, frame_end;
+    int64_t clock_offset = 0;
+    int clock_reset = live_mode;    //a live stream is joined in the middle, the clock starts at its first pts
+    int serial = 0;
+    int loop = 0, declick = 0, eof;
+    int rebase = 0;                 //the clock goes to the timeline at the first frame of a new loop or item
+    uint8_t *last_sample = NULL;
+    AVFilterGraph *graph = NULL;
+    Downmix dm;
+    DecodeStats ds;
+    FilterStats fs = { .name = "audio filter" };
+    int64_t start;
+    int ret, got;
+
+    pFrame = av_frame_alloc();
+    if(pFrame == NULL || downmix_init(&dm) < 0){
+        fprintf(stderr, "cannot get buffer of frame\n");
+        av_frame_free(&pFrame);
+        return -1;
+    }
+    decode_stats_init(&ds, "audio decoder");
+    if(loop_enabled || playlist.nb_items > 1)
+        last_sample = av_mallocz(bytes_per_sample);
+
+    //Read from stream into packet
+    while(1){
+        ret = packet_queue_get(&APQ, &packet);
+        if(ret<0)
+            break;
+
+        if(packet.data == flush_pkt.data){
+            //audio clock restarts from the first sample played after the seek
+            avcodec_flush_buffers(pCodecCtx);
+            FlushAudioOutput(vs);
+            //the graph holds the samples of the old position short of a whole frame
+            ResetAudioFilter(c);
+            preroll_target = packet.pts;
+            clock_offset = 0;
+            serial = packet.pos;
+            vs->audio_offset = 0;
+            clock_reset = 1;
+            loop = declick = rebase = 0;
+            next_item = -1;
+            continue;
+        }
+
+        if(packet.data == atrack_pkt.data){
+            SDL_AtomicSet(&vs->atrack_pending, 0);
+            //the new track starts at the target, what is left of the old one is dropped
+            FilterSwitchCancel(&audio_filters);
+            TakeItemCodec(c, &atrack_codec);
+            pCodecCtx = c->CCtx;
+            tb = c->FCtx->streams[c->stream]->time_base;
+            FlushAudioOutput(vs);
+            preroll_target = packet.pts;
+            clock_offset = packet.pos;
+            clock_reset = 1;
+            declick = rebase = 0;
+            continue;
+        }
+
+        /*
+         * drain the last loop and flush the decoder, or switch to the next item, the clock is
+         * rebased to the offset when the new loop or item is played, the streams may not end together
+         */
+        if(packet.data == loop_pkt.data || packet.data == item_pkt.data){
+            if(packet.data == item_pkt.data)
+                next_item = packet.pos;
+            vs->audio_offset = packet.pts;
+            loop = 1;
+            packet.data = NULL;
+            packet.size = 0;
+        }
+        eof = !packet.data && !loop;
+
+        //a graph built in the background takes over between two packets, the old one is drained first
+        if(FilterSwitchPoll(&audio_filters, c)){
+            fn.serial = serial;
+            fn.item = playlist.audio_item;
+            if(DrainAudioFilter(c, pFrame, &dm, &fn, last_sample, bytes_per_sample) < 0){
+                av_packet_unref(&packet);
+                break;
+            }
+            FilterSwitchTake(&audio_filters, c);
+        }
+
+        decode_stats_begin(&ds);
+        ret = avcodec_send_packet(pCodecCtx, &packet);
+        decode_stats_end(&ds, 0);
+
+        while(ret>=0){
+            //Decode audio frame
+            decode_stats_begin(&ds);
+            ret = avcodec_receive_frame(pCodecCtx, pFrame);
+            decode_stats_end(&ds, ret>=0);
+            
+            if(ret >=0){
+                frame_pts = AV_NOPTS_VALUE;
+                if(pFrame->best_effort_timestamp != AV_NOPTS_VALUE)
+                    frame_pts = av_rescale_q(pFrame->best_effort_timestamp, tb, AV_TIME_BASE_Q);
+
+                //drop the whole frames before the accurate seek target
+                if(preroll_target != AV_NOPTS_VALUE && frame_pts != AV_NOPTS_VALUE){
+                    frame_end = frame_pts + av_rescale(pFrame->nb_samples, AV_TIME_BASE, pCodecCtx->sample_rate);
+                    if(frame_end <= preroll_target){
+                        av_frame_unref(pFrame);
+                        continue;
+                    }
+                }
+
+                FilterAddFrame(c, pFrame, &fs);
+                start = av_gettime_relative();
+                //the graph running dry does not end the receiving, a drain takes every frame out of the decoder
+                while((got = AudioFilterGetFrame(c, pFrame, &dm))>=0){
+                    fs.time += av_gettime_relative() - start;
+                    //origin pFrame->linesize[0] = 8192
+                    //filtered pFrame->linesize[0] = 4224
+                    //why ?
+                    if(declick){
+                        if(last_sample && av_frame_make_writable(pFrame) >= 0)
+                            Declick(pFrame->data[0], pFrame->nb_samples, pFrame->channels, pFrame->format, last_sample, LOOP_DECLICK);
+                        declick = 0;
+                    }
+                    if(last_sample && pFrame->nb_samples > 0)
+                        memcpy(last_sample, pFrame->data[0] + (pFrame->nb_samples-1)*bytes_per_sample, bytes_per_sample);
+
+                    if(clock_reset){
+                        /*
+                         * cut the head of the first frame to land on the exact target,
+                         * only the data pointer moves, the buffer is still released by its reference
+                         */
+                        if(preroll_target != AV_NOPTS_VALUE && frame_pts != AV_NOPTS_VALUE && frame_pts < preroll_target){
+                            skip_size = (int)((preroll_target - frame_pts)/vs->usecond_per_byte);
+                            skip_size -= skip_size % bytes_per_sample;
+                            if(skip_size > pFrame->nb_samples*bytes_per_sample)
+                                skip_size = pFrame->nb_samples*bytes_per_sample;
+                            pFrame->data[0] += skip_size;
+                            pFrame->nb_samples -= skip_size/bytes_per_sample;
+                            frame_pts = preroll_target;
+                        }
+                        if(frame_pts != AV_NOPTS_VALUE){
+                            SDL_LockAudioDevice(vs->audio_dev);
+                            vs->audio_bytes_consumed = (frame_pts + clock_offset)/vs->usecond_per_byte;
+                            SDL_UnlockAudioDevice(vs->audio_dev);
+                        }
+                        vs->audio_serial = serial;
+                        if(vs->atrack_request_time){
+                            fprintf(stdout, "audio track switched to stream %d, latency %lld ms\n",
+                                    c->stream, (long long)((av_gettime_relative()-vs->atrack_request_time)/1000));
+                            vs->atrack_request_time = 0;
+                        }
+                        preroll_target = AV_NOPTS_VALUE;
+                        clock_reset = 0;
+                    }
+
+                    if(pFrame->nb_samples <= 0){
+                        av_frame_unref(pFrame);
+                        start = av_gettime_relative();
+                        continue;
+                    }
+                    pFrame->pts = rebase ? AudioTimelinePts(c, pFrame, vs->audio_offset) : AV_NOPTS_VALUE;
+                    if(pFrame->pts != AV_NOPTS_VALUE)
+                        rebase = 0;
+                    fn.frame = pFrame;
+                    fn.serial = serial;
+                    fn.item = playlist.audio_item;
+                    if(queue_frame(&AFQ, &fn) < 0){
+                        ret = -1;
+                        break;
+                    }
+                    start = av_gettime_relative();
+                }
+                fs.time += av_gettime_relative() - start;
+            }
+        }
+        av_packet_unref(&packet);
+
+        if(loop || eof){
+            fn.serial = serial;
+            fn.item = playlist.audio_item;
+            if(DrainAudioFilter(c, pFrame, &dm, &fn, last_sample, bytes_per_sample) < 0)
+                break;
+            graph = c->filter_graph;
+        }
+
+        if(loop){
+            if(next_item >= 0){
+                FilterSwitchCancel(&audio_filters);
+                TakeItemCodec(c, &playlist.items[next_item].ACodec);
+                pCodecCtx = c->CCtx;
+                tb = c->FCtx->streams[c->stream]->time_base;
+                fprintf(stdout, "audio switched to item %d with %lld ms buffered\n", next_item,
+                        (long long)(AudioQueuedDuration(vs)/1000));
+                playlist.audio_item = next_item;
+                next_item = -1;
+            }else{
+                avcodec_flush_buffers(pCodecCtx);
+            }
+            rebase = 1;
+            //a reused graph has been drained, the new loop or item starts in a new one
+            if(c->filter_graph == graph)
+                ResetAudioFilter(c);
+            declick = 1;
+            loop = 0;
+        }
+    }
+
+    decode_stats_log(&ds);
+    FilterStatsLog(&fs);
+    av_free(last_sample);
+    av_free(pFrame);
+    downmix_uninit(&dm);
+    avcodec_close(pCodecCtx);
+    FilterSwitchCancel(&audio_filters);
+    avfilter_graph_free(&(c->filter_graph));
+
+    fprintf(stdout, "AudioThread exit\n");
+    return 0;
+}
+
+/*
+ * Fast seek lands on the keyframe nearest to the target,
+ * accurate seek lands on the keyframe before the target.
+ * The keyframe is looked up in the index of the video stream, 
+ * if the container has no index, avformat_seek_file searches it in the allowed range.
+ */
+int SeekToKeyFrame(VideoState *vs, int64_t target, int accurate){
+    AVFormatContext *pFormatCtx = vs->FCtx;
+    AVStream *st;
+    int64_t ts, key_ts;
+    int idx, next;
+
+    if(vs->has_video){
+        st = pFormatCtx->streams[vs->VStream];
+        ts = av_rescale_q(target, AV_TIME_BASE_Q, st->time_base);
+        idx = av_index_search_timestamp(st, ts, AVSEEK_FLAG_BACKWARD);
+        if(idx >= 0){
+            key_ts = st->index_entries[idx].timestamp;
+            if(!accurate){
+                next = av_index_search_timestamp(st, ts, 0);
+                if(next >= 0 && st->index_entries[next].timestamp - ts < ts - key_ts)
+                    key_ts = st->index_entries[next].timestamp;
+            }
+            return avformat_seek_file(pFormatCtx, vs->VStream, INT64_MIN, key_ts, key_ts, 0);
+        }
+    }
+
+    if(accurate)
+        return avformat_seek_file(pFormatCtx, -1, INT64_MIN, target, target, 0);
+    else
+        return avformat_seek_file(pFormatCtx, -1, INT64_MIN, target, INT64_MAX, 0);
+}
+
+/*
+ * Drop the packets of old position and tell decoders with flush_pkt,
+ * decoders flush themselves, VFQ and AFQ.
+ */
+void FlushDecoders(VideoState *vs, int64_t preroll_target){
+    AVPacket pkt;
+
+    vs->seek_serial++;
+    pkt = flush_pkt;
+    pkt.pts = preroll_target;
+    pkt.pos = vs->seek_serial;
+    if(vs->has_audio){
+        packet_queue_flush(&APQ);
+        packet_queue_put(&APQ, &pkt);
+    }
+    if(vs->has_video){
+        packet_queue_flush(&VPQ);
+        packet_queue_put(&VPQ, &pkt);
+    }
+    vs->loop_offset = 0;
+    vs->item_offset = 0;
+
+    //the switched audio track has not been taken yet, it starts at the new position
+    if(vs->has_audio && SDL_AtomicGet(&vs->atrack_pending)){
+        pkt = atrack_pkt;
+        pkt.pts = preroll_target;
+        pkt.pos = 0;
+        packet_queue_put(&APQ, &pkt);
+    }
+
+    //a decoder not in the current item yet has just lost its item_pkt
+    pkt = item_pkt;
+    pkt.pts = 0;
+    pkt.pos = playlist.cur;
+    if(vs->has_audio && playlist.audio_item != playlist.cur)
+        packet_queue_put(&APQ, &pkt);
+    if(vs->has_video && playlist.video_item != playlist.cur)
+        packet_queue_put(&VPQ, &pkt);
+    read_finished = 0;
+}
+
+/*
+ *  1. seek the demuxer to the keyframe
+ *  2. flush the decoders, for accurate seek they drop the frames before the target
+ */
+int DoSeek(VideoState *vs){
+    int64_t target = vs->seek_target;
+    int accurate = vs->seek_flags & SEEK_ACCURATE;
+    int ret;
+
+    ret = SeekToKeyFrame(vs, target, accurate);
+    if(ret < 0){
+        fprintf(stderr, "seek to %lf failed: %s\n", target/(double)AV_TIME_BASE, av_err2str(ret));
+        vs->seek_request_time = 0;
+        return ret;
+    }
+
+    FlushDecoders(vs, accurate ? target : AV_NOPTS_VALUE);
+    vs->trick_pos = target;
+    return 0;
+}
+
+/*
+ * Queue the next keyframe for trick play, return -1 when there is no keyframe in this direction.
+ *   1. with the index of the video stream, seek to the keyframe directly
+ *   2. without index, rewind seeks to the keyframe before the wanted position,
+ *      fast-forward reads on and discards the packets until the next keyframe
+ *   3. audio packets and non-key video packets are never queued
+ */
+int TrickStep(VideoState *vs){
+    AVFormatContext *pFormatCtx = vs->FCtx;
+    AVStream *st = pFormatCtx->streams[vs->VStream];
+    int64_t step = (int64_t)TRICK_INTERVAL*FFABS(vs->trick_speed);
+    int64_t start = pFormatCtx->start_time != AV_NOPTS_VALUE ? pFormatCtx->start_time : 0;
+    int64_t want, ts, pts;
+    AVPacket packet;
+    int idx;
+
+    want = vs->trick_speed > 0 ? vs->trick_pos + step : vs->trick_pos - step;
+    if(want < start && vs->trick_pos <= start)
+        return -1;
+
+    if(st->nb_index_entries > 0){
+        ts = av_rescale_q(want, AV_TIME_BASE_Q, st->time_base);
+        idx = av_index_search_timestamp(st, ts, vs->trick_speed > 0 ? 0 : AVSEEK_FLAG_BACKWARD);
+        if(idx < 0)
+            return -1;
+        ts = st->index_entries[idx].timestamp;
+        if(avformat_seek_file(pFormatCtx, vs->VStream, INT64_MIN, ts, ts, 0) < 0)
+            return -1;
+    }else if(vs->trick_speed < 0){
+        if(avformat_seek_file(pFormatCtx, -1, INT64_MIN, want, want, 0) < 0)
+            return -1;
+    }
+
+    while(av_read_frame(pFormatCtx, &packet) >= 0){
+        if(packet.stream_index != vs->VStream || !(packet.flags & AV_PKT_FLAG_KEY)){
+            av_packet_unref(&packet);
+            continue;
+        }
+
+        pts = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+        pts = pts != AV_NOPTS_VALUE ? av_rescale_q(pts, st->time_base, AV_TIME_BASE_Q) : want;
+        if(st->nb_index_entries <= 0 && vs->trick_speed > 0 && pts < want){
+            av_packet_unref(&packet);
+            continue;
+        }
+
+        if(vs->trick_speed > 0 ? pts <= vs->trick_pos : pts >= vs->trick_pos){
+            //landed on the same keyframe again, go further next time
+            av_packet_unref(&packet);
+            vs->trick_pos = want;
+            return 0;
+        }
+
+        vs->trick_pos = pts;
+        if(packet_queue_put(&VPQ, &packet) < 0)
+            av_packet_unref(&packet);
+        return 0;
+    }
+    return -1;
+}
+
+/* 
+ * Entering trick play flushes the decoders, the speed can be changed without flushing.
+ * Leaving trick play seeks to the last keyframe shown and plays normally from there.
+ */
+void DoTrickChange(VideoState *vs){
+    int speed = vs->trick_req_speed;
+
+    vs->trick_req = 0;
+    if(!vs->has_video || speed == vs->trick_speed)
+        return;
+
+    if(speed && !vs->trick_speed){
+        vs->trick_pos = MediaPosition(vs);
+        vs->trick_speed = speed;
+        FlushDecoders(vs, AV_NOPTS_VALUE);
+    }else if(speed){
+        vs->trick_speed = speed;
+    }else{
+        vs->trick_speed = 0;
+        vs->seek_target = vs->trick_pos;
+        vs->seek_flags = 0;
+        DoSeek(vs);
+    }
+    fprintf(stdout, "trick play speed %d\n", vs->trick_speed);
+}
+
+/*
+ * Seek back to the start at the end of file for gapless looping.
+ * Nothing is reopened or flushed here, loop_pkt follows the last packets of the loop
+ * and the frames of the new loop are shifted by loop_offset, so the timeline goes on.
+ */
+int LoopBack(VideoState *vs, int64_t duration){
+    AVFormatContext *pFormatCtx = vs->FCtx;
+    int64_t start = pFormatCtx->start_time != AV_NOPTS_VALUE ? pFormatCtx->start_time : 0;
+    AVPacket pkt;
+    int ret;
+
+    if(duration <= 0)
+        return -1;
+
+    ret = avformat_seek_file(pFormatCtx, -1, INT64_MIN, start, start, 0);
+    if(ret < 0){
+        fprintf(stderr, "loop back failed: %s\n", av_err2str(ret));
+        return ret;
+    }
+
+    vs->loop_duration = duration;
+    vs->loop_offset += duration;
+    vs->loop_count++;
+
+    pkt = loop_pkt;
+    pkt.pts = vs->loop_offset;
+    if(vs->has_audio)
+        packet_queue_put(&APQ, &pkt);
+    if(vs->has_video)
+        packet_queue_put(&VPQ, &pkt);
+
+    fprintf(stdout, "loop %d, %lf s per loop\n", vs->loop_count, duration/(double)AV_TIME_BASE);
+    return 0;
+}
+
+/* the loop or the item ends with the longest stream */
+void TrackEnd(AVFormatContext *pFormatCtx, AVPacket *pkt, int64_t *end){
+    AVStream *st = pFormatCtx->streams[pkt->stream_index];
+    int64_t pkt_end;
+
+    if(pkt->pts == AV_NOPTS_VALUE)
+        return;
+    pkt_end = av_rescale_q(pkt->pts + pkt->duration, st->time_base, AV_TIME_BASE_Q);
+    if(*end == AV_NOPTS_VALUE || pkt_end > *end)
+        *end = pkt_end;
+}
+
+int CodecInit(int type, AVFormatContext *pFormatCtx, Codec *c);
+
+/*
+ * The stream given with -ast/-vst when the file has it with this type,
+ * otherwise the best one, the items of a playlist fall back the same way.
+ */
+int SelectStream(AVFormatContext *pFormatCtx, int type){
+    int wanted = wanted_stream[type];
+
+    if(wanted == -2)
+        return AVERROR_STREAM_NOT_FOUND;
+    if(wanted >= 0 && wanted < pFormatCtx->nb_streams
+            && pFormatCtx->streams[wanted]->codecpar->codec_type == type)
+        return wanted;
+    return av_find_best_stream(pFormatCtx, type, -1, -1, NULL, 0);
+}
+
+/* the demuxer skips the packets of every stream but the selected ones */
+void DiscardStreams(AVFormatContext *pFormatCtx, int AudioStream, int VideoStream){
+    int i;
+
+    for(i=0; i<pFormatCtx->nb_streams; i++){
+        if(i == AudioStream || i == VideoStream)
+            pFormatCtx->streams[i]->discard = AVDISCARD_DEFAULT;
+        else
+            pFormatCtx->streams[i]->discard = AVDISCARD_ALL;
+    }
+}
+
+/* a packet of no selected stream, released at once */
+void DiscardPacket(VideoState *vs, AVPacket *pkt){
+    vs->discarded_packets++;
+    vs->discarded_bytes += pkt->size;
+    av_packet_unref(pkt);
 }
 
-void UninitSDLAudioOutput(SDL_Output *pOutput){
-    if(!pOutput)
-        return;
-    if(pOutput->audio_dev)
-        SDL_CloseAudioDevice(pOutput->audio_dev);
+/* the decoder context can be kept over the item boundary */
+int CodecParamsMatch(AVCodecParameters *a, AVCodecParameters *b){
+    if(a->codec_type != b->codec_type || a->codec_id != b->codec_id || a->format != b->format)
+        return 0;
+    if(a->width != b->width || a->height != b->height)
+        return 0;
+    if(a->sample_rate != b->sample_rate || a->channels != b->channels || a->channel_layout != b->channel_layout)
+        return 0;
+    //different extradata carries different parameter sets
+    if(a->extradata_size != b->extradata_size
+            || (a->extradata_size && memcmp(a->extradata, b->extradata, a->extradata_size)))
+        return 0;
+    return 1;
 }
 
-void DisplayFrame(SDL_Output *pOutput){
-    if(0!=SDL_UpdateYUVTexture(pOutput->texture, NULL, \
-                pOutput->YPlane, pOutput->window_width, \
-                pOutput->UPlane, pOutput->window_width/2, \
-                pOutput->VPlane, pOutput->window_width/2)){
-        fprintf(stdout, "Render Update Texture failed, reason: %s\n", SDL_GetError());
+/*
+ * Find the stream of the next item and open its decoder and filter graph,
+ * nothing is opened when the parameters match the item playing, c->CCtx stays NULL.
+ */
+int ItemCodecInit(int type, PlayItem *item, Codec *prev, Codec *c){
+    AVStream *st, *prev_st = prev->FCtx->streams[prev->stream];
+    int stream;
+
+    memset(c, 0, sizeof(Codec));
+    c->vs = prev->vs;
+    c->out_sample_rate = prev->out_sample_rate;
+    c->out_channels = prev->out_channels;
+    c->out_channel_layout = prev->out_channel_layout;
+    c->out_frame_size = prev->out_frame_size;
+    c->out_sample_fmt = prev->out_sample_fmt;
+    c->out_width = prev->out_width;
+    c->out_height = prev->out_height;
+    c->out_pix_fmt = prev->out_pix_fmt;
+    c->filters = FilterWanted(type == AVMEDIA_TYPE_VIDEO ? &video_filters : &audio_filters);
+
+    stream = SelectStream(item->FCtx, type);
+    if(stream < 0){
+        fprintf(stderr, "%s has no %s stream\n", item->filename, av_get_media_type_string(type));
+        return -1;
     }
-    SDL_RenderCopyEx(pOutput->renderer, pOutput->texture, NULL, NULL, 0, NULL, 0);
-    SDL_RenderPresent(pOutput->renderer);
+    st = item->FCtx->streams[stream];
+
+    if(CodecParamsMatch(prev_st->codecpar, st->codecpar) && !av_cmp_q(prev_st->time_base, st->time_base)){
+        c->FCtx = item->FCtx;
+        c->stream = stream;
+        return 0;
+    }
+
+    if(CodecInit(type, item->FCtx, c) != 0)
+        return -1;
+    c->vs = prev->vs;
+    if(type == AVMEDIA_TYPE_VIDEO)
+        return VideoFilterInit(c);
+    LogAudioConversion(c);
+    return AudioFilterInit(c);
 }
 
-int VideoThread(void *arg){
-    fprintf(stdout, "VideoThread start\n");
-    Codec *c = arg;
-    AVFrame *pFrame;
-    AVCodecContext *pCodecCtx = c->CCtx;
+/*
+ * Open, probe and create the decoders of the next item while the current one plays,
+ * then read ahead PLAYLIST_PREFILL packets per stream into its own queues.
+ */
+int PrefetchThread(void *arg){
+    PlayItem *item = arg;
+    VideoState *vs = item->vs;
+    int64_t begin = av_gettime_relative();
     AVPacket packet;
-    FrameNode fn;
-    int ret;
 
-    pFrame = av_frame_alloc();
-    if(pFrame == NULL){
-        fprintf(stderr, "cannot get buffer of frame\n");
+    item->ready = -1;
+    if(file_io_open_input(&item->FCtx, item->filename, io_mode, io_window, &item->fio)!=0){
+        fprintf(stderr, "open input %s failed\n", item->filename);
+        return -1;
+    }
+    if(stream_cache_find_stream_info(item->FCtx, item->filename, fast_start)<0){
+        fprintf(stderr, "find stream info of %s failed\n", item->filename);
+        return -1;
+    }
+    if(!live_mode)
+        key_index_attach(item->FCtx, item->filename);
+    if(vs->has_video && ItemCodecInit(AVMEDIA_TYPE_VIDEO, item, &item->prev->VCodec, &item->VCodec)<0)
+        return -1;
+    if(vs->has_audio && ItemCodecInit(AVMEDIA_TYPE_AUDIO, item, &item->prev->ACodec, &item->ACodec)<0)
         return -1;
+    DiscardStreams(item->FCtx, vs->has_audio ? item->ACodec.stream : -1, vs->has_video ? item->VCodec.stream : -1);
+
+    packet_queue_init(&item->APQ, PLAYLIST_PREFILL, "prefill audio queue");
+    packet_queue_init(&item->VPQ, PLAYLIST_PREFILL, "prefill video queue");
+    item->prefilled = 1;
+
+    while(!vs->abort_request && packet_queue_nb_packets(&item->APQ) < PLAYLIST_PREFILL
+            && packet_queue_nb_packets(&item->VPQ) < PLAYLIST_PREFILL
+            && av_read_frame(item->FCtx, &packet)>=0){
+        if(vs->has_audio && packet.stream_index == item->ACodec.stream)
+            packet_queue_put(&item->APQ, &packet);
+        else if(vs->has_video && packet.stream_index == item->VCodec.stream)
+            packet_queue_put(&item->VPQ, &packet);
+        else
+            av_packet_unref(&packet);
     }
 
-    while(1){
-        ret = packet_queue_get(&VPQ, &packet);
-        if(ret<0)
-            break;
+    item->ready = 1;
+    fprintf(stdout, "%s ready in %lld ms, %d audio + %d video packets prefilled, decoder %s\n",
+            item->filename, (long long)((av_gettime_relative()-begin)/1000),
+            packet_queue_nb_packets(&item->APQ), packet_queue_nb_packets(&item->VPQ),
+            (vs->has_video ? item->VCodec.CCtx : item->ACodec.CCtx) ? "opened" : "reused");
+    return 0;
+}
 
-        ret = avcodec_send_packet(pCodecCtx, &packet);
+void StartPrefetch(VideoState *vs, int index){
+    PlayItem *item;
 
-        //receive video frame
-        while(ret>=0){
-            ret = avcodec_receive_frame(pCodecCtx, pFrame);
-            if(ret>=0){
+    if(index >= playlist.nb_items)
+        return;
+    item = &playlist.items[index];
+    item->vs = vs;
+    item->prev = &playlist.items[playlist.cur];
+    item->tid = SDL_CreateThread(PrefetchThread, "PrefetchThread", item);
+}
 
-                ret = av_buffersrc_add_frame(c->in_filter, pFrame);
-                if(ret < 0){
-                    fprintf(stderr, "filter error\n");
-                }
-                while((ret = av_buffersink_get_frame_flags(c->out_filter, pFrame, 0))>=0){
+void ItemClose(PlayItem *item){
+    AVPacket packet;
 
-                    fn.frame = pFrame;
-        
-                    //fprintf(stdout, "filtered frame pts = %d\n", pFrame->pts);
-                    ret = queue_frame(&VFQ, &fn);
-                    if(ret<0)
-                        break;
-                }
-            }
+    if(item->tid){
+        SDL_WaitThread(item->tid, NULL);
+        item->tid = NULL;
+    }
+    avcodec_free_context(&item->ACodec.CCtx);
+    avfilter_graph_free(&item->ACodec.filter_graph);
+    avcodec_free_context(&item->VCodec.CCtx);
+    avfilter_graph_free(&item->VCodec.filter_graph);
+    if(item->prefilled){
+        while(packet_queue_nb_packets(&item->APQ) > 0 && packet_queue_get(&item->APQ, &packet) >= 0)
+            av_packet_unref(&packet);
+        while(packet_queue_nb_packets(&item->VPQ) > 0 && packet_queue_get(&item->VPQ, &packet) >= 0)
+            av_packet_unref(&packet);
+        packet_queue_uninit(&item->APQ);
+        packet_queue_uninit(&item->VPQ);
+        item->prefilled = 0;
+    }
+    avformat_close_input(&item->FCtx);
+    if(item->fio){
+        file_io_log(item->fio);
+        file_io_close(&item->fio);
+    }
+}
+
+/* the items both decoders have left are closed */
+void ReleaseItems(VideoState *vs){
+    int i, last = playlist.cur;
+
+    if(vs->has_audio && playlist.audio_item < last)
+        last = playlist.audio_item;
+    if(vs->has_video && playlist.video_item < last)
+        last = playlist.video_item;
+    for(i=0; i<last; i++)
+        if(playlist.items[i].FCtx)
+            ItemClose(&playlist.items[i]);
+}
+
+/*
+ * Switch ReadThread to the next item at the end of the current one,
+ * the item has been opened and prefilled by PrefetchThread already.
+ *   1. item_pkt follows the last packets of the current item, the decoders
+ *      drain and take the decoder contexts of the next item there
+ *   2. the prefilled packets are moved into APQ/VPQ
+ *   3. the timeline goes on from the end of the current item
+ */
+int NextItem(VideoState *vs, int64_t *end){
+    AVFormatContext *pFormatCtx = vs->FCtx;
+    PlayItem *item;
+    AVPacket pkt;
+    int64_t start, next_start;
+    int next;
+
+    for(next = playlist.cur+1; next < playlist.nb_items; next++){
+        item = &playlist.items[next];
+        if(!item->tid && !item->ready){
+            //the item before was skipped, nobody prefetched this one
+            item->vs = vs;
+            item->prev = &playlist.items[playlist.cur];
+            PrefetchThread(item);
+        }else if(item->tid){
+            SDL_WaitThread(item->tid, NULL);
+            item->tid = NULL;
         }
-        av_packet_unref(&packet);
+        if(item->ready > 0)
+            break;
+        fprintf(stderr, "skip %s\n", item->filename);
+        ItemClose(item);
     }
+    if(next >= playlist.nb_items)
+        return -1;
 
-    av_frame_free(&pFrame);
-    avcodec_close(pCodecCtx);
-    avfilter_graph_free(&(c->filter_graph));
-    
-    fprintf(stdout, "VideoThread exit\n");
+    start = pFormatCtx->start_time != AV_NOPTS_VALUE ? pFormatCtx->start_time : 0;
+    if(*end == AV_NOPTS_VALUE)
+        *end = pFormatCtx->duration != AV_NOPTS_VALUE ? start + pFormatCtx->duration : start;
+    next_start = item->FCtx->start_time != AV_NOPTS_VALUE ? item->FCtx->start_time : 0;
+
+    vs->loop_offset += *end - next_start;
+    vs->item_offset = vs->loop_offset;
+    vs->loop_duration = 0;
+
+    pkt = item_pkt;
+    pkt.pts = vs->loop_offset;
+    pkt.pos = next;
+    if(vs->has_audio)
+        packet_queue_put(&APQ, &pkt);
+    if(vs->has_video)
+        packet_queue_put(&VPQ, &pkt);
+
+    *end = AV_NOPTS_VALUE;
+    while(packet_queue_nb_packets(&item->APQ) > 0 && packet_queue_get(&item->APQ, &pkt) >= 0){
+        TrackEnd(item->FCtx, &pkt, end);
+        if(packet_queue_put(&APQ, &pkt) < 0)
+            av_packet_unref(&pkt);
+    }
+    while(packet_queue_nb_packets(&item->VPQ) > 0 && packet_queue_get(&item->VPQ, &pkt) >= 0){
+        TrackEnd(item->FCtx, &pkt, end);
+        if(packet_queue_put(&VPQ, &pkt) < 0)
+            av_packet_unref(&pkt);
+    }
+
+    playlist.cur = next;
+    vs->FCtx = item->FCtx;
+    vs->AStream = item->ACodec.stream;
+    vs->VStream = item->VCodec.stream;
+    fprintf(stdout, "playlist item %d: %s\n", next, item->filename);
+
+    StartPrefetch(vs, next+1);
     return 0;
 }
 
-int AudioThread(void *arg){
-    fprintf(stdout, "AudioThread start\n");
-    Codec *c = arg;
-    AVCodecContext *pCodecCtx = c->CCtx;
-    AVPacket packet;
-    AVFrame *pFrame = NULL;
-    void *ptr;
-    int write_size, left_size;
-    unsigned int audio_sleep;
-    int ret;
+/* open the decoder and filter graph of the new audio track while the old one plays */
+int AudioTrackThread(void *arg){
+    VideoState *vs = arg;
+
+    memset(&atrack_codec, 0, sizeof(Codec));
+    atrack_codec.vs = vs;
+    atrack_codec.out_sample_rate = playlist.items[0].ACodec.out_sample_rate;
+    atrack_codec.out_channels = playlist.items[0].ACodec.out_channels;
+    atrack_codec.out_channel_layout = playlist.items[0].ACodec.out_channel_layout;
+    atrack_codec.out_frame_size = playlist.items[0].ACodec.out_frame_size;
+    atrack_codec.out_sample_fmt = playlist.items[0].ACodec.out_sample_fmt;
+    if(CodecOpen(vs->FCtx, vs->atrack_stream, &atrack_codec) != 0){
+        avcodec_free_context(&atrack_codec.CCtx);
+        SDL_AtomicSet(&vs->atrack_ready, -1);
+        return -1;
+    }
+    atrack_codec.filters = FilterWanted(&audio_filters);
+    AudioFilterInit(&atrack_codec);
+    LogAudioConversion(&atrack_codec);
+    SDL_AtomicSet(&vs->atrack_ready, 1);
+    return 0;
+}
 
-    pFrame = av_frame_alloc();
-    if(pFrame == NULL){
-        fprintf(stderr, "cannot get buffer of frame\n");
+/*
+ * Switch to the audio track opened by AudioTrackThread, video goes on untouched:
+ *   1. the demuxer takes the new stream instead of the old one and seeks back to
+ *      the audio clock, the video packets queued already are skipped when read again
+ *   2. APQ is flushed and atrack_pkt makes AudioThread take the new decoder,
+ *      drop the queued frames and start the new track at the clock position
+ */
+int DoAudioSwitch(VideoState *vs){
+    AVFormatContext *pFormatCtx = vs->FCtx;
+    int64_t target;
+    AVPacket pkt;
+
+    target = get_audio_clock(&vs->sc) - vs->loop_offset + ATRACK_LEAD;
+    DiscardStreams(pFormatCtx, atrack_codec.stream, vs->has_video ? vs->VStream : -1);
+    if(avformat_seek_file(pFormatCtx, -1, INT64_MIN, target, target, 0) < 0){
+        fprintf(stderr, "seek for audio track switch failed\n");
+        DiscardStreams(pFormatCtx, vs->AStream, vs->has_video ? vs->VStream : -1);
         return -1;
     }
-    
 
-    audio_sleep = (unsigned int)((240*DEF_SAMPLES/4)/(pCodecCtx->sample_rate)/2*1000.0);
+    vs->AStream = atrack_codec.stream;
+    playlist.items[playlist.cur].ACodec.stream = atrack_codec.stream;
+    wanted_stream[AVMEDIA_TYPE_AUDIO] = atrack_codec.stream;
 
-    //Read from stream into packet
-    while(1){
-        ret = packet_queue_get(&APQ, &packet);
-        if(ret<0)
-            break;
+    packet_queue_flush(&APQ);
+    pkt = atrack_pkt;
+    pkt.pts = target;
+    pkt.pos = vs->loop_offset;
+    SDL_AtomicSet(&vs->atrack_pending, 1);
+    packet_queue_put(&APQ, &pkt);
+    return 0;
+}
 
-        ret = avcodec_send_packet(pCodecCtx, &packet);
+/*
+ * Step of the audio track switch in ReadThread, nothing here blocks reading.
+ * The switch waits until AudioThread has passed the loop/item boundaries and seeks queued,
+ * APQ can only be flushed when it holds no marker. Return 1 when switched.
+ */
+int AudioSwitchStep(VideoState *vs){
+    AVFormatContext *pFormatCtx = vs->FCtx;
+    int i, stream = -1, ready;
+
+    if(!vs->atrack_tid){
+        if(vs->trick_speed || read_finished){
+            fprintf(stdout, "audio track cannot be switched now\n");
+            vs->atrack_req = 0;
+            vs->atrack_request_time = 0;
+            return 0;
+        }
+        if(vs->audio_offset != vs->loop_offset || vs->audio_serial != vs->seek_serial)
+            return 0;
 
-        while(ret>=0){
-            //Decode audio frame
-            ret = avcodec_receive_frame(pCodecCtx, pFrame);
-            
-            if(ret >=0){
-                ret = av_buffersrc_add_frame(c->in_filter, pFrame);
-                if(ret < 0){
-                    fprintf(stderr, "filter error\n");
-                }
-                while((ret = av_buffersink_get_frame_flags(c->out_filter, pFrame, 0))>=0){
-                    //origin pFrame->linesize[0] = 8192
-                    //filtered pFrame->linesize[0] = 4224
-                    //why ?
-                    ptr = pFrame->data[0];
-                    left_size = pFrame->nb_samples * pFrame->channels * 2;
-
-                    while(left_size){
-                        write_size = RB_PushData(&ring_buffer, ptr, left_size);
-                        if(write_size == 0)
-                            SDL_Delay(audio_sleep);
-                        else if(write_size<0)
-                            break;
-                        ptr += write_size;
-                        left_size -= write_size;
-                    }
-                }
+        for(i=1; i<pFormatCtx->nb_streams; i++){
+            if(pFormatCtx->streams[(vs->AStream+i)%pFormatCtx->nb_streams]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO){
+                stream = (vs->AStream+i)%pFormatCtx->nb_streams;
+                break;
             }
         }
-        av_packet_unref(&packet);
+        if(stream < 0){
+            fprintf(stdout, "no other audio track\n");
+            vs->atrack_req = 0;
+            vs->atrack_request_time = 0;
+            return 0;
+        }
+        vs->atrack_stream = stream;
+        SDL_AtomicSet(&vs->atrack_ready, 0);
+        vs->atrack_tid = SDL_CreateThread(AudioTrackThread, "AudioTrackThread", vs);
+        return 0;
     }
 
-    av_free(pFrame);
-    avcodec_close(pCodecCtx);
-    avfilter_graph_free(&(c->filter_graph));
+    ready = SDL_AtomicGet(&vs->atrack_ready);
+    if(!ready)
+        return 0;
+    SDL_WaitThread(vs->atrack_tid, NULL);
+    vs->atrack_tid = NULL;
+    vs->atrack_req = 0;
+
+    //the item, loop or position changed while the decoder was opened
+    if(ready < 0 || atrack_codec.FCtx != vs->FCtx || read_finished || vs->trick_speed
+            || vs->audio_offset != vs->loop_offset || vs->audio_serial != vs->seek_serial
+            || DoAudioSwitch(vs) < 0){
+        fprintf(stderr, "switch to audio stream %d failed\n", vs->atrack_stream);
+        avcodec_free_context(&atrack_codec.CCtx);
+        avfilter_graph_free(&atrack_codec.filter_graph);
+        vs->atrack_request_time = 0;
+        return 0;
+    }
+    return 1;
+}
 
-    fprintf(stdout, "AudioThread exit\n");
-    return 0;
+/* duration of one frame in the time base of the stream, for the packets without duration */
+int64_t FramePacketDuration(AVFormatContext *pFormatCtx, int stream){
+    AVStream *st;
+    AVRational frame_rate;
+
+    if(stream < 0)
+        return 0;
+    st = pFormatCtx->streams[stream];
+    frame_rate = av_guess_frame_rate(pFormatCtx, st, NULL);
+    if(frame_rate.num <= 0 || frame_rate.den <= 0)
+        return 0;
+    return av_rescale_q(1, av_inv_q(frame_rate), st->time_base);
 }
 
 int ReadThread(void *arg){
@@ -470,31 +2440,98 @@ int ReadThread(void *arg){
     int VideoStream = pVS->VStream;
     int audio_available = pVS->has_audio;
     int video_available = pVS->has_video;
+    int64_t start = pFormatCtx->start_time != AV_NOPTS_VALUE ? pFormatCtx->start_time : 0;
+    int64_t loop_end = AV_NOPTS_VALUE;
+    int64_t video_last_dts = AV_NOPTS_VALUE, video_skip_dts = AV_NOPTS_VALUE;
+    int64_t frame_duration = FramePacketDuration(pFormatCtx, VideoStream);
     int ret;
 
     AVPacket packet;
-    while(1){
+    while(!pVS->abort_request){
+        if(playlist.cur > 0)
+            ReleaseItems(pVS);
+
+        if(pVS->seek_req){
+            DoSeek(pVS);
+            pVS->seek_req = 0;
+            video_skip_dts = AV_NOPTS_VALUE;
+        }
+
+        if(pVS->trick_req){
+            DoTrickChange(pVS);
+            video_skip_dts = AV_NOPTS_VALUE;
+        }
+
+        if(pVS->atrack_req && audio_available && AudioSwitchStep(pVS) > 0)
+            video_skip_dts = video_last_dts;
+
+        if(pVS->trick_speed){
+            if(packet_queue_nb_packets(&VPQ) >= TRICK_QUEUE){
+                SDL_Delay(5);
+            }else if(TrickStep(pVS) < 0){
+                pVS->trick_req_speed = 0;
+                DoTrickChange(pVS);
+            }
+            continue;
+        }
+
         ret = av_read_frame(pFormatCtx, &packet);
         if(ret>=0){
-            if(packet.stream_index==AudioStream){
-                if(audio_available)
-                    ret = packet_queue_put(&APQ, &packet);
-            }else if(packet.stream_index==VideoStream){
-                if(video_available)
-                    ret = packet_queue_put(&VPQ, &packet);
+            AudioStream = pVS->AStream;
+            if(audio_available && packet.stream_index==AudioStream){
+                if(live_mode)
+                    LiveArrival(&pVS->live_audio, pFormatCtx->streams[AudioStream], &packet);
+                TrackEnd(pFormatCtx, &packet, &loop_end);
+                ret = packet_queue_put(&APQ, &packet);
+            }else if(video_available && packet.stream_index==VideoStream){
+                //read again after the seek of an audio track switch, queued already
+                if(video_skip_dts != AV_NOPTS_VALUE && packet.dts != AV_NOPTS_VALUE && packet.dts <= video_skip_dts){
+                    av_packet_unref(&packet);
+                    continue;
+                }
+                video_skip_dts = AV_NOPTS_VALUE;
+                if(packet.dts != AV_NOPTS_VALUE)
+                    video_last_dts = packet.dts;
+                //the buffered duration is counted with the packet durations
+                if(packet.duration <= 0)
+                    packet.duration = frame_duration;
+                if(live_mode)
+                    LiveArrival(&pVS->live_video, pFormatCtx->streams[VideoStream], &packet);
+                TrackEnd(pFormatCtx, &packet, &loop_end);
+                ret = packet_queue_put(&VPQ, &packet);
+            }else{
+                DiscardPacket(pVS, &packet);
             }
             if(ret<0)
                 break;
         }else{
-            //read finished
-            //av_usleep(1000000);
-            packet.data=NULL;
-            packet.size=0;
-            if(audio_available)
-                packet_queue_put(&APQ, &packet);
-            if(video_available)
-                packet_queue_put(&VPQ, &packet);
-            break;
+            if(loop_enabled && !read_finished && loop_end != AV_NOPTS_VALUE
+                    && LoopBack(pVS, loop_end - start) >= 0){
+                video_skip_dts = AV_NOPTS_VALUE;
+                continue;
+            }
+
+            if(!loop_enabled && !read_finished && NextItem(pVS, &loop_end) >= 0){
+                pFormatCtx = pVS->FCtx;
+                AudioStream = pVS->AStream;
+                VideoStream = pVS->VStream;
+                start = pFormatCtx->start_time != AV_NOPTS_VALUE ? pFormatCtx->start_time : 0;
+                video_last_dts = video_skip_dts = AV_NOPTS_VALUE;
+                frame_duration = FramePacketDuration(pFormatCtx, VideoStream);
+                continue;
+            }
+
+            //read finished, drain the decoders once and wait for seeking back
+            if(!read_finished){
+                packet.data=NULL;
+                packet.size=0;
+                if(audio_available)
+                    packet_queue_put(&APQ, &packet);
+                if(video_available)
+                    packet_queue_put(&VPQ, &packet);
+                read_finished = 1;
+            }
+            SDL_Delay(10);
         }
     }
 
@@ -512,8 +2549,6 @@ int ReadThread(void *arg){
  *              Codec struct for combination
  * ********************************************************/
 int CodecInit(int type, AVFormatContext *pFormatCtx, Codec *c){
-    AVCodecContext *pCodecCtx = NULL;
-    AVCodec *pCodec = NULL;
     int audioVideo = -1;
     int Stream = -1;
 
@@ -533,7 +2568,7 @@ int CodecInit(int type, AVFormatContext *pFormatCtx, Codec *c){
      * 5. Open the codec
      */
     Stream=-1;
-    Stream = av_find_best_stream(pFormatCtx, type, -1, -1, NULL, 0);
+    Stream = SelectStream(pFormatCtx, type);
     
     if(Stream<0){
         if(audioVideo == 1)
@@ -547,6 +2582,15 @@ int CodecInit(int type, AVFormatContext *pFormatCtx, Codec *c){
         fprintf(stdout, "stream %d is %s\n", Stream, audioVideo?"video":"audio");
     }
 
+    return CodecOpen(pFormatCtx, Stream, c);
+}
+
+/* open the decoder of the given stream into c */
+int CodecOpen(AVFormatContext *pFormatCtx, int Stream, Codec *c){
+    AVCodecContext *pCodecCtx = NULL;
+    AVCodec *pCodec = NULL;
+    int type = pFormatCtx->streams[Stream]->codecpar->codec_type;
+
     pCodecCtx = avcodec_alloc_context3(NULL);
 
     if(avcodec_parameters_to_context(pCodecCtx, pFormatCtx->streams[Stream]->codecpar)<0){
@@ -562,8 +2606,10 @@ int CodecInit(int type, AVFormatContext *pFormatCtx, Codec *c){
         fprintf(stdout, "codec id is %d\n", pCodecCtx->codec_id);
     }
 
-    pCodecCtx->thread_count = 4;
-    pCodecCtx->thread_type = FF_THREAD_SLICE;
+    thread_config_apply(pCodecCtx, pCodec, &thread_config);
+    if(type == AVMEDIA_TYPE_VIDEO)
+        frame_pool_attach(&frame_pool, pCodecCtx);
+    ApplyLiveFlags(pCodecCtx);
 
     if(avcodec_open2(pCodecCtx, pCodec, NULL)<0){
         fprintf(stderr, "open codec failed\n");
@@ -578,8 +2624,16 @@ int CodecInit(int type, AVFormatContext *pFormatCtx, Codec *c){
     return 0;
 }
 
+/* live mode sizes the packet queues by media duration, packet_duration in usecond */
+int LiveQueueSize(int64_t packet_duration){
+    if(packet_duration <= 0)
+        packet_duration = 10000;
+    return FFMAX(LIVE_QUEUE_MS*1000/packet_duration, 2);
+}
+
 int AudioInit(AVFormatContext *pFormatCtx, Codec *pACodec, SDL_Output *pOutput, VideoState *pVS) {
-    int ret = 0;
+    AVCodecParameters *par;
+    int ret = 0, frame_size;
 
     if(CodecInit(AVMEDIA_TYPE_AUDIO, pFormatCtx, pACodec)!=0){
         pVS->has_audio = 0;
@@ -587,25 +2641,67 @@ int AudioInit(AVFormatContext *pFormatCtx, Codec *pACodec, SDL_Output *pOutput,
     }else{
         pVS->has_audio = 1;
     }
-    AudioFilterInit(pACodec);
-    
-    VideoStateSetForComputingPTS(pVS, pACodec->CCtx->sample_rate, pACodec->CCtx->channels);
+    pACodec->vs = pVS;
    
-    ret = InitSDLAudioOutput(pOutput, pVS, pACodec->CCtx->sample_rate, pACodec->CCtx->channels);
+    //the device is opened first, the filter graph converts to its format and cuts frames of one callback
+    ret = InitSDLAudioOutput(pOutput, pVS, pACodec->CCtx->sample_rate, pACodec->CCtx->channels, pACodec->CCtx->sample_fmt);
     if(ret != 0){
         fprintf(stderr, "init SDL output error:%s\n", SDL_GetError());
         UninitSDLAudioOutput(pOutput);
         return -1;
     }
+    pVS->audio_dev = pOutput->audio_dev;
+    pVS->audio_silence = pOutput->audio_silence;
+    pVS->audio_frame_bytes = av_get_bytes_per_sample(pOutput->audio_sample_fmt)*pOutput->audio_channels;
+    pVS->audio_frame_samples = pOutput->audio_samples;
+    pVS->audio_channels = pOutput->audio_channels;
+    pVS->audio_sample_fmt = pOutput->audio_sample_fmt;
+    if(audio_conceal){
+        pVS->audio_last_frame = av_malloc(pVS->audio_frame_bytes);
+        pVS->audio_silence_frame = av_malloc(pVS->audio_frame_bytes);
+        if(pVS->audio_last_frame && pVS->audio_silence_frame){
+            memset(pVS->audio_last_frame, pVS->audio_silence, pVS->audio_frame_bytes);
+            memset(pVS->audio_silence_frame, pVS->audio_silence, pVS->audio_frame_bytes);
+        }else{
+            av_freep(&pVS->audio_last_frame);
+            av_freep(&pVS->audio_silence_frame);
+        }
+    }
+    VideoStateSetForComputingPTS(pVS, pOutput->audio_freq, pOutput->audio_channels,
+            av_get_bytes_per_sample(pOutput->audio_sample_fmt));
+
+    pACodec->out_sample_rate = pOutput->audio_freq;
+    pACodec->out_channels = pOutput->audio_channels;
+    pACodec->out_channel_layout = pOutput->audio_channel_layout;
+    pACodec->out_sample_fmt = pOutput->audio_sample_fmt;
+    pACodec->out_frame_size = pOutput->audio_samples;
+    pACodec->filters = FilterWanted(&audio_filters);
+    LogAudioConversion(pACodec);
+    AudioFilterInit(pACodec);
+    frame_queue_init(&AFQ, "audio frame queue");
+    //AFQ holds what the target leaves over from the device buffer
+    frame_queue_limit(&AFQ, audio_buffer_open(&audio_buffer, pOutput->audio_freq, pOutput->audio_samples));
    
-    packet_queue_init(&APQ, 500, "audio queue");
-    RB_Init(&ring_buffer, 240*DEF_SAMPLES);
+    if(live_mode){
+        //packets of frame_size samples
+        par = pFormatCtx->streams[pACodec->stream]->codecpar;
+        frame_size = par->frame_size > 0 ? par->frame_size : 1024;
+        packet_queue_init(&APQ, LiveQueueSize(av_rescale(frame_size, AV_TIME_BASE, pACodec->CCtx->sample_rate)), "audio queue");
+        pVS->live_buf_size = 2*pOutput->audio_samples*pVS->audio_frame_bytes;
+        pVS->live_buf = av_malloc(pVS->live_buf_size);
+        fprintf(stdout, "live: %d audio packets, %d frames of %d samples queued\n",
+                APQ.max_packets, AFQ.max_nb, pOutput->audio_samples);
+    }else{
+        packet_queue_init(&APQ, 500, "audio queue");
+    }
 
     audio_tid   = SDL_CreateThread(AudioThread, "AudioThread", pACodec);
+    if(audio_push_mode){
+        audio_push_init(&audio_push, pOutput->audio_dev, pOutput->audio_samples*pVS->audio_frame_bytes, pVS->usecond_per_byte);
+        audio_push_tid = SDL_CreateThread(AudioPushThread, "AudioPushThread", pVS);
+    }
     
-    //start to play audio
-    SDL_PauseAudioDevice(pOutput->audio_dev, 0);
-
+    //audio is started by the buffering controller when enough is buffered
     return 0;
 }
 
@@ -614,6 +2710,7 @@ int VideoInit(AVFormatContext *pFormatCtx, Codec *pVCodec, SDL_Output *pOutput,
     
     VideoStateInit(pVS);
 
+    frame_pool_init(&frame_pool);
     if(CodecInit(AVMEDIA_TYPE_VIDEO, pFormatCtx, pVCodec)!=0)
         pVS->has_video = 0;
     else
@@ -634,6 +2731,11 @@ int VideoInit(AVFormatContext *pFormatCtx, Codec *pVCodec, SDL_Output *pOutput,
         pVS->time_base = tb.num*1000000.0f/(double)tb.den;
         fprintf(stdout, "timebase = %lf, %lf\n", pVS->time_base, av_q2d(tb));
     
+        pVCodec->vs = pVS;
+        pVCodec->out_width = pVCodec->CCtx->width;
+        pVCodec->out_height = pVCodec->CCtx->height;
+        pVCodec->out_pix_fmt = pVCodec->CCtx->pix_fmt;
+        pVCodec->filters = FilterWanted(&video_filters);
         VideoFilterInit(pVCodec);
     
         //Init SDL
@@ -644,8 +2746,16 @@ int VideoInit(AVFormatContext *pFormatCtx, Codec *pVCodec, SDL_Output *pOutput,
             return -1;
         }
     
-        packet_queue_init(&VPQ, 300, "video queue");
-        frame_queue_init(&VFQ, "video frame queue");
+        if(live_mode){
+            packet_queue_init(&VPQ, LiveQueueSize(av_rescale_q(FramePacketDuration(pFormatCtx, pVCodec->stream),
+                            tb, AV_TIME_BASE_Q)), "video queue");
+            frame_queue_init(&VFQ, "video frame queue");
+            frame_queue_limit(&VFQ, LIVE_FRAMES);
+            fprintf(stdout, "live: %d video packets, %d frames queued\n", VPQ.max_packets, VFQ.max_nb);
+        }else{
+            packet_queue_init(&VPQ, 300, "video queue");
+            frame_queue_init(&VFQ, "video frame queue");
+        }
   
         video_tid   = SDL_CreateThread(VideoThread, "VideoThread", pVCodec);
     } else {
@@ -673,6 +2783,13 @@ int Display(SDL_Output *Output, VideoState *vs){
 
     //video display loop
     frameNode.frame = vs->cur_frame;
+
+    //the frame waiting for display is out of date after seeking
+    if(!vs->last_frame_displayed && !vs->is_first_frame && vs->frame_serial != vs->seek_serial){
+        av_frame_unref(vs->cur_frame);
+        vs->last_frame_displayed = 1;
+    }
+
     if(vs->last_frame_displayed||vs->is_first_frame){
         if(read_finished && !frame_nb(&VFQ))
             return 0;
@@ -680,16 +2797,36 @@ int Display(SDL_Output *Output, VideoState *vs){
         if(ret<0)
             return -1;
 
-        memcpy(Output->YPlane, vs->cur_frame->data[0], Output->buf_size);
-        memcpy(Output->UPlane, vs->cur_frame->data[1], Output->buf_size/4);
-        memcpy(Output->VPlane, vs->cur_frame->data[2], Output->buf_size/4);
+        if(frameNode.serial != vs->seek_serial){
+            av_frame_unref(vs->cur_frame);
+            vs->sleep_time = 0;
+            return 0;
+        }
+        if(frameNode.serial != vs->frame_serial){
+            //the first frame after seeking is displayed at once
+            vs->frame_serial = frameNode.serial;
+            vs->is_first_frame = 1;
+        }
 
         vs->frame_last_pts = vs->frame_cur_pts;
         vs->frame_cur_pts = vs->cur_frame->pts * vs->time_base;
         pts_delay = vs->frame_cur_pts - vs->frame_last_pts;
-        if(vs->has_audio) {
+        if(frameNode.item != vs->frame_item){
+            vs->frame_item = frameNode.item;
+            vs->item_switched = 1;
+            vs->item_pts_delay = pts_delay;
+        }
+        if(vs->trick_speed){
+            //stills are paced by their distance in media time at trick speed
+            pts_delay = FFABS(pts_delay)/FFABS(vs->trick_speed);
+            if(pts_delay > TRICK_MAX_STILL)
+                pts_delay = TRICK_MAX_STILL;
+        }else if(vs->has_audio) {
             set_acceptable_delay(&vs->sc, pts_delay);
             pts_delay = adjust_delay(&vs->sc, pts_delay);
+        }else if(live_mode && vs->live_video.latency > live_target){
+            //no audio clock to follow, catch up at the same speed as audio would
+            pts_delay -= pts_delay/LIVE_SPEEDUP;
         }
         vs->cur_display_time = vs->last_display_time + pts_delay;
 
@@ -700,10 +2837,28 @@ int Display(SDL_Output *Output, VideoState *vs){
     if(!vs->is_first_frame){
         delay = vs->cur_display_time - time;
 
+        //far behind in live mode, drop the frame while a newer one is decoded already
+        if(delay <= 0 && live_mode && frame_nb(&VFQ) > 0 && vs->live_video.last_arrival
+                && LiveLatency(&vs->live_video, time, vs->frame_cur_pts) > live_target + LIVE_DROP_MARGIN){
+            av_frame_unref(vs->cur_frame);
+            vs->last_frame_displayed = 1;
+            vs->live_video.dropped++;
+            vs->sleep_time = 0;
+            return 0;
+        }
+
         if(delay <= 0){
+            //gap = wall time between the last frame of an item and the first of the next, beyond the frame duration
+            if(vs->item_switched){
+                fprintf(stdout, "playlist item %d: transition gap %lld us\n", vs->frame_item,
+                        (long long)(time - vs->last_display_time - vs->item_pts_delay));
+                vs->item_switched = 0;
+            }
             vs->last_display_time = time;
             set_video_pts(&vs->sc, vs->frame_cur_pts);
-            DisplayFrame(Output);
+            DisplayFrame(Output, vs->cur_frame);
+            if(live_mode)
+                LivePresent(&vs->live_video, av_gettime_relative(), vs->frame_cur_pts);
             av_frame_unref(vs->cur_frame);
             vs->last_frame_displayed = 1;
             vs->sleep_time = 0;
@@ -715,37 +2870,410 @@ int Display(SDL_Output *Output, VideoState *vs){
     }else{
         vs->last_display_time = time;
         set_video_pts(&vs->sc, vs->frame_cur_pts);
-        DisplayFrame(Output);
+        DisplayFrame(Output, vs->cur_frame);
+        if(live_mode)
+            LivePresent(&vs->live_video, av_gettime_relative(), vs->frame_cur_pts);
         av_frame_unref(vs->cur_frame);
         vs->last_frame_displayed = 1;
         vs->is_first_frame = 0;
+        vs->item_switched = 0;
         vs->sleep_time = 0;
+        ReportFirstFrame("frame");
+        if(vs->seek_request_time){
+            fprintf(stdout, "seek to %lf, landed on %lf, latency %lld ms\n", vs->seek_target/(double)AV_TIME_BASE,
+                    vs->frame_cur_pts/(double)AV_TIME_BASE, (long long)((time-vs->seek_request_time)/1000));
+            vs->seek_request_time = 0;
+        }
     }
     return 0;
 }
 
+/* position of the frame displayed in the media file, the timeline goes on over the loops and items */
+int64_t MediaPosition(VideoState *vs){
+    AVFormatContext *pFormatCtx = vs->FCtx;
+    int64_t start = pFormatCtx->start_time != AV_NOPTS_VALUE ? pFormatCtx->start_time : 0;
+    int64_t pos;
+
+    pos = vs->has_video ? vs->frame_cur_pts : get_audio_pts(&vs->sc);
+    pos -= vs->item_offset;
+    if(pos < start)
+        pos = start;
+    if(vs->loop_duration > 0 && pos >= start + vs->loop_duration)
+        pos = start + (pos - start) % vs->loop_duration;
+    return pos;
+}
+
+/*
+ * Seek relative to the current position, the seek itself is done in ReadThread.
+ * Packet queues are flushed here in case ReadThread is waiting for space in them.
+ */
+void RequestSeek(VideoState *vs, int64_t incr, int flags){
+    AVFormatContext *pFormatCtx = vs->FCtx;
+    int64_t pos, target, start, end;
+
+    if(vs->seek_req)
+        pos = vs->seek_target;
+    else
+        pos = MediaPosition(vs);
+
+    start = pFormatCtx->start_time != AV_NOPTS_VALUE ? pFormatCtx->start_time : 0;
+    end = pFormatCtx->duration != AV_NOPTS_VALUE ? start + pFormatCtx->duration : INT64_MAX;
+
+    target = pos + incr;
+    if(target < start)
+        target = start;
+    if(target >= end){
+        fprintf(stdout, "seek to %lf is beyond the end\n", target/(double)AV_TIME_BASE);
+        return;
+    }
+
+    vs->seek_target = target;
+    vs->seek_flags = flags;
+    vs->seek_request_time = av_gettime_relative();
+    vs->seek_req = 1;
+    buffer_seek(&buffering);
+
+    //a pending atrack_pkt is kept, AudioThread drains APQ anyway
+    if(vs->has_audio && !SDL_AtomicGet(&vs->atrack_pending))
+        packet_queue_flush(&APQ);
+    if(vs->has_video)
+        packet_queue_flush(&VPQ);
+}
+
+/* the audio track is switched by ReadThread, video keeps playing */
+void RequestAudioTrack(VideoState *vs){
+    if(!vs->has_audio || vs->atrack_req)
+        return;
+    vs->atrack_request_time = av_gettime_relative();
+    vs->atrack_req = 1;
+}
+
+/* the decoder thread builds the graph and swaps it */
+void RequestFilterGraph(FilterSwitch *fs){
+    if(!fs->nb)
+        return;
+    fs->cur = (fs->cur + 1) % (fs->nb + 1);
+    fs->failed = -1;
+    fs->request_time = av_gettime_relative();
+    fprintf(stdout, "%s filter graph %s requested\n", fs->kind, FilterWanted(fs) ? FilterWanted(fs) : "none");
+}
+
+/* trick play is done in ReadThread, wake it up in case it is waiting for space in the queues */
+void RequestTrickPlay(VideoState *vs, int speed){
+    vs->trick_req_speed = speed;
+    vs->trick_req = 1;
+    buffer_seek(&buffering);
+
+    //a pending atrack_pkt is kept, AudioThread drains APQ anyway
+    if(vs->has_audio && !SDL_AtomicGet(&vs->atrack_pending))
+        packet_queue_flush(&APQ);
+    if(vs->has_video)
+        packet_queue_flush(&VPQ);
+}
+
+/*
+ * left/right: seek -/+ SEEK_STEP_SHORT
+ * down/up   : seek -/+ SEEK_STEP_LONG
+ * with shift the seek is frame accurate, otherwise it lands on the nearest keyframe
+ * f/b       : fast-forward/rewind with keyframes, 8x, 16x, 32x
+ * n         : back to normal play
+ * a         : next audio track
+ * v/e       : next -vf/-af filter graph, none after the last one
+ */
+void HandleKeyDown(VideoState *vs, SDL_Keysym *key){
+    int flags = (key->mod & KMOD_SHIFT) ? SEEK_ACCURATE : 0;
+    int speed = vs->trick_req ? vs->trick_req_speed : vs->trick_speed;
+
+    switch(key->sym){
+    case SDLK_LEFT :
+        RequestSeek(vs, -SEEK_STEP_SHORT, flags);
+        break;
+    case SDLK_RIGHT :
+        RequestSeek(vs, SEEK_STEP_SHORT, flags);
+        break;
+    case SDLK_DOWN :
+        RequestSeek(vs, -SEEK_STEP_LONG, flags);
+        break;
+    case SDLK_UP :
+        RequestSeek(vs, SEEK_STEP_LONG, flags);
+        break;
+    case SDLK_f :
+        RequestTrickPlay(vs, speed > 0 ? FFMIN(speed*2, TRICK_MAX_SPEED) : TRICK_MIN_SPEED);
+        break;
+    case SDLK_b :
+        RequestTrickPlay(vs, speed < 0 ? FFMAX(speed*2, -TRICK_MAX_SPEED) : -TRICK_MIN_SPEED);
+        break;
+    case SDLK_n :
+        RequestTrickPlay(vs, 0);
+        break;
+    case SDLK_a :
+        RequestAudioTrack(vs);
+        break;
+    case SDLK_v :
+        RequestFilterGraph(&video_filters);
+        break;
+    case SDLK_e :
+        RequestFilterGraph(&audio_filters);
+        break;
+    default :
+        break;
+    }
+}
+
+/* the smallest buffered duration of the streams playing in usecond, a full queue has enough */
+int64_t BufferedDuration(VideoState *vs){
+    AVFormatContext *pFormatCtx = vs->FCtx;
+    int64_t buffered = INT64_MAX, duration;
+
+    if(vs->has_audio && packet_queue_nb_packets(&APQ) < APQ.max_packets){
+        duration = av_rescale_q(packet_queue_duration(&APQ), pFormatCtx->streams[vs->AStream]->time_base, AV_TIME_BASE_Q)
+            + AudioQueuedDuration(vs);
+        buffered = FFMIN(buffered, duration);
+    }
+    if(vs->has_video && packet_queue_nb_packets(&VPQ) < VPQ.max_packets){
+        duration = av_rescale_q(packet_queue_duration(&VPQ), pFormatCtx->streams[vs->VStream]->time_base, AV_TIME_BASE_Q)
+            + frame_nb(&VFQ)*degrade.frame_duration;
+        buffered = FFMIN(buffered, duration);
+    }
+    return buffered;
+}
+
+/*
+ * Hold the clock while buffering: the audio device is paused, no frame is displayed
+ * and the display times are shifted by the time held when playing again.
+ * Trick play and audio track switching drain the queues on purpose, they are not underruns.
+ */
+void UpdateBuffering(VideoState *vs){
+    int was_playing = buffer_playing(&buffering);
+    int64_t buffered, held;
+    int playing;
+
+    buffered = (vs->trick_speed || vs->atrack_request_time) ? INT64_MAX : BufferedDuration(vs);
+    playing = buffer_update(&buffering, buffered, read_finished);
+    if(playing == was_playing)
+        return;
+
+    if(playing){
+        held = av_gettime_relative() - vs->hold_time;
+        vs->cur_display_time += held;
+        vs->last_display_time += held;
+        if(vs->has_audio)
+            SDL_PauseAudioDevice(vs->audio_dev, 0);
+    }else{
+        vs->hold_time = av_gettime_relative();
+        if(vs->has_audio)
+            SDL_PauseAudioDevice(vs->audio_dev, 1);
+    }
+}
+
+/* underruns ended are published, in adaptive mode AFQ takes more frames after them */
+void UpdateAudioBuffer(VideoState *vs){
+    int frames;
+
+    if(!vs->has_audio)
+        return;
+    audio_buffer_publish(&audio_buffer, vs->audio_dev);
+    frames = audio_buffer_update(&audio_buffer);
+    if(frames > 0)
+        frame_queue_limit(&AFQ, frames);
+}
+
+/* latency since the last log, the audio stats are updated by the callback */
+void LiveLog(VideoState *vs){
+    LiveStats *ls;
+
+    vs->live_log_time = av_gettime_relative();
+    if(vs->has_audio)
+        SDL_LockAudioDevice(vs->audio_dev);
+    ls = &vs->live_video;
+    if(ls->count)
+        fprintf(stdout, "live video latency: avg %lld ms, max %lld ms, %lld frames dropped\n",
+                (long long)(ls->sum/ls->count/1000), (long long)(ls->max/1000), (long long)ls->dropped);
+    ls->sum = ls->max = ls->count = 0;
+    ls = &vs->live_audio;
+    if(ls->count)
+        fprintf(stdout, "live audio latency: avg %lld ms, max %lld ms, %lld ms skipped\n",
+                (long long)(ls->sum/ls->count/1000), (long long)(ls->max/1000),
+                (long long)(ls->dropped*vs->audio_frame_bytes*vs->usecond_per_byte/1000));
+    ls->sum = ls->max = ls->count = 0;
+    if(vs->has_audio)
+        SDL_UnlockAudioDevice(vs->audio_dev);
+}
+
+void Usage(const char *name){
+    fprintf(stderr, "Usage: %s [options] mediafile...\n"
+            "  more than one mediafile are played as a gapless playlist\n"
+            "  -threads n              video decoder threads, auto by default\n"
+            "  -thread_type frame|slice video decoder thread type, auto by default\n"
+            "  -latency                prefer low decoder latency to throughput\n"
+            "  -nodegrade              never degrade decoding when falling behind\n"
+            "  -nobypass               send every video frame through the filter graph\n"
+            "  -loop                   loop the first file gaplessly\n"
+            "  -io default|mmap|readahead|uring|uring_direct  how local files are read\n"
+            "  -io_window KB           read-ahead window, mmap prefetch after a seek\n"
+            "  -ast n / -vst n         play audio/video stream n, the best one by default\n"
+            "  -an / -vn               no audio/video\n"
+            "  -fast                   bounded probing, stream info cached in mediafile%s\n"
+            "  -live                   low latency for live input like pipe: or udp://\n"
+            "  -live_target ms         latency live mode catches up to, %d ms by default\n"
+            "  -audio_buffer ms        audio latency, device buffer plus decoded audio, %d ms by default, %d ms live\n"
+            "  -audio_adaptive         start the audio buffer at %d ms, grow it up to -audio_buffer after underruns\n"
+            "  -conceal                fade in and out of the silence of audio underruns\n"
+            "  -audio_push             queue the audio to the device from a thread instead of the audio callback\n"
+            "  -vf graph / -af graph   video/audio filter graph, up to %d of each switched with v/e while playing\n",
+            name, STREAM_CACHE_SUFFIX, LIVE_TARGET/1000, AUDIO_BUFFER_MS, LIVE_AUDIO_MS, AUDIO_BUFFER_START_MS,
+            MAX_FILTER_GRAPHS);
+}
+
+/* return the index of the first media file in argv, -1 for error */
+int ParseOptions(int argc, char *argv[]){
+    int i;
+
+    thread_config_default(&thread_config);
+
+    for(i=1; i<argc && argv[i][0]=='-'; i++){
+        if(!strcmp(argv[i], "-threads") && i+1<argc){
+            thread_config.thread_count = atoi(argv[++i]);
+        }else if(!strcmp(argv[i], "-thread_type") && i+1<argc){
+            i++;
+            if(!strcmp(argv[i], "frame"))
+                thread_config.thread_type = FF_THREAD_FRAME;
+            else if(!strcmp(argv[i], "slice"))
+                thread_config.thread_type = FF_THREAD_SLICE;
+            else
+                return -1;
+        }else if(!strcmp(argv[i], "-latency")){
+            thread_config.mode = DECODE_LATENCY;
+        }else if(!strcmp(argv[i], "-nodegrade")){
+            degrade_enabled = 0;
+        }else if(!strcmp(argv[i], "-nobypass")){
+            filter_bypass = 0;
+        }else if(!strcmp(argv[i], "-loop")){
+            loop_enabled = 1;
+        }else if(!strcmp(argv[i], "-io") && i+1<argc){
+            io_mode = file_io_mode(argv[++i]);
+            if(io_mode < 0)
+                return -1;
+        }else if(!strcmp(argv[i], "-ast") && i+1<argc){
+            wanted_stream[AVMEDIA_TYPE_AUDIO] = atoi(argv[++i]);
+        }else if(!strcmp(argv[i], "-vst") && i+1<argc){
+            wanted_stream[AVMEDIA_TYPE_VIDEO] = atoi(argv[++i]);
+        }else if(!strcmp(argv[i], "-an")){
+            wanted_stream[AVMEDIA_TYPE_AUDIO] = -2;
+        }else if(!strcmp(argv[i], "-vn")){
+            wanted_stream[AVMEDIA_TYPE_VIDEO] = -2;
+        }else if(!strcmp(argv[i], "-fast")){
+            fast_start = 1;
+        }else if(!strcmp(argv[i], "-live")){
+            live_mode = 1;
+            thread_config.mode = DECODE_LATENCY;
+        }else if(!strcmp(argv[i], "-live_target") && i+1<argc){
+            live_target = atoi(argv[++i])*1000LL;
+            if(live_target <= 0)
+                return -1;
+        }else if(!strcmp(argv[i], "-audio_buffer") && i+1<argc){
+            audio_buffer_ms = atoi(argv[++i]);
+            if(audio_buffer_ms <= 0)
+                return -1;
+        }else if(!strcmp(argv[i], "-audio_adaptive")){
+            audio_adaptive = 1;
+        }else if(!strcmp(argv[i], "-conceal")){
+            audio_conceal = 1;
+        }else if(!strcmp(argv[i], "-audio_push")){
+            audio_push_mode = 1;
+        }else if(!strcmp(argv[i], "-vf") && i+1<argc){
+            if(video_filters.nb >= MAX_FILTER_GRAPHS)
+                return -1;
+            video_filters.graphs[video_filters.nb++] = argv[++i];
+        }else if(!strcmp(argv[i], "-af") && i+1<argc){
+            if(audio_filters.nb >= MAX_FILTER_GRAPHS)
+                return -1;
+            audio_filters.graphs[audio_filters.nb++] = argv[++i];
+        }else if(!strcmp(argv[i], "-io_window") && i+1<argc){
+            io_window = atoi(argv[++i])*1024;
+            if(io_window <= 0)
+                return -1;
+        }else{
+            return -1;
+        }
+    }
+
+    return i<argc ? i : -1;
+}
+
 int main(int argc, char *argv[]){
     Codec ACodec, VCodec;
     AVFormatContext *pFormatCtx = NULL;
     SDL_Output Output;
     SDL_Event event;
     VideoState vs;
+    char *filename;
+    int file_index, i;
 
     //Register all codecs and formats
     //av_register_all();
+    open_time = av_gettime_relative();
+    buffer_init(&buffering);
+
+    file_index = ParseOptions(argc, argv);
+    if(file_index < 0){
+        Usage(argv[0]);
+        return -1;
+    }
+    filename = argv[file_index];
+    audio_buffer_init(&audio_buffer, audio_buffer_ms ? audio_buffer_ms : (live_mode ? LIVE_AUDIO_MS : 0), audio_adaptive);
+
+    /*
+     * live input is read as it comes: no cache or index, no loop,
+     * packets are not buffered by the demuxer and probing is short
+     */
+    if(live_mode){
+        io_mode = FILE_IO_DEFAULT;
+        fast_start = 0;
+        loop_enabled = 0;
+        buffer_set_watermarks(&buffering, LIVE_LOW_WATERMARK, LIVE_HIGH_WATERMARK, live_target/2);
+        pFormatCtx = avformat_alloc_context();
+        if(!pFormatCtx)
+            return -1;
+        pFormatCtx->flags |= AVFMT_FLAG_NOBUFFER;
+        pFormatCtx->probesize = LIVE_PROBESIZE;
+        pFormatCtx->max_analyze_duration = LIVE_ANALYZEDURATION;
+    }
+
+    av_init_packet(&flush_pkt);
+    flush_pkt.data = (uint8_t *)&flush_pkt;
+    av_init_packet(&loop_pkt);
+    loop_pkt.data = (uint8_t *)&loop_pkt;
+    av_init_packet(&item_pkt);
+    item_pkt.data = (uint8_t *)&item_pkt;
+    av_init_packet(&atrack_pkt);
+    atrack_pkt.data = (uint8_t *)&atrack_pkt;
+
+    //the first item is opened here, the others by PrefetchThread one by one
+    playlist.nb_items = argc - file_index;
+    playlist.items = av_mallocz_array(playlist.nb_items, sizeof(PlayItem));
+    if(!playlist.items)
+        return -1;
+    for(i=0; i<playlist.nb_items; i++)
+        playlist.items[i].filename = argv[file_index+i];
+    memset(&ACodec, 0, sizeof(Codec));
+    memset(&VCodec, 0, sizeof(Codec));
 
     //Open and get stream info
-    pFormatCtx = avformat_alloc_context();
-    if(avformat_open_input(&pFormatCtx, argv[1], NULL, NULL)!=0){
+    if(file_io_open_input(&pFormatCtx, filename, io_mode, io_window, &playlist.items[0].fio)!=0){
         fprintf(stderr, "open input failed\n");
         return -1;
     }
-    if(avformat_find_stream_info(pFormatCtx, NULL)<0){
+    stream_info_cached = stream_cache_find_stream_info(pFormatCtx, filename, fast_start);
+    if(stream_info_cached<0){
         fprintf(stderr, "find stream info failed\n");
         return -1;
     }
+    //keyframe index of GetInfo for the streams without container index, a live stream has none
+    if(!live_mode)
+        key_index_attach(pFormatCtx, filename);
 
-    av_dump_format(pFormatCtx, 0, argv[1], 0);
+    av_dump_format(pFormatCtx, 0, filename, 0);
     
     VideoInit(pFormatCtx, &VCodec, &Output, &vs);
     AudioInit(pFormatCtx, &ACodec, &Output, &vs);
@@ -754,17 +3282,41 @@ int main(int argc, char *argv[]){
         return -1;
 
     vs.FCtx = pFormatCtx;
-    vs.AStream = ACodec.stream;
-    vs.VStream = VCodec.stream;
+    vs.AStream = vs.has_audio ? ACodec.stream : -1;
+    vs.VStream = vs.has_video ? VCodec.stream : -1;
+    DiscardStreams(pFormatCtx, vs.AStream, vs.VStream);
+
+    //only what PrefetchThread compares with, the contexts belong to the decoder threads
+    playlist.items[0].FCtx = pFormatCtx;
+    playlist.items[0].ACodec = ACodec;
+    playlist.items[0].ACodec.CCtx = NULL;
+    playlist.items[0].ACodec.filter_graph = NULL;
+    playlist.items[0].VCodec = VCodec;
+    playlist.items[0].VCodec.CCtx = NULL;
+    playlist.items[0].VCodec.filter_graph = NULL;
+    playlist.items[0].ready = 1;
+    if(!loop_enabled)
+        StartPrefetch(&vs, 1);
+
     read_tid    = SDL_CreateThread(ReadThread, "ReadThread", &vs);
     
+    vs.hold_time = av_gettime_relative();
+    vs.live_log_time = av_gettime_relative();
     while(1){
-        if(vs.has_video)
+        UpdateBuffering(&vs);
+        UpdateAudioBuffer(&vs);
+        if(live_mode && av_gettime_relative() - vs.live_log_time >= LIVE_LOG_INTERVAL)
+            LiveLog(&vs);
+        if(vs.has_video && buffer_playing(&buffering))
             Display(&Output, &vs);
         else
-            vs.sleep_time = 40000;
+            vs.sleep_time = vs.has_video ? 10000 : 40000;
+        event.type = SDL_FIRSTEVENT;
         SDL_PeepEvents(&event, 1, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT);
         switch(event.type){
+        case SDL_KEYDOWN :
+            HandleKeyDown(&vs, &event.key.keysym);
+            break;
         case SDL_QUIT :
             /* 
              * 1. set queue->abort_request = 1
@@ -773,9 +3325,10 @@ int main(int argc, char *argv[]){
              * 4. close audio device will wait callback thread return;
              * 5. uninit queue
              */
+            vs.abort_request = 1;
             if(vs.has_audio) {
                 packet_queue_abort(&APQ);
-                RB_abort(&ring_buffer);
+                frame_queue_abort(&AFQ);
             }
             if(vs.has_video) {
                 packet_queue_abort(&VPQ);
@@ -785,10 +3338,20 @@ int main(int argc, char *argv[]){
             //abort queue will cause threads break from loop
 
             SDL_WaitThread(read_tid, NULL);
+            if(vs.atrack_tid)
+                SDL_WaitThread(vs.atrack_tid, NULL);
             if(vs.has_video)
                 SDL_WaitThread(video_tid, NULL);
             if(vs.has_audio)
                 SDL_WaitThread(audio_tid, NULL);
+            if(audio_push_tid)
+                SDL_WaitThread(audio_push_tid, NULL);
+            if(live_mode)
+                LiveLog(&vs);
+            if(vs.has_audio)
+                audio_buffer_log(&audio_buffer, AudioQueuedDuration(&vs));
+            if(audio_push_tid)
+                audio_push_log(&audio_push);
             
             UninitSDLVideoOutput(&Output);
             if(vs.has_audio)
@@ -796,7 +3359,7 @@ int main(int argc, char *argv[]){
 
             if(vs.has_audio) {
                 packet_queue_uninit(&APQ);
-                RB_Uninit(&ring_buffer);
+                frame_queue_uninit(&AFQ);
             }
             if(vs.has_video) {
                 packet_queue_uninit(&VPQ);
@@ -807,8 +3370,20 @@ int main(int argc, char *argv[]){
             
             if(vs.has_video)
                 av_free(vs.cur_frame);
-
-            avformat_close_input(&pFormatCtx);
+            av_frame_free(&vs.audio_frame);
+            av_free(vs.audio_last_frame);
+            av_free(vs.audio_silence_frame);
+            frame_pool_uninit(&frame_pool);
+            fprintf(stdout, "%lld packets, %lld bytes of unselected streams discarded\n",
+                    (long long)vs.discarded_packets, (long long)vs.discarded_bytes);
+            buffer_log(&buffering);
+            av_free(vs.live_buf);
+
+            for(i=0; i<playlist.nb_items; i++)
+                ItemClose(&playlist.items[i]);
+            avcodec_free_context(&atrack_codec.CCtx);
+            avfilter_graph_free(&atrack_codec.filter_graph);
+            av_free(playlist.items);
             SDL_Quit();
             exit(0);
             break;
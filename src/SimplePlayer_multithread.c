@@ -12,6 +12,7 @@
 
 #include "Queue.h"
 #include "Clock.h"
+#include "DecoderThreads.h"
 
 #define DEF_SAMPLES 2048
 #define DATATEST 30
@@ -399,6 +400,7 @@ int AudioThread(void *arg){
 int CodecInit(int type, AVFormatContext *pFormatCtx, Codec *c){
     AVCodecContext *pCodecCtx = NULL;
     AVCodec *pCodec = NULL;
+    ThreadConfig tc;
     int audioVideo = -1;
     int Stream = -1;
 
@@ -442,10 +444,8 @@ int CodecInit(int type, AVFormatContext *pFormatCtx, Codec *c){
         fprintf(stdout, "codec id is %d\n", pCodecCtx->codec_id);
     }
     
-    if(type == AVMEDIA_TYPE_VIDEO){
-        pCodecCtx->thread_count = 4;
-        pCodecCtx->thread_type = FF_THREAD_FRAME;
-    }
+    thread_config_default(&tc);
+    thread_config_apply(pCodecCtx, pCodec, &tc);
 
     if(avcodec_open2(pCodecCtx, pCodec, NULL)<0){
         fprintf(stderr, "open codec failed\n");
@@ -0,0 +1,193 @@
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+
+#include <SDL2/SDL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "AudioPush.h"
+
+#define MAX_LOAD 64
+
+/*
+ * Play a tone through the audio callback and through push mode in turn, for the same time each,
+ * with -load n processes spinning on the CPUs to make the audio thread late.
+ *   busy:     time spent making and handing over the audio, the work of the sink
+ *   cpu:      user and system time of the bench, the SDL threads in it, the load processes not
+ *   wakeups:  callbacks, or wakeups of the push loop
+ *   switches: voluntary/involuntary context switches of the bench
+ *   glitches: callbacks coming over 1.5 periods after the last one, or the queue found dry
+ */
+typedef struct BenchSink{
+    int push;
+    int channels;
+    int frame_bytes;
+    float phase;
+    float step;
+    int64_t period;             //usecond of one device buffer
+    int64_t busy;
+    int64_t wakeups;
+    int64_t glitches;
+    int64_t last;
+}BenchSink;
+
+static void ToneFill(BenchSink *s, float *buf, int nb_samples){
+    int i, ch;
+
+    for(i=0; i<nb_samples; i++){
+        for(ch=0; ch<s->channels; ch++)
+            buf[i*s->channels+ch] = 0.2f*sinf(s->phase);
+        s->phase += s->step;
+        if(s->phase > 2*M_PI)
+            s->phase -= 2*M_PI;
+    }
+}
+
+static void BenchCallback(void *userdata, Uint8 *stream, int len){
+    BenchSink *s = userdata;
+    int64_t start = av_gettime_relative();
+
+    if(s->last && start - s->last > s->period*3/2)
+        s->glitches++;
+    s->last = start;
+    s->wakeups++;
+    ToneFill(s, (float *)stream, len/s->frame_bytes);
+    s->busy += av_gettime_relative() - start;
+}
+
+static int64_t CpuTime(struct rusage *r){
+    return r->ru_utime.tv_sec*1000000LL + r->ru_utime.tv_usec + r->ru_stime.tv_sec*1000000LL + r->ru_stime.tv_usec;
+}
+
+static int RunSink(BenchSink *s, int freq, int samples, int seconds){
+    SDL_AudioSpec wanted, obtained;
+    SDL_AudioDeviceID dev;
+    struct rusage r0, r1;
+    AudioPush ap;
+    uint8_t *buf = NULL;
+    int64_t end, start;
+    int64_t pts;
+    int held;
+
+    memset(&wanted, 0, sizeof(wanted));
+    wanted.freq = freq;
+    wanted.format = AUDIO_F32SYS;
+    wanted.channels = s->channels;
+    wanted.samples = samples;
+    wanted.callback = s->push ? NULL : BenchCallback;
+    wanted.userdata = s;
+    dev = SDL_OpenAudioDevice(NULL, 0, &wanted, &obtained, 0);
+    if(!dev){
+        fprintf(stderr, "SDL Open Audio failed, reason:%s\n", SDL_GetError());
+        return -1;
+    }
+    s->frame_bytes = s->channels*sizeof(float);
+    s->step = 2*M_PI*440/obtained.freq;
+    s->period = obtained.samples*1000000LL/obtained.freq;
+    if(s->push){
+        audio_push_init(&ap, dev, obtained.samples*s->frame_bytes, 1000000.0/(obtained.freq*s->frame_bytes));
+        buf = av_malloc(ap.chunk);
+        if(!buf){
+            SDL_CloseAudioDevice(dev);
+            return -1;
+        }
+    }
+
+    getrusage(RUSAGE_SELF, &r0);
+    SDL_PauseAudioDevice(dev, 0);
+    end = av_gettime_relative() + seconds*1000000LL;
+    if(s->push){
+        while(av_gettime_relative() < end){
+            start = av_gettime_relative();
+            while(audio_push_room(&ap)){
+                ToneFill(s, (float *)buf, obtained.samples);
+                if(audio_push(&ap, buf, ap.chunk, 0) < 0)
+                    break;
+            }
+            audio_push_clock(&ap, &pts, &held);
+            s->busy += av_gettime_relative() - start;
+            audio_push_wait(&ap);
+        }
+        s->wakeups = ap.wakeups;
+        s->glitches = ap.dry;
+    }else{
+        SDL_Delay(seconds*1000);
+    }
+    SDL_CloseAudioDevice(dev);
+    getrusage(RUSAGE_SELF, &r1);
+    av_free(buf);
+
+    fprintf(stdout, "%-8s busy %7.1f ms  cpu %7.1f ms  %7lld wakeups  switches %lld/%lld  %lld glitches, %.1f per minute\n",
+            s->push ? "push" : "callback", s->busy/1000.0, (CpuTime(&r1) - CpuTime(&r0))/1000.0, (long long)s->wakeups,
+            (long long)(r1.ru_nvcsw - r0.ru_nvcsw), (long long)(r1.ru_nivcsw - r0.ru_nivcsw),
+            (long long)s->glitches, s->glitches*60.0/seconds);
+    return 0;
+}
+
+int main(int argc, char *argv[]){
+    BenchSink sink;
+    pid_t load[MAX_LOAD];
+    int freq = 48000, channels = 2, samples = 1024, seconds = 10, nb_load = 0;
+    volatile double x = 1.0;
+    int i, mode;
+
+    for(i=1; i<argc && argv[i][0]=='-'; i++){
+        if(!strcmp(argv[i], "-freq") && i+1<argc)
+            freq = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-channels") && i+1<argc)
+            channels = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-samples") && i+1<argc)
+            samples = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-seconds") && i+1<argc)
+            seconds = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-load") && i+1<argc)
+            nb_load = atoi(argv[++i]);
+        else
+            goto usage;
+    }
+    if(i<argc || freq<=0 || channels<=0 || samples<=0 || seconds<=0 || nb_load<0 || nb_load>MAX_LOAD)
+        goto usage;
+
+    //the load is forked before SDL starts its threads
+    for(i=0; i<nb_load; i++){
+        load[i] = fork();
+        if(load[i] == 0)
+            while(1)
+                x = x*1.0000001 + 1.0;
+    }
+
+    if(SDL_Init(SDL_INIT_AUDIO)){
+        fprintf(stderr, "SDL init audio failed\n");
+        goto end;
+    }
+    fprintf(stdout, "audio driver %s, %d Hz %d ch, %d samples per buffer, %d s per sink, %d load processes\n",
+            SDL_GetCurrentAudioDriver(), freq, channels, samples, seconds, nb_load);
+    for(mode=0; mode<2; mode++){
+        memset(&sink, 0, sizeof(sink));
+        sink.push = mode;
+        sink.channels = channels;
+        if(RunSink(&sink, freq, samples, seconds) < 0)
+            break;
+    }
+    SDL_Quit();
+
+end:
+    for(i=0; i<nb_load; i++){
+        if(load[i] > 0){
+            kill(load[i], SIGKILL);
+            waitpid(load[i], NULL, 0);
+        }
+    }
+    return 0;
+
+usage:
+    fprintf(stderr, "Usage: %s [-freq n] [-channels n] [-samples n] [-seconds n] [-load n]\n", argv[0]);
+    return -1;
+}
@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <libavutil/crc.h>
+#include <libavutil/time.h>
+#include "StreamCache.h"
+
+typedef struct StreamCacheHeader{
+    char magic[4];
+    int32_t version;
+    int32_t entry_size;
+    int32_t nb_streams;
+    StreamCacheKey key;
+    int64_t start_time;
+    int64_t duration;
+    int64_t bit_rate;
+}StreamCacheHeader;
+
+/* one stream, followed by extradata_size bytes of extradata in the file */
+typedef struct StreamCacheEntry{
+    int32_t codec_type;
+    int32_t codec_id;
+    uint32_t codec_tag;
+    int32_t format;
+    int64_t bit_rate;
+    int32_t bits_per_coded_sample;
+    int32_t bits_per_raw_sample;
+    int32_t profile;
+    int32_t level;
+    int32_t width;
+    int32_t height;
+    AVRational sample_aspect_ratio;
+    int32_t field_order;
+    int32_t color_range;
+    int32_t color_primaries;
+    int32_t color_trc;
+    int32_t color_space;
+    int32_t chroma_location;
+    int32_t video_delay;
+    uint64_t channel_layout;
+    int32_t channels;
+    int32_t sample_rate;
+    int32_t block_align;
+    int32_t frame_size;
+    int32_t initial_padding;
+    int32_t trailing_padding;
+    int32_t seek_preroll;
+    AVRational time_base;
+    AVRational avg_frame_rate;
+    AVRational r_frame_rate;
+    int64_t start_time;
+    int64_t duration;
+    int32_t extradata_size;
+}StreamCacheEntry;
+
+static const char cache_magic[4] = {'S', 'P', 'S', 'C'};
+
+int stream_cache_key(const char *filename, StreamCacheKey *key){
+    struct stat st;
+    uint8_t *buf;
+    FILE *pFile;
+    size_t size;
+
+    memset(key, 0, sizeof(StreamCacheKey));
+    if(stat(filename, &st) < 0)
+        return -1;
+    key->file_size = st.st_size;
+    key->mtime_sec = st.st_mtim.tv_sec;
+    key->mtime_nsec = st.st_mtim.tv_nsec;
+
+    buf = av_malloc(STREAM_CACHE_HASH_SIZE);
+    pFile = fopen(filename, "rb");
+    if(!buf || !pFile){
+        av_free(buf);
+        if(pFile)
+            fclose(pFile);
+        return -1;
+    }
+    size = fread(buf, 1, STREAM_CACHE_HASH_SIZE, pFile);
+    key->header_crc = av_crc(av_crc_get_table(AV_CRC_32_IEEE), 0, buf, size);
+    fclose(pFile);
+    av_free(buf);
+    return 0;
+}
+
+static void entry_from_stream(StreamCacheEntry *e, AVStream *st){
+    AVCodecParameters *par = st->codecpar;
+
+    memset(e, 0, sizeof(StreamCacheEntry));
+    e->codec_type = par->codec_type;
+    e->codec_id = par->codec_id;
+    e->codec_tag = par->codec_tag;
+    e->format = par->format;
+    e->bit_rate = par->bit_rate;
+    e->bits_per_coded_sample = par->bits_per_coded_sample;
+    e->bits_per_raw_sample = par->bits_per_raw_sample;
+    e->profile = par->profile;
+    e->level = par->level;
+    e->width = par->width;
+    e->height = par->height;
+    e->sample_aspect_ratio = par->sample_aspect_ratio;
+    e->field_order = par->field_order;
+    e->color_range = par->color_range;
+    e->color_primaries = par->color_primaries;
+    e->color_trc = par->color_trc;
+    e->color_space = par->color_space;
+    e->chroma_location = par->chroma_location;
+    e->video_delay = par->video_delay;
+    e->channel_layout = par->channel_layout;
+    e->channels = par->channels;
+    e->sample_rate = par->sample_rate;
+    e->block_align = par->block_align;
+    e->frame_size = par->frame_size;
+    e->initial_padding = par->initial_padding;
+    e->trailing_padding = par->trailing_padding;
+    e->seek_preroll = par->seek_preroll;
+    e->time_base = st->time_base;
+    e->avg_frame_rate = st->avg_frame_rate;
+    e->r_frame_rate = st->r_frame_rate;
+    e->start_time = st->start_time;
+    e->duration = st->duration;
+    e->extradata_size = par->extradata_size;
+}
+
+static void entry_to_stream(StreamCacheEntry *e, uint8_t *extradata, AVStream *st){
+    AVCodecParameters *par = st->codecpar;
+
+    par->codec_type = e->codec_type;
+    par->codec_id = e->codec_id;
+    par->codec_tag = e->codec_tag;
+    par->format = e->format;
+    par->bit_rate = e->bit_rate;
+    par->bits_per_coded_sample = e->bits_per_coded_sample;
+    par->bits_per_raw_sample = e->bits_per_raw_sample;
+    par->profile = e->profile;
+    par->level = e->level;
+    par->width = e->width;
+    par->height = e->height;
+    par->sample_aspect_ratio = e->sample_aspect_ratio;
+    par->field_order = e->field_order;
+    par->color_range = e->color_range;
+    par->color_primaries = e->color_primaries;
+    par->color_trc = e->color_trc;
+    par->color_space = e->color_space;
+    par->chroma_location = e->chroma_location;
+    par->video_delay = e->video_delay;
+    par->channel_layout = e->channel_layout;
+    par->channels = e->channels;
+    par->sample_rate = e->sample_rate;
+    par->block_align = e->block_align;
+    par->frame_size = e->frame_size;
+    par->initial_padding = e->initial_padding;
+    par->trailing_padding = e->trailing_padding;
+    par->seek_preroll = e->seek_preroll;
+    st->avg_frame_rate = e->avg_frame_rate;
+    st->r_frame_rate = e->r_frame_rate;
+    st->start_time = e->start_time;
+    st->duration = e->duration;
+
+    av_freep(&par->extradata);
+    par->extradata = extradata;
+    par->extradata_size = extradata ? e->extradata_size : 0;
+}
+
+/*
+ * All the streams are checked before any of them is changed,
+ * the streams created by the demuxer must be the ones in the sidecar.
+ */
+static int stream_cache_load(AVFormatContext *ctx, const char *path, StreamCacheKey *key){
+    StreamCacheHeader header;
+    StreamCacheEntry *entries = NULL;
+    uint8_t **extradata = NULL;
+    AVStream *st;
+    FILE *pFile;
+    int i, ret = -1;
+
+    pFile = fopen(path, "rb");
+    if(!pFile)
+        return -1;
+
+    if(fread(&header, sizeof(header), 1, pFile) != 1 || memcmp(header.magic, cache_magic, 4)
+            || header.version != STREAM_CACHE_VERSION || header.entry_size != sizeof(StreamCacheEntry)
+            || memcmp(&header.key, key, sizeof(StreamCacheKey)) || header.nb_streams != ctx->nb_streams
+            || header.nb_streams <= 0)
+        goto end;
+
+    entries = av_mallocz_array(header.nb_streams, sizeof(StreamCacheEntry));
+    extradata = av_mallocz_array(header.nb_streams, sizeof(uint8_t *));
+    if(!entries || !extradata)
+        goto end;
+
+    for(i=0; i<header.nb_streams; i++){
+        st = ctx->streams[i];
+        if(fread(&entries[i], sizeof(StreamCacheEntry), 1, pFile) != 1
+                || entries[i].extradata_size < 0 || entries[i].extradata_size > (1<<24))
+            goto end;
+        if(entries[i].extradata_size > 0){
+            extradata[i] = av_mallocz(entries[i].extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+            if(!extradata[i] || fread(extradata[i], entries[i].extradata_size, 1, pFile) != 1)
+                goto end;
+        }
+        if(av_cmp_q(entries[i].time_base, st->time_base)
+                || (st->codecpar->codec_type != AVMEDIA_TYPE_UNKNOWN && st->codecpar->codec_type != entries[i].codec_type))
+            goto end;
+    }
+
+    for(i=0; i<header.nb_streams; i++){
+        entry_to_stream(&entries[i], extradata[i], ctx->streams[i]);
+        extradata[i] = NULL;
+    }
+    if(ctx->start_time == AV_NOPTS_VALUE)
+        ctx->start_time = header.start_time;
+    if(ctx->duration == AV_NOPTS_VALUE)
+        ctx->duration = header.duration;
+    if(!ctx->bit_rate)
+        ctx->bit_rate = header.bit_rate;
+    ret = 0;
+
+end:
+    if(extradata)
+        for(i=0; i<header.nb_streams; i++)
+            av_free(extradata[i]);
+    av_free(extradata);
+    av_free(entries);
+    fclose(pFile);
+    return ret;
+}
+
+/* written to a temporary file and renamed, a reader never sees half of it */
+static int stream_cache_save(AVFormatContext *ctx, const char *path, StreamCacheKey *key){
+    StreamCacheHeader header;
+    StreamCacheEntry entry;
+    char tmp_path[1024];
+    FILE *pFile;
+    int i;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    pFile = fopen(tmp_path, "wb");
+    if(!pFile)
+        return -1;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cache_magic, 4);
+    header.version = STREAM_CACHE_VERSION;
+    header.entry_size = sizeof(StreamCacheEntry);
+    header.nb_streams = ctx->nb_streams;
+    header.key = *key;
+    header.start_time = ctx->start_time;
+    header.duration = ctx->duration;
+    header.bit_rate = ctx->bit_rate;
+    fwrite(&header, sizeof(header), 1, pFile);
+
+    for(i=0; i<ctx->nb_streams; i++){
+        entry_from_stream(&entry, ctx->streams[i]);
+        fwrite(&entry, sizeof(entry), 1, pFile);
+        if(entry.extradata_size > 0)
+            fwrite(ctx->streams[i]->codecpar->extradata, entry.extradata_size, 1, pFile);
+    }
+
+    if(fclose(pFile) != 0 || rename(tmp_path, path) != 0){
+        remove(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+int stream_cache_find_stream_info(AVFormatContext *ctx, const char *filename, int fast_start){
+    StreamCacheKey key;
+    char path[1024];
+    int64_t start = av_gettime_relative();
+    int ret;
+
+    if(!fast_start)
+        return avformat_find_stream_info(ctx, NULL) < 0 ? -1 : 0;
+
+    snprintf(path, sizeof(path), "%s%s", filename, STREAM_CACHE_SUFFIX);
+    if(stream_cache_key(filename, &key) < 0)
+        return avformat_find_stream_info(ctx, NULL) < 0 ? -1 : 0;
+
+    if(stream_cache_load(ctx, path, &key) == 0){
+        fprintf(stdout, "stream info of %s from %s in %.1f ms\n", filename, path, (av_gettime_relative()-start)/1000.0);
+        return 1;
+    }
+
+    ctx->probesize = STREAM_CACHE_PROBESIZE;
+    ctx->max_analyze_duration = STREAM_CACHE_ANALYZEDURATION;
+    ret = avformat_find_stream_info(ctx, NULL);
+    if(ret < 0)
+        return -1;
+    fprintf(stdout, "stream info of %s probed in %.1f ms\n", filename, (av_gettime_relative()-start)/1000.0);
+
+    if(stream_cache_save(ctx, path, &key) < 0)
+        fprintf(stderr, "cannot write %s\n", path);
+    return 0;
+}
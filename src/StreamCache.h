@@ -0,0 +1,33 @@
+#ifndef __INCLUDED_STREAMCACHE_H__
+#define __INCLUDED_STREAMCACHE_H__
+#include <libavformat/avformat.h>
+
+/*
+ * Fast start:
+ *   1. the stream parameters found by avformat_find_stream_info are saved into a sidecar
+ *      file <mediafile>.spcache, keyed by file size, mtime and a crc of the file header
+ *   2. later opens of the same file take the parameters from the sidecar and skip probing
+ *   3. without a valid sidecar probing is bounded by STREAM_CACHE_PROBESIZE/ANALYZEDURATION
+ */
+#define STREAM_CACHE_PROBESIZE       (512*1024)
+#define STREAM_CACHE_ANALYZEDURATION 1000000    //usecond
+#define STREAM_CACHE_HASH_SIZE       (64*1024)  //bytes of the file header in the key
+#define STREAM_CACHE_SUFFIX          ".spcache"
+#define STREAM_CACHE_VERSION         1
+
+typedef struct StreamCacheKey{
+    int64_t file_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t header_crc;        //crc of the first STREAM_CACHE_HASH_SIZE bytes
+}StreamCacheKey;
+
+/* key of the file as it is now, return <0 if it cannot be read */
+int stream_cache_key(const char *filename, StreamCacheKey *key);
+
+/*
+ * Replace avformat_find_stream_info after avformat_open_input.
+ * Return 1 when the parameters come from the sidecar, 0 when probed, <0 for error.
+ */
+int stream_cache_find_stream_info(AVFormatContext *ctx, const char *filename, int fast_start);
+#endif
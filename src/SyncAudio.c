@@ -3,6 +3,7 @@
 #include <SDL2/SDL.h>
 
 #include "Queue.h"
+#include "SampleConvert.h"
 
 #define SAVE_FRAMES 2000
 #define DEF_SAMPLES 2048
@@ -70,9 +71,9 @@ void dumpAudioInfo(AVCodecContext *pCodecCtx){
 void SaveFrame2PCM(AVFrame *pFrame, int size, int iFrame){
     static FILE *pFile;
     char szFilename[32];
-    unsigned int sample_count, i;
-    float *channel0, *channel1;
-    short sample0, sample1;
+    static int16_t *pcm;
+    static unsigned int pcm_count;
+    unsigned int sample_count;
 
     //Open file
     if(iFrame==1){
@@ -83,18 +84,22 @@ void SaveFrame2PCM(AVFrame *pFrame, int size, int iFrame){
     }
 
     sample_count = pFrame->nb_samples;
-    channel0 = (float *)pFrame->data[0];
-    channel1 = (float *)pFrame->data[1];
     //Write YUV Data, Only support YUV420
     //normal PCM is mixed track, but fltp "p" means planar
     if(pFrame->format == AV_SAMPLE_FMT_FLTP) 
     {
-        for(i=0; i<sample_count; i++){ //stereo 
-            sample0 = (short)(channel0[i]*32767.0f);
-            sample1 = (short)(channel1[i]*32767.0f);
-            fwrite(&sample0, 2, 1, pFile);
-            fwrite(&sample1, 2, 1, pFile);
+        //stereo, converted at once and written with one call
+        if(sample_count > pcm_count){
+            av_free(pcm);
+            pcm = av_malloc(sample_count*2*sizeof(int16_t));
+            if(pcm == NULL){
+                pcm_count = 0;
+                return;
+            }
+            pcm_count = sample_count;
         }
+        sample_fltp_to_s16(pcm, (const float **)pFrame->data, 2, sample_count);
+        fwrite(pcm, sizeof(int16_t), sample_count*2, pFile);
     }else{
         fwrite(pFrame->extended_data[0], 1, size, pFile);
     }
@@ -102,6 +107,8 @@ void SaveFrame2PCM(AVFrame *pFrame, int size, int iFrame){
     //Close FIle
     if(iFrame==SAVE_FRAMES){
         fclose(pFile);
+        av_freep(&pcm);
+        pcm_count = 0;
     }
 }
 
@@ -111,14 +118,12 @@ int main(int argc, char *argv[]){
     AVCodec *pCodec = NULL;
     AVPacket packet;
     AVFrame *pFrame = NULL;
-    int i = 0, AudioStream = -1, frameFinished, size=0;
+    int AudioStream = -1, frameFinished, size=0;
     SDL_AudioSpec wanted, obtained;
     void *buf=NULL, *ptr;
     short *itr;
     int frame_size, write_size, left_size;
     unsigned int sample_count;
-    float *channel0, *channel1;
-    short sample0, sample1;
     unsigned int audio_sleep;
 
     pFile = fopen("audio.pcm", "rb");
@@ -218,17 +223,11 @@ int main(int argc, char *argv[]){
                 itr = (short *)buf;
                 //SaveFrame2PCM(pFrame, size, i);
                 sample_count = pFrame->nb_samples;
-                channel0 = (float *)pFrame->data[0];
-                channel1 = (float *)pFrame->data[1];
                 //normal PCM is mixed track, but fltp "p" means planar
                 if(pFrame->format == AV_SAMPLE_FMT_FLTP) 
                 {
-                    for(i=0; i<sample_count; i++){ //stereo 
-                        sample0 = (short)(channel0[i]*32767.0f);
-                        sample1 = (short)(channel1[i]*32767.0f);
-                        itr[2*i] = sample0;
-                        itr[2*i+1] = sample1;
-                    }
+                    //stereo
+                    sample_fltp_to_s16(itr, (const float **)pFrame->data, 2, sample_count);
                     frame_size = sample_count*4;
                 }else{
                     memcpy(itr, pFrame->data[0], pFrame->linesize[0]);
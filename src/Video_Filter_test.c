@@ -12,6 +12,7 @@
 
 #include "Queue.h"
 #include "Clock.h"
+#include "DecoderThreads.h"
 
 #define DEF_SAMPLES 2048
 #define DATATEST 30
@@ -557,6 +558,7 @@ int ReadThread(void *arg){
 int CodecInit(int type, AVFormatContext *pFormatCtx, Codec *c){
     AVCodecContext *pCodecCtx = NULL;
     AVCodec *pCodec = NULL;
+    ThreadConfig tc;
     int audioVideo = -1;
     int Stream = -1;
 
@@ -605,8 +607,8 @@ int CodecInit(int type, AVFormatContext *pFormatCtx, Codec *c){
         fprintf(stdout, "codec id is %d\n", pCodecCtx->codec_id);
     }
 
-    pCodecCtx->thread_count = 4;
-    pCodecCtx->thread_type = FF_THREAD_SLICE;
+    thread_config_default(&tc);
+    thread_config_apply(pCodecCtx, pCodec, &tc);
 
     if(avcodec_open2(pCodecCtx, pCodec, NULL)<0){
         fprintf(stderr, "open codec failed\n");